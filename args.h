@@ -8,13 +8,33 @@
 
 
 struct pargs {
+    program_command command;
     program_mode mode;
     data_type type;
     bool readCores;
     bool writeCores;
+    bool splitChromosomes;
+    size_t segmentLength;
+    std::string bedFile;
+    std::string referenceFile;
+    std::string databaseFile;
+    std::string updateFile;
+    bool writeState;
+    uint16_t skipFlags;
+    uint16_t requiredFlags;
     std::string prefix;
+    output_format format;
     size_t threadNumber;
     size_t lcpLevel;
+    size_t scale;
+    size_t memoryBudget;
+    size_t shardIndex;
+    size_t shardCount;
+    size_t shardBegin;
+    size_t shardEnd;
+    size_t topK;
+    size_t prefilterScale;
+    bool usePostings;
     bool verbose;
 };
 
@@ -22,10 +42,12 @@ struct pargs {
 struct targs {
     std::string inFileName;
     std::string outFileName;
+    std::string sketchFileName;
     std::string shortName;
     std::vector<uint32_t> cores;
     std::vector<size_t> counts;
     size_t size;
+    size_t scale;
 };
 
 
@@ -0,0 +1,236 @@
+/**
+ * @file    intersect_bench.cpp
+ * @brief   Microbenchmark of the comparison of two genomes on synthetic sorted core sets.
+ *
+ * Pairs of sorted sets with random counts are generated at several sizes, size ratios and overlaps,
+ * the overlap being the fraction of the smaller set found in the larger one. Every pair is compared
+ * in `VECTOR` mode by:
+ * - `fused`, the single merge loop over all cores that preceded `intersectSorted()`,
+ * - `scalar`, `sse2`, `avx2` and `gallop`, the loop of `compareCores()` over one kernel of
+ *   `intersectSorted()` only, the remaining elements being merged by the scalar kernel,
+ * - `dispatch`, `compareCores()` itself, i.e. the kernel chosen by `intersectSorted()`.
+ * All variants must give the same comparison. The throughput is reported in millions of merged
+ * elements, the sum of both set sizes, per second, best of the repetitions.
+ *
+ * Usage: ./bin/intersect_bench [elements of the smaller set] [repetitions]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include "similarity_metrics.cpp"
+
+
+typedef size_t (*kernel)( const uint32_t*, size_t, const uint32_t*, size_t, size_t&, size_t&, size_t*, size_t*, size_t );
+
+
+// the merge loop of compareCores() before intersectSorted(), in VECTOR mode
+static void compareFused( const struct targs& argument1, const struct targs& argument2, const size_t total1, const size_t total2, struct comparison& result ) {
+
+    const double depth1 = 1, depth2 = static_cast<double>(argument2.size) / static_cast<double>(argument1.size);
+    const size_t size1 = argument1.cores.size(), size2 = argument2.cores.size();
+
+    size_t interSize = 0, i = 0, j = 0;
+    double shared = 0.0;
+
+    while ( i < size1 && j < size2 ) {
+        if ( argument1.cores[i] < argument2.cores[j] ) {
+            i++;
+        } else if ( argument1.cores[i] > argument2.cores[j] ) {
+            j++;
+        } else {
+            const size_t count1 = argument1.counts[i++], count2 = argument2.counts[j++];
+            interSize += std::min(count1, count2);
+            shared += 2 * std::min(count1 * depth2, count2 * depth1);
+        }
+    }
+
+    result.interSize = interSize;
+    result.unionSize = total1 + total2 - interSize;
+    result.denominator = total1 * depth2 + total2 * depth1;
+    result.numerator = result.denominator - shared;
+};
+
+
+// the loop of compareCores() over a single kernel
+static void compareKernel( kernel blocks, const struct targs& argument1, const struct targs& argument2, const size_t total1, const size_t total2, struct comparison& result ) {
+
+    size_t matches1[INTERSECTION_BUFFER_SIZE], matches2[INTERSECTION_BUFFER_SIZE];
+    size_t i = 0, j = 0;
+
+    const size_t size1 = argument1.cores.size(), size2 = argument2.cores.size();
+    const double depth1 = 1, depth2 = static_cast<double>(argument2.size) / static_cast<double>(argument1.size);
+
+    size_t interSize = 0;
+    double shared = 0.0;
+
+    while ( i < size1 && j < size2 ) {
+        size_t count = blocks( argument1.cores.data(), size1, argument2.cores.data(), size2, i, j, matches1, matches2, INTERSECTION_BUFFER_SIZE );
+
+        if ( count + 8 <= INTERSECTION_BUFFER_SIZE ) {
+            count += intersectScalar( argument1.cores.data(), size1, argument2.cores.data(), size2, i, j, matches1 + count, matches2 + count, INTERSECTION_BUFFER_SIZE - count );
+        }
+
+        for ( size_t k = 0; k < count; k++ ) {
+            const size_t count1 = argument1.counts[matches1[k]], count2 = argument2.counts[matches2[k]];
+
+            interSize += std::min(count1, count2);
+            shared += 2 * std::min(count1 * depth2, count2 * depth1);
+        }
+    }
+
+    result.interSize = interSize;
+    result.unionSize = total1 + total2 - interSize;
+    result.denominator = total1 * depth2 + total2 * depth1;
+    result.numerator = result.denominator - shared;
+};
+
+
+static size_t gallopKernel( const uint32_t* set1, size_t size1, const uint32_t* set2, size_t size2, size_t& i, size_t& j, size_t* matches1, size_t* matches2, size_t capacity ) {
+    if ( size1 <= size2 ) {
+        return intersectGalloping( set1, size1, set2, size2, i, j, matches1, matches2, capacity );
+    }
+    return intersectGalloping( set2, size2, set1, size1, j, i, matches2, matches1, capacity );
+};
+
+
+static void makePair( size_t small, size_t ratio, double overlap, std::mt19937& random, struct targs& argument1, struct targs& argument2 ) {
+
+    const size_t large = small * ratio;
+    const size_t common = static_cast<size_t>( overlap * small );
+
+    // distinct labels, split into the common part and the parts of either set
+    std::vector<uint32_t> labels;
+    labels.reserve( small + large );
+
+    while ( labels.size() < small + large - common ) {
+        const size_t missing = small + large - common - labels.size();
+        for ( size_t k = 0; k < missing + missing / 8; k++ ) {
+            labels.push_back( random() );
+        }
+        std::sort( labels.begin(), labels.end() );
+        labels.erase( std::unique( labels.begin(), labels.end() ), labels.end() );
+    }
+
+    std::shuffle( labels.begin(), labels.end(), random );
+
+    argument1.cores.assign( labels.begin(), labels.begin() + small );
+    argument2.cores.assign( labels.begin(), labels.begin() + common );
+    argument2.cores.insert( argument2.cores.end(), labels.begin() + small, labels.begin() + small + large - common );
+
+    std::sort( argument1.cores.begin(), argument1.cores.end() );
+    std::sort( argument2.cores.begin(), argument2.cores.end() );
+
+    std::uniform_int_distribution<size_t> counts( 1, 8 );
+    argument1.counts.resize( argument1.cores.size() );
+    argument2.counts.resize( argument2.cores.size() );
+
+    for ( size_t k = 0; k < argument1.counts.size(); k++ ) {
+        argument1.counts[k] = counts( random );
+    }
+    for ( size_t k = 0; k < argument2.counts.size(); k++ ) {
+        argument2.counts[k] = counts( random );
+    }
+
+    argument1.size = argument1.cores.size() * 10;
+    argument2.size = argument2.cores.size() * 10;
+};
+
+
+static bool same( const struct comparison& a, const struct comparison& b ) {
+    return a.interSize == b.interSize && a.unionSize == b.unionSize && a.numerator == b.numerator && a.denominator == b.denominator;
+};
+
+
+enum variant { FUSED, SCALAR, SSE2, AVX2, GALLOP, DISPATCH };
+
+
+static void compare( variant v, const struct targs& argument1, const struct targs& argument2, const size_t total1, const size_t total2, struct comparison& result ) {
+    switch ( v ) {
+        case FUSED: compareFused( argument1, argument2, total1, total2, result ); break;
+        case SCALAR: compareKernel( intersectScalar, argument1, argument2, total1, total2, result ); break;
+#ifdef SIMD_INTERSECTION
+        case SSE2: compareKernel( intersectSSE2, argument1, argument2, total1, total2, result ); break;
+        case AVX2: compareKernel( intersectAVX2, argument1, argument2, total1, total2, result ); break;
+#endif
+        case GALLOP: compareKernel( gallopKernel, argument1, argument2, total1, total2, result ); break;
+        default: compareCores<VECTOR>( argument1, argument2, total1, total2, result ); break;
+    }
+};
+
+
+int main( int argc, char** argv ) {
+
+    const size_t elements = argc > 1 ? strtoull( argv[1], NULL, 10 ) : 1048576;
+    const size_t repetitions = argc > 2 ? strtoull( argv[2], NULL, 10 ) : 5;
+
+    std::vector<variant> variants;
+    variants.push_back( FUSED );
+    variants.push_back( SCALAR );
+#ifdef SIMD_INTERSECTION
+    variants.push_back( SSE2 );
+    if ( __builtin_cpu_supports("avx2") ) {
+        variants.push_back( AVX2 );
+    }
+#endif
+    variants.push_back( GALLOP );
+    variants.push_back( DISPATCH );
+
+    const char* names[] = { "fused", "scalar", "sse2", "avx2", "gallop", "dispatch" };
+    const size_t ratios[] = { 1, 2, 4, 8, 16, 32, 64 };
+    const double overlaps[] = { 0.01, 0.1, 0.5, 0.9, 0.99, 1.0 };
+
+    printf( "# smaller set of %zu elements, best of %zu repetitions, Melem/s\n", elements, repetitions );
+    printf( "ratio\toverlap" );
+    for ( std::vector<variant>::const_iterator v = variants.begin(); v != variants.end(); v++ ) {
+        printf( "\t%s", names[*v] );
+    }
+    printf( "\n" );
+
+    std::mt19937 random( 42 );
+
+    for ( size_t r = 0; r < sizeof(ratios) / sizeof(ratios[0]); r++ ) {
+        for ( size_t o = 0; o < sizeof(overlaps) / sizeof(overlaps[0]); o++ ) {
+
+            struct targs argument1, argument2;
+            makePair( elements, ratios[r], overlaps[o], random, argument1, argument2 );
+
+            const size_t total1 = calculateCountTotal( argument1 ), total2 = calculateCountTotal( argument2 );
+            const double merged = argument1.cores.size() + argument2.cores.size();
+
+            struct comparison reference;
+            compareFused( argument1, argument2, total1, total2, reference );
+
+            printf( "%zu\t%.2f", ratios[r], overlaps[o] );
+
+            for ( std::vector<variant>::const_iterator v = variants.begin(); v != variants.end(); v++ ) {
+                double best = 0;
+
+                for ( size_t k = 0; k < repetitions; k++ ) {
+                    struct comparison result;
+                    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    compare( *v, argument1, argument2, total1, total2, result );
+                    const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+                    best = std::max( best, merged / seconds / 1e6 );
+
+                    if ( !same( result, reference ) ) {
+                        fprintf( stderr, "%s differs from the fused loop at ratio %zu and overlap %.2f\n", names[*v], ratios[r], overlaps[o] );
+                        return 1;
+                    }
+                }
+
+                printf( "\t%.0f", best );
+            }
+
+            printf( "\n" );
+            fflush( stdout );
+        }
+    }
+
+    return 0;
+};
@@ -0,0 +1,150 @@
+/**
+ * @file    queue_bench.cpp
+ * @brief   Microbenchmark of the queues exchanging read batches between FASTQ producers and workers.
+ *
+ * Every producer and consumer thread count of 1, 2, 4, ..., 64 is run with `LockFreeQueue` and
+ * `ThreadSafeQueue`, in the pattern of `read_fastqs()`: `BATCHES_PER_THREAD` batches per consumer
+ * and one per producer circulate between a task queue and a free queue, producers queue a batch and
+ * take an empty one, and consumers take a full batch, work on it and return it. The work per batch
+ * is a number of dependent multiplications, 0 to measure the exchange alone.
+ *
+ * Usage: ./bin/queue_bench [batches per run] [work per batch]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include "utils/LockFreeQueue.hpp"
+#include "utils/ThreadSafeQueue.hpp"
+
+#ifndef BENCH_MAX_THREADS
+#define BENCH_MAX_THREADS 64
+#endif
+
+#ifndef BATCHES_PER_THREAD
+#define BATCHES_PER_THREAD 2
+#endif
+
+
+// same layout as `Task` of rfastq.h, so moving a batch costs the same
+struct Batch {
+    size_t sample;
+    std::string bases;
+    std::vector<size_t> ends;
+};
+
+
+static uint64_t work( uint64_t seed, size_t steps ) {
+    for ( size_t i = 0; i < steps; i++ ) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    }
+    return seed;
+};
+
+
+template <template <typename> class Queue>
+static double run( size_t producers, size_t consumers, size_t batches, size_t steps ) {
+
+    const size_t batch_count = BATCHES_PER_THREAD * consumers + producers;
+    Queue<Batch> task_queue( batch_count );
+    Queue<Batch> free_queue( batch_count );
+
+    for ( size_t i = 0; i < batch_count; i++ ) {
+        Batch batch;
+        batch.bases.reserve( 64 );
+        batch.ends.reserve( 4 );
+        free_queue.push( std::move(batch) );
+    }
+
+    std::atomic<uint64_t> checksum(0), consumed(0);
+    std::vector<std::thread> threads;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for ( size_t c = 0; c < consumers; c++ ) {
+        threads.emplace_back( [&]() {
+            Batch batch;
+            uint64_t sum = 0, count = 0;
+
+            while ( task_queue.pop(batch) ) {
+                sum += work( batch.sample, steps );
+                count++;
+                batch.ends.clear();
+                free_queue.push( std::move(batch) );
+            }
+
+            checksum += sum;
+            consumed += count;
+        });
+    }
+
+    std::vector<std::thread> producing;
+
+    for ( size_t p = 0; p < producers; p++ ) {
+        producing.emplace_back( [&, p]() {
+            Batch batch;
+            free_queue.pop( batch );
+
+            // the batches are split evenly, the first producers take the remainder
+            for ( size_t i = p; i < batches; i += producers ) {
+                batch.sample = i;
+                batch.ends.push_back( i );
+                task_queue.push( std::move(batch) );
+                free_queue.pop( batch );
+            }
+        });
+    }
+
+    for ( std::vector<std::thread>::iterator it = producing.begin(); it != producing.end(); it++ ) {
+        it->join();
+    }
+
+    task_queue.markFinished();
+
+    for ( std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++ ) {
+        it->join();
+    }
+
+    const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+    // every batch is consumed exactly once
+    uint64_t expected = 0;
+    for ( size_t i = 0; i < batches; i++ ) {
+        expected += work( i, steps );
+    }
+
+    if ( consumed != batches || checksum != expected ) {
+        fprintf( stderr, "Lost batches with %zu producers and %zu consumers\n", producers, consumers );
+        exit(1);
+    }
+
+    return batches / seconds;
+};
+
+
+int main( int argc, char** argv ) {
+
+    const size_t batches = argc > 1 ? strtoull( argv[1], NULL, 10 ) : 200000;
+    const size_t steps = argc > 2 ? strtoull( argv[2], NULL, 10 ) : 0;
+
+    printf( "# %zu batches per run, %zu steps of work per batch, %u hardware threads\n", batches, steps, std::thread::hardware_concurrency() );
+    printf( "producers\tconsumers\tlockfree_batches/s\tmutex_batches/s\tratio\n" );
+
+    for ( size_t producers = 1; producers <= BENCH_MAX_THREADS; producers *= 2 ) {
+        for ( size_t consumers = 1; consumers <= BENCH_MAX_THREADS; consumers *= 2 ) {
+            const double lockfree = run<LockFreeQueue>( producers, consumers, batches, steps );
+            const double mutex = run<ThreadSafeQueue>( producers, consumers, batches, steps );
+
+            printf( "%zu\t%zu\t%.0f\t%.0f\t%.2f\n", producers, consumers, lockfree, mutex, lockfree / mutex );
+            fflush( stdout );
+        }
+    }
+
+    return 0;
+};
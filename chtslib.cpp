@@ -1,19 +1,35 @@
 #include "chtslib.h"
 
 
-chtslib::chtslib(const char* filename) : fp_in(nullptr), bam_hdr(nullptr), bam_file_index(nullptr) {
+chtslib::chtslib(const char* filename, const char* reference, bool require_index) : fp_in(nullptr), bam_hdr(nullptr), bam_file_index(nullptr) {
+    // "-" reads from standard input
     this->fp_in = sam_open(filename, "r");
     if (!this->fp_in) {
         throw std::runtime_error("Error opening file: " + std::string(filename));
     }
+    // CRAM records are decoded against the reference
+    if (reference && hts_set_fai_filename(this->fp_in, reference) != 0) {
+        sam_close(this->fp_in);
+        throw std::runtime_error("Error setting reference: " + std::string(reference));
+    }
+    // CRAM records only decode the fields of the flag filter, the regions and the sequence
+    if (this->fp_in->is_cram) {
+        hts_set_opt(this->fp_in, CRAM_OPT_REQUIRED_FIELDS, SAM_FLAG | SAM_RNAME | SAM_POS | SAM_SEQ);
+        hts_set_opt(this->fp_in, CRAM_OPT_DECODE_MD, 0);
+    }
     this->bam_hdr = sam_hdr_read(this->fp_in);
     if (this->bam_hdr == NULL) {
         sam_close(this->fp_in);
         throw std::runtime_error("Error reading BAM header");
     }
-    this->bam_file_index = sam_index_load(this->fp_in, this->fp_in->fn);
-    if (!this->bam_file_index) {
-        throw std::runtime_error("Error creating BAM index");
+    // a stream cannot be indexed, files without an index are read sequentially
+    if (strcmp(filename, "-") != 0) {
+        this->bam_file_index = sam_index_load(this->fp_in, this->fp_in->fn);
+    }
+    if (!this->bam_file_index && require_index) {
+        bam_hdr_destroy(this->bam_hdr);
+        sam_close(this->fp_in);
+        throw std::runtime_error("Error loading BAM index");
     }
 };
 
@@ -39,6 +55,16 @@ int chtslib::read(bam1_t *aln) {
 };
 
 
+int chtslib::read(hts_itr_t *iter, bam1_t *aln) {
+    return sam_itr_next(this->fp_in, iter, aln);
+};
+
+
+int chtslib::set_threads(int threads) {
+    return hts_set_threads(this->fp_in, threads);
+};
+
+
 hts_itr_t* chtslib::create_iter(int tid, hts_pos_t beg, hts_pos_t end) {
     return sam_itr_queryi( this->bam_file_index, tid, beg, end);
 };
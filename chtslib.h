@@ -3,6 +3,7 @@
 
 #include <string>
 #include <stdexcept>
+#include <cstring>
 #include <htslib/sam.h>
 #include <htslib/bgzf.h>
 #include <sys/stat.h>
@@ -13,10 +14,12 @@ public:
     bam_hdr_t *bam_hdr;
     hts_idx_t *bam_file_index;
 
-    chtslib(const char* filename);
+    chtslib(const char* filename, const char* reference = NULL, bool require_index = false);
     ~chtslib();
 
     int read(bam1_t *aln);
+    int read(hts_itr_t *iter, bam1_t *aln);
+    int set_threads(int threads);
     hts_itr_t* create_iter(int tid, hts_pos_t beg, hts_pos_t end);
 };
 
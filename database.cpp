@@ -0,0 +1,332 @@
+#include "database.h"
+
+
+void build_index( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments ) {
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    const size_t numGenomes = thread_arguments.size();
+
+    struct database_header header;
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, DATABASE_MAGIC, 4 );
+    header.version = DATABASE_VERSION;
+    header.lcp_level = program_arguments.lcpLevel;
+    header.scale = std::max( thread_arguments[0].scale, (size_t)1 );
+    header.genomes = numGenomes;
+
+    std::string names;
+    std::vector<struct genome_stats> stats;
+    std::vector<uint64_t> signature_offsets( 1, 0 );
+
+    for ( std::vector<struct targs>::const_iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+        names += trimmed_name( it->shortName ) + "\n";
+
+        struct genome_stats genome = { it->size, it->cores.size(), calculateCountTotal( *it ) };
+        stats.push_back( genome );
+
+        signature_offsets.push_back( signature_offsets.back() + it->cores.size() );
+    }
+
+    header.postings = signature_offsets.back();
+    header.names_length = names.size();
+
+    // k-way merge of the signatures, the postings of a label are ordered by genome
+    std::vector<uint32_t> labels;
+    std::vector<uint64_t> label_offsets;
+    std::vector<uint32_t> posting_genomes;
+    std::vector<uint64_t> posting_counts;
+    posting_genomes.reserve( header.postings );
+    posting_counts.reserve( header.postings );
+
+    typedef std::pair<uint32_t, uint32_t> entry;
+    std::priority_queue<entry, std::vector<entry>, std::greater<entry>> heap;
+    std::vector<size_t> cursors( numGenomes, 0 );
+
+    for ( size_t i = 0; i < numGenomes; i++ ) {
+        if ( !thread_arguments[i].cores.empty() ) {
+            heap.push( entry( thread_arguments[i].cores[0], i ) );
+        }
+    }
+
+    while ( !heap.empty() ) {
+        const entry top = heap.top();
+        heap.pop();
+
+        if ( labels.empty() || labels.back() != top.first ) {
+            labels.push_back( top.first );
+            label_offsets.push_back( posting_genomes.size() );
+        }
+
+        const struct targs& genome = thread_arguments[top.second];
+        size_t& cursor = cursors[top.second];
+
+        posting_genomes.push_back( top.second );
+        posting_counts.push_back( genome.counts[cursor] );
+
+        if ( ++cursor < genome.cores.size() ) {
+            heap.push( entry( genome.cores[cursor], top.second ) );
+        }
+    }
+
+    label_offsets.push_back( posting_genomes.size() );
+    header.labels = labels.size();
+
+    const std::string& filename = program_arguments.databaseFile;
+    const std::string temporary = filename + ".tmp";
+
+    std::ofstream out( temporary, std::ios::binary );
+
+    if ( !out ) {
+        log(ERROR, "Couldn't open %s", temporary.c_str());
+        exit(1);
+    }
+
+    write_section( out, &header, sizeof(header) );
+    write_section( out, names.data(), names.size() );
+    write_section( out, stats.data(), stats.size() * sizeof(struct genome_stats) );
+    write_section( out, signature_offsets.data(), signature_offsets.size() * sizeof(uint64_t) );
+
+    // signatures are written genome by genome, counts as 64-bit integers
+    for ( std::vector<struct targs>::const_iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+        out.write( reinterpret_cast<const char*>(it->cores.data()), it->cores.size() * sizeof(uint32_t) );
+    }
+    write_padding( out, header.postings * sizeof(uint32_t) );
+
+    for ( std::vector<struct targs>::const_iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+        std::vector<uint64_t> counts( it->counts.begin(), it->counts.end() );
+        out.write( reinterpret_cast<const char*>(counts.data()), counts.size() * sizeof(uint64_t) );
+    }
+
+    write_section( out, labels.data(), labels.size() * sizeof(uint32_t) );
+    write_section( out, label_offsets.data(), label_offsets.size() * sizeof(uint64_t) );
+    write_section( out, posting_genomes.data(), posting_genomes.size() * sizeof(uint32_t) );
+    write_section( out, posting_counts.data(), posting_counts.size() * sizeof(uint64_t) );
+
+    out.close();
+
+    if ( out.fail() || rename( temporary.c_str(), filename.c_str() ) != 0 ) {
+        log(ERROR, "Failed to write %s", filename.c_str());
+        exit(1);
+    }
+
+    double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    log(INFO, "Indexed %zu genomes, %zu distinct cores and %zu postings in %.2f seconds", numGenomes, labels.size(), posting_genomes.size(), seconds);
+};
+
+
+void open_database( const std::string& filename, struct database& db ) {
+
+    db.file = new MmapFile( filename.c_str() );
+
+    if ( !(*db.file) || db.file->size() < sizeof(struct database_header) ) {
+        log(ERROR, "Couldn't open database %s", filename.c_str());
+        exit(1);
+    }
+
+    memcpy( &db.header, db.file->data(), sizeof(struct database_header) );
+
+    if ( memcmp( db.header.magic, DATABASE_MAGIC, 4 ) != 0 || db.header.version != DATABASE_VERSION ) {
+        log(ERROR, "Invalid database file %s", filename.c_str());
+        exit(1);
+    }
+
+    const struct database_header& header = db.header;
+
+    // sections, in the order of build_index()
+    size_t offsets[10];
+    offsets[0] = section_size( sizeof(struct database_header) );
+    offsets[1] = offsets[0] + section_size( header.names_length );
+    offsets[2] = offsets[1] + section_size( header.genomes * sizeof(struct genome_stats) );
+    offsets[3] = offsets[2] + section_size( ( header.genomes + 1 ) * sizeof(uint64_t) );
+    offsets[4] = offsets[3] + section_size( header.postings * sizeof(uint32_t) );
+    offsets[5] = offsets[4] + section_size( header.postings * sizeof(uint64_t) );
+    offsets[6] = offsets[5] + section_size( header.labels * sizeof(uint32_t) );
+    offsets[7] = offsets[6] + section_size( ( header.labels + 1 ) * sizeof(uint64_t) );
+    offsets[8] = offsets[7] + section_size( header.postings * sizeof(uint32_t) );
+    offsets[9] = offsets[8] + section_size( header.postings * sizeof(uint64_t) );
+
+    if ( db.file->size() != offsets[9] ) {
+        log(ERROR, "Database file %s is truncated.", filename.c_str());
+        exit(1);
+    }
+
+    const char* data = db.file->data();
+
+    // only the postings of the cores of the queries are visited
+    madvise( const_cast<char*>(data), db.file->size(), MADV_RANDOM );
+
+    db.names.clear();
+    std::string names( data + offsets[0], header.names_length );
+    std::stringstream ss( names );
+    std::string name;
+
+    while ( std::getline( ss, name ) ) {
+        db.names.push_back( name );
+    }
+
+    db.stats = reinterpret_cast<const struct genome_stats*>( data + offsets[1] );
+    db.signature_offsets = reinterpret_cast<const uint64_t*>( data + offsets[2] );
+    db.signature_labels = reinterpret_cast<const uint32_t*>( data + offsets[3] );
+    db.signature_counts = reinterpret_cast<const uint64_t*>( data + offsets[4] );
+    db.labels = reinterpret_cast<const uint32_t*>( data + offsets[5] );
+    db.label_offsets = reinterpret_cast<const uint64_t*>( data + offsets[6] );
+    db.posting_genomes = reinterpret_cast<const uint32_t*>( data + offsets[7] );
+    db.posting_counts = reinterpret_cast<const uint64_t*>( data + offsets[8] );
+};
+
+
+void close_database( struct database& db ) {
+    delete db.file;
+    db.file = NULL;
+};
+
+
+void query_database( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const struct database& db ) {
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<std::vector<struct query_hit>> hits( thread_arguments.size() );
+    std::atomic<size_t> next(0), postings(0);
+    std::vector<std::thread> threads;
+
+    for ( size_t i = 0; i < std::min( thread_arguments.size(), program_arguments.threadNumber ); i++ ) {
+        threads.emplace_back( query_genomes, std::cref(thread_arguments), std::cref(program_arguments), std::cref(db), std::ref(next), std::ref(hits), std::ref(postings) );
+    }
+
+    for ( std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++ ) {
+        if ((*it).joinable()) {
+            (*it).join();
+        }
+    }
+
+    std::string filename = program_arguments.prefix + ".query.tsv";
+    std::ofstream out( filename );
+
+    if ( !out ) {
+        log(ERROR, "Couldn't open %s", filename.c_str());
+        exit(1);
+    }
+
+    out << "query\treference\tjaccard\tdice\tns\tcontainment\tshared" << std::endl;
+
+    std::string line;
+    char number[FORMAT_BUFFER_SIZE];
+
+    for ( size_t i = 0; i < thread_arguments.size(); i++ ) {
+        const std::string& shortName = thread_arguments[i].shortName;
+        const std::string query = trimmed_name( shortName );
+
+        for ( std::vector<struct query_hit>::const_iterator hit = hits[i].begin(); hit != hits[i].end(); hit++ ) {
+            line = query + "\t" + db.names[hit->genome];
+
+            const double values[4] = { hit->jaccard, hit->dice, hit->distance, hit->containment };
+            for ( size_t k = 0; k < 4; k++ ) {
+                line += '\t';
+                line.append( number, format_fixed( values[k], number ) );
+            }
+
+            line += '\t' + std::to_string( hit->distinct ) + '\n';
+            out.write( line.data(), line.size() );
+        }
+    }
+
+    out.close();
+
+    if ( out.fail() ) {
+        log(ERROR, "Failed to write %s", filename.c_str());
+        exit(1);
+    }
+
+    if ( program_arguments.verbose ) {
+        double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+        log(INFO, "Queried %zu genomes against %zu references in %.2f seconds, %zu postings visited", thread_arguments.size(), (size_t)db.header.genomes, seconds, postings.load());
+    }
+};
+
+
+void query_genomes( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const struct database& db, std::atomic<size_t>& next, std::vector<std::vector<struct query_hit>>& hits, std::atomic<size_t>& postings ) {
+
+    const size_t numReferences = db.header.genomes;
+    const bool set = program_arguments.type == SET;
+
+    std::vector<struct query_term> terms( numReferences );
+    std::vector<double> depths( numReferences );
+    std::vector<uint32_t> touched;
+    size_t matches1[INTERSECTION_BUFFER_SIZE], matches2[INTERSECTION_BUFFER_SIZE];
+    size_t visited = 0;
+    size_t index;
+
+    while ( ( index = next++ ) < thread_arguments.size() ) {
+        const struct targs& query = thread_arguments[index];
+
+        // relative depths of the references, as in compareCores()
+        for ( size_t g = 0; g < numReferences; g++ ) {
+            depths[g] = static_cast<double>(db.stats[g].size) / static_cast<double>(query.size);
+        }
+
+        struct intersection_cursor cursor = { 0, 0, false };
+        const size_t size1 = query.cores.size();
+
+        while ( cursor.position1 < size1 && cursor.position2 < db.header.labels ) {
+            size_t count = intersectSorted( query.cores.data(), size1, db.labels, db.header.labels, cursor, matches1, matches2, INTERSECTION_BUFFER_SIZE );
+
+            for ( size_t k = 0; k < count; k++ ) {
+                const size_t count1 = query.counts[matches1[k]];
+                const uint64_t end = db.label_offsets[matches2[k] + 1];
+
+                for ( uint64_t p = db.label_offsets[matches2[k]]; p < end; p++ ) {
+                    const uint32_t g = db.posting_genomes[p];
+                    const size_t count2 = db.posting_counts[p];
+                    struct query_term& term = terms[g];
+
+                    if ( term.distinct == 0 ) {
+                        touched.push_back( g );
+                    }
+
+                    term.distinct++;
+                    term.interSize += set ? 1 : std::min( count1, count2 );
+                    term.shared += 2 * std::min( count1 * depths[g], count2 * 1.0 );
+                }
+
+                visited += end - db.label_offsets[matches2[k]];
+            }
+        }
+
+        // the remaining terms are derived from the totals, as in compareCores()
+        const size_t total1 = calculateCountTotal( query );
+        const double querySize = calculateTotalSize( query, program_arguments );
+
+        std::vector<struct query_hit>& result = hits[index];
+        result.reserve( touched.size() );
+
+        for ( std::vector<uint32_t>::iterator it = touched.begin(); it != touched.end(); it++ ) {
+            const struct genome_stats& reference = db.stats[*it];
+            struct query_term& term = terms[*it];
+
+            const size_t unionSize = ( set ? size1 + reference.distinct : total1 + reference.total ) - term.interSize;
+            const double denominator = total1 * depths[*it] + reference.total * 1.0;
+
+            struct query_hit hit;
+            hit.genome = *it;
+            hit.distinct = term.distinct;
+            hit.jaccard = calculateJaccardSimilarity( term.interSize, unionSize );
+            hit.dice = calculateDiceSimilarity( term.interSize, querySize, set ? reference.distinct : reference.total );
+            hit.distance = calculateNormalizedVectorSimilarity( denominator - term.shared, denominator );
+            hit.containment = static_cast<double>(term.distinct) / size1;
+            result.push_back( hit );
+
+            term.distinct = 0;
+            term.interSize = 0;
+            term.shared = 0;
+        }
+
+        touched.clear();
+
+        std::sort( result.begin(), result.end(), []( const struct query_hit& a, const struct query_hit& b ) {
+            return a.jaccard > b.jaccard || ( a.jaccard == b.jaccard && a.genome < b.genome );
+        });
+    }
+
+    postings += visited;
+};
@@ -0,0 +1,153 @@
+#ifndef DATABASE_H
+#define DATABASE_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include "args.h"
+#include "logging.h"
+#include "fileio.h"
+#include "helper.h"
+#include "similarity_metrics.h"
+#include "wmatrix.h"
+#include "utils/MmapFile.hpp"
+
+// magic number and version of database files
+#define DATABASE_MAGIC "GCDB"
+#define DATABASE_VERSION 1
+
+
+struct database_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t lcp_level;     // LCP level of the core labels
+    uint32_t reserved;
+    uint64_t scale;         // scale of the sketches, 1 for all cores
+    uint64_t genomes;       // number of reference genomes
+    uint64_t labels;        // number of distinct core labels
+    uint64_t postings;      // number of postings, i.e. the sum of the distinct cores of all genomes
+    uint64_t names_length;  // bytes of the newline-terminated genome names
+};
+
+struct genome_stats {
+    uint64_t size;          // size of the genome, see `targs.size`
+    uint64_t distinct;      // number of distinct cores
+    uint64_t total;         // sum of the counts of the cores
+};
+
+struct database {
+    MmapFile* file;
+    struct database_header header;
+    std::vector<std::string> names;
+    const struct genome_stats* stats;
+    const uint64_t* signature_offsets;  // first core of every genome in the signatures, genomes + 1 entries
+    const uint32_t* signature_labels;   // sorted core labels of all genomes
+    const uint64_t* signature_counts;   // counts of the core labels of all genomes
+    const uint32_t* labels;             // sorted distinct core labels of the inverted index
+    const uint64_t* label_offsets;      // first posting of every label, labels + 1 entries
+    const uint32_t* posting_genomes;    // genomes having the core of a posting, ascending per label
+    const uint64_t* posting_counts;     // counts of the core of a posting in its genome
+};
+
+struct query_term {
+    size_t distinct;        // number of distinct shared cores
+    size_t interSize;       // intersection size in the calculation mode of the program
+    double shared;          // sum of twice the smaller depth-weighted counts of the shared cores
+};
+
+struct query_hit {
+    uint32_t genome;        // index of the reference genome
+    size_t distinct;        // number of distinct shared cores
+    double jaccard;
+    double dice;
+    double distance;        // normalized vector similarity
+    double containment;     // fraction of the distinct cores of the query found in the reference
+};
+
+
+/**
+ * @brief Builds a reference database from the cores of the genomes.
+ *
+ * The database is written to the file given with `--db`, whose sections are 8-byte aligned so that
+ * it can be mapped and used in place: the `database_header`, the genome names, the `genome_stats`
+ * of every genome, the sorted signatures, i.e. the cores and counts of every genome, and an inverted
+ * index from every distinct core label to the genomes containing it, with the counts of the core.
+ * The inverted index is built by a k-way merge of the signatures, and the sections are written by
+ * `write_section()`. The file is written next to its destination and renamed, so a previous
+ * database is replaced only by a complete one.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures of the reference
+ *        genomes, already reduced to sketches of a common scale.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ */
+void build_index( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments );
+
+/**
+ * @brief Maps a database file written by `build_index()`.
+ *
+ * The program exits with an error if the file cannot be mapped or is not a valid database.
+ *
+ * @param filename The name of the database file.
+ * @param db An output structure whose pointers refer to the sections of the mapped file. Its file
+ *        has to be deleted with `close_database()`.
+ */
+void open_database( const std::string& filename, struct database& db );
+
+/**
+ * @brief Unmaps a database opened by `open_database()`.
+ *
+ * @param db The database.
+ */
+void close_database( struct database& db );
+
+/**
+ * @brief Compares query genomes with all reference genomes of a database.
+ *
+ * Every query is compared through the inverted index: the postings of its cores are located in the
+ * sorted labels of the database, and only these postings are visited, accumulating the terms of
+ * `compareCores()` per reference genome; everything else is derived from the per-genome statistics.
+ * Since the shared cores are visited in ascending order, the similarities are identical to those of
+ * the all-vs-all matrices. The queries are processed by `threadNumber` threads running
+ * `query_genomes()`.
+ *
+ * The results are written to `<prefix>.query.tsv`, one line per query and reference genome sharing
+ * at least one core, with the Jaccard, Dice and normalized vector similarities and the containment
+ * of the query in the reference, i.e. the fraction of its distinct cores found in the reference.
+ * The references of a query are sorted by decreasing Jaccard similarity.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures of the queries,
+ *        already reduced to sketches at the scale of the database.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param db A constant reference to the database.
+ */
+void query_database( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const struct database& db );
+
+/**
+ * @brief Collects the reference genomes sharing cores with queries until no query is left.
+ *
+ * Worker routine of `query_database()`. Each thread accumulates the `query_term` of every reference
+ * genome in its own array, and resets only the touched entries after a query. The common cores of a
+ * query and the labels of the database are found by `intersectSorted()`, which gallops over the
+ * labels if the query is much smaller.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures of the queries.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param db A constant reference to the database.
+ * @param next The index of the next query to be processed, shared by the threads.
+ * @param hits An output vector per query that will contain the reference genomes sharing cores with it,
+ *        by decreasing Jaccard similarity.
+ * @param postings The number of visited postings, shared by the threads.
+ */
+void query_genomes( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const struct database& db, std::atomic<size_t>& next, std::vector<std::vector<struct query_hit>>& hits, std::atomic<size_t>& postings );
+
+#endif
@@ -51,39 +51,199 @@ void load( struct targs& thread_arguments, struct pargs& program_arguments, std:
 };
 
 
+bool is_sketch( const std::string& filename ) {
+    std::ifstream in(filename, std::ios::binary);
+    char magic[4];
+
+    return in.read(magic, sizeof(magic)) && memcmp(magic, SKETCH_MAGIC, sizeof(magic)) == 0;
+};
+
+
+void save_sketch( const struct targs& arguments, const struct pargs& program_arguments ) {
+    std::ofstream out(arguments.sketchFileName, std::ios::binary);
+    if (!out) {
+        log(ERROR, "Error opening file for writing %s", arguments.sketchFileName.c_str());
+        exit(1);
+    }
+
+    log(INFO, "Saving sketch to file %s", arguments.sketchFileName.c_str());
+
+    uint32_t version = SKETCH_VERSION;
+    uint32_t lcp_level = program_arguments.lcpLevel;
+    uint64_t scale = arguments.scale;
+    uint64_t genome_size = arguments.size;
+    uint64_t core_size = arguments.cores.size();
+
+    out.write(SKETCH_MAGIC, 4);
+    out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    out.write(reinterpret_cast<const char*>(&lcp_level), sizeof(lcp_level));
+    out.write(reinterpret_cast<const char*>(&scale), sizeof(scale));
+    out.write(reinterpret_cast<const char*>(&genome_size), sizeof(genome_size));
+    out.write(reinterpret_cast<const char*>(&core_size), sizeof(core_size));
+
+    // counts are written as 64-bit integers, regardless of the size of size_t
+    std::vector<uint64_t> counts(arguments.counts.begin(), arguments.counts.end());
+
+    out.write(reinterpret_cast<const char*>(arguments.cores.data()), core_size * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char*>(counts.data()), core_size * sizeof(uint64_t));
+
+    out.close();
+
+    if (out.fail()) {
+        log(ERROR, "Failed to write %s", arguments.sketchFileName.c_str());
+        exit(1);
+    }
+};
+
+
+void load_sketch( const std::string& filename, const struct pargs& program_arguments, struct run& result, size_t& genome_size, size_t& scale ) {
+    std::ifstream in(filename, std::ios::binary);
+
+    if (!in) {
+        log(ERROR, "Error opening file for reading %s", filename.c_str());
+        exit(1);
+    }
+
+    char magic[4];
+    uint32_t version, lcp_level;
+    uint64_t sketch_scale, sketch_genome_size, core_size;
+
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    in.read(reinterpret_cast<char*>(&lcp_level), sizeof(lcp_level));
+    in.read(reinterpret_cast<char*>(&sketch_scale), sizeof(sketch_scale));
+    in.read(reinterpret_cast<char*>(&sketch_genome_size), sizeof(sketch_genome_size));
+    in.read(reinterpret_cast<char*>(&core_size), sizeof(core_size));
+
+    if ( !in || version != SKETCH_VERSION ) {
+        log(ERROR, "Invalid sketch file %s", filename.c_str());
+        exit(1);
+    }
+
+    // labels of different levels are not comparable
+    if ( lcp_level != program_arguments.lcpLevel ) {
+        log(ERROR, "Sketch %s was computed at LCP level %u, not %zu.", filename.c_str(), lcp_level, program_arguments.lcpLevel);
+        exit(1);
+    }
+
+    std::vector<uint64_t> counts(core_size);
+    result.cores.resize(core_size);
+
+    in.read(reinterpret_cast<char*>(result.cores.data()), core_size * sizeof(uint32_t));
+    in.read(reinterpret_cast<char*>(counts.data()), core_size * sizeof(uint64_t));
+
+    if ( !in ) {
+        log(ERROR, "Sketch file %s is truncated.", filename.c_str());
+        exit(1);
+    }
+
+    result.counts.assign(counts.begin(), counts.end());
+    genome_size = sketch_genome_size;
+    scale = sketch_scale;
+
+    in.close();
+};
+
+
+void sketch_genomes( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments ) {
+
+    size_t scale = std::max( program_arguments.scale, (size_t)1 );
+
+    for ( std::vector<struct targs>::iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+        scale = std::max( scale, it->scale );
+    }
+
+    if ( scale > 1 ) {
+        size_t kept = 0;
+
+        for ( std::vector<struct targs>::iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+            if ( it->scale != scale ) {
+                sketchCores( it->cores, it->counts, sketchThreshold( scale ) );
+                it->scale = scale;
+            }
+
+            kept += it->cores.size();
+        }
+
+        if ( scale != program_arguments.scale ) {
+            log(WARN, "Sketches are compared at scale %zu, the largest scale of the inputs.", scale);
+        }
+        log(INFO, "Sketch scale: %zu, %.0f cores are kept per genome on average.", scale, (double)kept / thread_arguments.size());
+    }
+
+    for ( std::vector<struct targs>::iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+        if ( !it->sketchFileName.empty() ) {
+            save_sketch( *it, program_arguments );
+        }
+    }
+};
+
+
 void read_from_file( struct targs& thread_arguments, struct pargs& program_arguments ) {
 
     // get thread id
     std::ostringstream ss;
     ss << std::this_thread::get_id();
 
-    // log initiation of reading fasta
-    log(INFO, "Thread ID: %s started loading %s", ss.str().c_str(), thread_arguments.inFileName.c_str());
+    // files joined with `+` are merged into one genome
+    std::vector<struct run> runs;
+    std::stringstream parts(thread_arguments.inFileName);
+    std::string part;
+    size_t genome_size = 0;
+    size_t scale = 1;
+
+    while ( std::getline(parts, part, '+') ) {
+
+        // log initiation of reading fasta
+        log(INFO, "Thread ID: %s started loading %s", ss.str().c_str(), part.c_str());
+
+        struct run result;
+
+        if ( is_sketch( part ) ) {
+            size_t part_size, part_scale;
+            load_sketch( part, program_arguments, result, part_size, part_scale );
 
-    // load lcp cores
-    std::vector<lcp::lps*> strs;
-    load( thread_arguments, program_arguments, strs );
+            genome_size += part_size;
+            scale = std::max( scale, part_scale );
+        } else {
+            // load lcp cores
+            struct targs arguments;
+            arguments.inFileName = part;
+            arguments.size = 0;
 
-    // log ending of processing fasta
-    log(INFO, "Thread ID: %s ended loading %s", ss.str().c_str(), thread_arguments.inFileName.c_str());
+            std::vector<lcp::lps*> strs;
+            load( arguments, program_arguments, strs );
+
+            // get lcp core hashes
+            std::vector<uint32_t> lcp_core_hashes;
+            flatten(strs, lcp_core_hashes);
+
+            // delete lcp cores
+            for ( std::vector<lcp::lps*>::iterator it = strs.begin(); it != strs.end(); it++ ) {
+                delete (*it);
+            }
+            strs.clear();
+
+            makeRun( lcp_core_hashes, result );
+            genome_size += arguments.size;
+        }
 
-    // get lcp core hashes
-    std::vector<uint32_t> lcp_core_hashes;
-    flatten(strs, lcp_core_hashes);
+        // log ending of processing fasta
+        log(INFO, "Thread ID: %s ended loading %s", ss.str().c_str(), part.c_str());
 
-    // delete lcp cores
-    for ( std::vector<lcp::lps*>::iterator it = strs.begin(); it != strs.end(); it++ ) {
-        delete (*it);
+        pushRun( runs, result );
     }
-    strs.clear();
 
     // set lcp cores and counts to arguments
-    generateSignature( lcp_core_hashes );
-    initializeSetAndCounts( lcp_core_hashes, thread_arguments.cores, thread_arguments.counts );
+    collapseRuns( runs, thread_arguments.cores, thread_arguments.counts );
+    sketchCores( thread_arguments.cores, thread_arguments.counts, sketchThreshold( scale ) );
+
+    thread_arguments.size = genome_size;
+    thread_arguments.scale = scale;
 };
 
 
-void read_cores( std::vector<struct targs>& thread_arguments, struct pargs& program_arguments ) {
+void read_cores( std::vector<struct targs>& thread_arguments, struct pargs& program_arguments, const std::vector<bool>& selected ) {
 
     std::vector<std::thread> threads;
     std::vector<struct targs>::iterator current_argument = thread_arguments.begin();
@@ -91,7 +251,9 @@ void read_cores( std::vector<struct targs>& thread_arguments, struct pargs& prog
     while (current_argument < thread_arguments.end()) {
 
         while (threads.size() < program_arguments.threadNumber && current_argument < thread_arguments.end()) {
-            threads.emplace_back(read_from_file, std::ref(*current_argument), std::ref(program_arguments));
+            if ( selected[current_argument - thread_arguments.begin()] ) {
+                threads.emplace_back(read_from_file, std::ref(*current_argument), std::ref(program_arguments));
+            }
             current_argument++;
         }
 
@@ -109,3 +271,48 @@ void read_cores( std::vector<struct targs>& thread_arguments, struct pargs& prog
         it->join();
     }
 };
+
+
+void read_signature_length( const std::string& filename, size_t& length, size_t& scale ) {
+
+    std::stringstream parts(filename);
+    std::string part;
+
+    length = 0;
+    scale = 1;
+
+    while ( std::getline(parts, part, '+') ) {
+        std::ifstream in(part, std::ios::binary | std::ios::ate);
+        const std::streamoff bytes = in.tellg();
+        char magic[4];
+        uint64_t sketch_scale = 1;
+
+        // the scale follows the magic number, version and LCP level of a sketch
+        in.seekg(0);
+        if ( in.read(magic, sizeof(magic)) && memcmp(magic, SKETCH_MAGIC, sizeof(magic)) == 0 ) {
+            in.seekg(2 * sizeof(uint32_t), std::ios::cur);
+            in.read(reinterpret_cast<char*>(&sketch_scale), sizeof(sketch_scale));
+        }
+
+        if ( !in || bytes < 0 ) {
+            log(ERROR, "Error opening file for reading %s", part.c_str());
+            exit(1);
+        }
+
+        length += bytes;
+        scale = std::max( scale, (size_t)sketch_scale );
+    }
+};
+
+
+void write_padding( std::ofstream& out, size_t bytes ) {
+    static const char padding[8] = { 0 };
+
+    out.write( padding, section_size( bytes ) - bytes );
+};
+
+
+void write_section( std::ofstream& out, const void* data, size_t bytes ) {
+    out.write( static_cast<const char*>(data), bytes );
+    write_padding( out, bytes );
+};
@@ -1,6 +1,8 @@
 #ifndef FILEIO_H
 #define FILEIO_H
 
+#include <cstdint>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <thread>
@@ -12,6 +14,10 @@
 #include "helper.h"
 #include "logging.h"
 
+// magic number and version of sketch files
+#define SKETCH_MAGIC "GCSG"
+#define SKETCH_VERSION 1
+
 
 /**
  * @brief Saves the LCP cores to a binary file.
@@ -43,6 +49,52 @@ void save( const struct targs& arguments, const std::vector<lcp::lps*>& cores );
  */
 void load( struct targs& arguments, struct pargs& program_arguments, std::vector<lcp::lps*>& cores );
 
+/**
+ * @brief Checks if a file is a sketch written by `save_sketch()`.
+ *
+ * @param filename The name of the file.
+ * @return True if the file starts with the magic number of sketches; otherwise, false.
+ */
+bool is_sketch( const std::string& filename );
+
+/**
+ * @brief Saves the sketch of a genome to a binary file.
+ *
+ * The file consists of the magic number `GCSG`, the version and the LCP level as 32-bit integers, 
+ * the scale, the genome size and the number of cores as 64-bit integers, followed by the sorted 
+ * core labels as 32-bit integers and their counts as 64-bit integers.
+ *
+ * @param arguments A constant reference to the `targs` structure of the genome, its cores are 
+ *        written to `sketchFileName`.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ */
+void save_sketch( const struct targs& arguments, const struct pargs& program_arguments );
+
+/**
+ * @brief Loads a sketch from a binary file written by `save_sketch()`.
+ *
+ * @param filename The name of the file.
+ * @param program_arguments A constant reference to the `pargs` structure, the LCP level of the 
+ *        sketch must match its `lcpLevel`.
+ * @param result An output run that will hold the cores and counts of the sketch.
+ * @param genome_size An output variable that will hold the size of the sketched genome.
+ * @param scale An output variable that will hold the scale of the sketch.
+ */
+void load_sketch( const std::string& filename, const struct pargs& program_arguments, struct run& result, size_t& genome_size, size_t& scale );
+
+/**
+ * @brief Reduces all genomes to sketches of a common scale and saves them if requested.
+ *
+ * The common scale is the largest of `--scale` and the scales of the loaded sketches, since a 
+ * sketch can only be reduced further. Genomes with a smaller scale are sketched again with 
+ * `sketchCores()`. If sketch file names are given with `--sketch`, the sketches are saved with 
+ * `save_sketch()`.
+ *
+ * @param thread_arguments A reference to the vector of `targs` structures, one per genome.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ */
+void sketch_genomes( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments );
+
 /**
  * @brief Reads LCP cores from a file and processes them.
  * 
@@ -50,6 +102,11 @@ void load( struct targs& arguments, struct pargs& program_arguments, std::vector
  * hashes for further processing. It manages memory by deleting loaded LCP core objects after 
  * extracting their hashes and setting the results into the provided `thread_arguments`.
  * 
+ * The file can be a core file written with `-w` or a sketch written with `--sketch`. Several files 
+ * joined with `+`, e.g. `run1.sketch+run2.sketch`, are merged into a single genome: their cores 
+ * are united, their counts and genome sizes are summed, and the result is reduced to the largest 
+ * scale among them.
+ * 
  * @param thread_arguments A reference to a `targs` structure containing file-specific data (e.g., input file name) 
  *        and will be updated with the extracted LCP cores and their counts.
  * @param program_arguments A reference to a `pargs` structure containing program-wide settings needed 
@@ -69,8 +126,64 @@ void read_from_file( struct targs& thread_arguments, struct pargs& program_argum
  *        file information (e.g., input file names) and is passed to the respective threads for reading.
  * @param program_arguments A reference to the `pargs` structure, which contains general program settings, 
  *        including the number of threads to spawn (`threadNumber`).
+ * @param selected A constant reference to a vector of flags, one per genome; the cores of the genomes 
+ *        that are not selected, e.g. outside the tiles of a shard, are left empty.
+ */
+void read_cores( std::vector<struct targs>& thread_arguments, struct pargs& program_arguments, const std::vector<bool>& selected );
+
+/**
+ * @brief Estimates the size of the core set and reads the scale of a genome without loading it.
+ *
+ * The size of the core set is estimated by the size of the files in bytes, as the header of a core 
+ * file counts its sequences rather than its cores; only the header of a sketch is read for its scale. 
+ * For files joined with `+`, the sizes are summed and the scale is the largest among them.
+ *
+ * @param filename The name of the file, or of the files joined with `+`.
+ * @param length An output variable that will hold the size of the files in bytes.
+ * @param scale An output variable that will hold the scale, 1 for core files.
+ */
+void read_signature_length( const std::string& filename, size_t& length, size_t& scale );
+
+/**
+ * @brief Rounds the size of a section of a binary file up to the next 8-byte boundary.
+ *
+ * @param bytes The size of the section.
+ * @return The size of the section with its padding.
+ */
+inline size_t section_size( size_t bytes ) {
+    return ( bytes + 7 ) / 8 * 8;
+};
+
+/**
+ * @brief Pads a section of a binary file of the given size with zeros to the next 8-byte boundary.
+ *
+ * @param out The stream of the file.
+ * @param bytes The size of the section.
+ */
+void write_padding( std::ofstream& out, size_t bytes );
+
+/**
+ * @brief Writes a section of a binary file, padded to the next 8-byte boundary.
+ *
+ * The sections of databases, matrix states and shard files are aligned, so that the files can be 
+ * mapped and used in place. Numbers are written in the byte order of the machine, as in core files 
+ * and sketches.
+ *
+ * @param out The stream of the file.
+ * @param data A pointer to the content of the section.
+ * @param bytes The size of the content.
+ */
+void write_section( std::ofstream& out, const void* data, size_t bytes );
+
+/**
+ * @brief Removes the padding of a short name, added for the alignment of PHYLIP files.
+ *
+ * @param shortName The short name of a genome.
+ * @return The short name without its trailing spaces.
  */
-void read_cores( std::vector<struct targs>& thread_arguments, struct pargs& program_arguments );
+inline std::string trimmed_name( const std::string& shortName ) {
+    return shortName.substr( 0, shortName.find_last_not_of( ' ' ) + 1 );
+};
 
 
 #endif
@@ -1,7 +1,5 @@
 #include <vector>
 #include <iostream>
-#include <iomanip>
-#include <fstream>
 
 #include "args.h"
 #include "init.h"
@@ -9,6 +7,14 @@
 #include "rfastq.h"
 #include "rbam.h"
 #include "similarity_metrics.h"
+#include "matrix.h"
+#include "wmatrix.h"
+#include "database.h"
+#include "state.h"
+#include "outofcore.h"
+#include "shard.h"
+#include "topk.h"
+#include "postings.h"
 
 
 int main(int argc, char **argv) {
@@ -21,26 +27,83 @@ int main(int argc, char **argv) {
 
     const size_t numGenomes = thread_arguments.size();
 
+    // Shards computed by other runs are only assembled
+    if ( program_arguments.command == MERGE ) {
+        merge_shards( thread_arguments, program_arguments );
+        return 0;
+    }
+
     // Initialize coefficient arrays
     lcp::init_coefficients( program_arguments.verbose );
 
-    // Process files program
-    if ( program_arguments.readCores ) {
-        read_cores( thread_arguments, program_arguments );
+    // Queries are compared at the scale and LCP level of the database
+    struct database db;
+
+    if ( program_arguments.command == QUERY ) {
+        open_database( program_arguments.databaseFile, db );
+
+        if ( db.header.lcp_level != program_arguments.lcpLevel ) {
+            log(ERROR, "Database %s was built at LCP level %u, not %zu.", program_arguments.databaseFile.c_str(), db.header.lcp_level, program_arguments.lcpLevel);
+            exit(1);
+        }
+        if ( program_arguments.scale > 1 && program_arguments.scale != db.header.scale ) {
+            log(WARN, "Queries are sketched at scale %zu, the scale of the database.", (size_t)db.header.scale);
+        }
+
+        program_arguments.scale = db.header.scale;
+    }
+
+    // Shards compute consecutive tiles of about the same cost, and only need the genomes and rows of their tiles
+    std::vector<bool> selected( numGenomes, true );
+    size_t row_begin = 0, row_end = numGenomes;
+
+    if ( program_arguments.shardCount > 0 && program_arguments.readCores ) {
+        std::vector<size_t> lengths( numGenomes ), scales( numGenomes );
+
+        for ( size_t i = 0; i < numGenomes; i++ ) {
+            read_signature_length( thread_arguments[i].inFileName, lengths[i], scales[i] );
+        }
+
+        plan_shard( lengths, program_arguments );
+        shard_genomes( numGenomes, program_arguments.shardBegin, program_arguments.shardEnd, selected, row_begin, row_end );
+
+        // all genomes are read into the store, or to save their sketches
+        bool all = program_arguments.memoryBudget > 0;
+
+        for ( std::vector<struct targs>::const_iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+            all = all || !it->sketchFileName.empty();
+        }
+
+        if ( all ) {
+            selected.assign( numGenomes, true );
+        }
+
+        // the others are sketched to the common scale as empty genomes
+        for ( size_t i = 0; i < numGenomes; i++ ) {
+            if ( !selected[i] ) {
+                thread_arguments[i].size = 0;
+                thread_arguments[i].scale = scales[i];
+            }
+        }
+
+        log(INFO, "Shard %zu/%zu reads %zu of %zu genomes", program_arguments.shardIndex, program_arguments.shardCount, (size_t)std::count( selected.begin(), selected.end(), true ), numGenomes);
+    }
+
+    // Process files program, signatures are kept on disk with a memory budget
+    struct signature_store store;
+
+    if ( program_arguments.memoryBudget > 0 ) {
+        spill_signatures( thread_arguments, program_arguments, store );
+    } else if ( program_arguments.readCores ) {
+        read_cores( thread_arguments, program_arguments, selected );
     } else {
         switch ( program_arguments.mode ) {
         case FA:
             read_fastas( thread_arguments, program_arguments );
             break;
         case FQ:
-            for ( std::vector<struct targs>::iterator it = thread_arguments.begin(); it < thread_arguments.end(); it++ ) {
-                read_fastq( *it, program_arguments );
-            }
-            break;
         case BAM:
-            for ( std::vector<struct targs>::iterator it = thread_arguments.begin(); it < thread_arguments.end(); it++ ) {
-                read_bam( *it, program_arguments );
-            }
+            read_samples( thread_arguments, program_arguments );
             break;
         default:
             throw std::invalid_argument("Invalid program mode provided");
@@ -48,98 +111,114 @@ int main(int argc, char **argv) {
         }
     }
 
-    log(INFO, "Calculating distance matrices...");
-
-    // Initialize similarity matrices
-    double jaccard[numGenomes][numGenomes];
-    double dice[numGenomes][numGenomes];
-    double distance[numGenomes][numGenomes];
-    
-    for (size_t i = 0; i < numGenomes; i++ ) {
-        jaccard[i][i] = 1;
-        dice[i][i] = 1;
-        distance[i][i] = 1;
+    // Reduce genomes to sketches of a common scale, if any, and save them
+    if ( program_arguments.memoryBudget == 0 ) {
+        sketch_genomes( thread_arguments, program_arguments );
     }
 
-    // Compute similarity scores
-    for ( std::vector<struct targs>::iterator it1 = thread_arguments.begin(); it1 < thread_arguments.end(); it1++ ) { 
-        for ( std::vector<struct targs>::iterator it2 = it1+1; it2 < thread_arguments.end(); it2++ ) {
-            
-            size_t interSize, unionSize;
-            calculateIntersectionAndUnionSizes( *it1, *it2, program_arguments, interSize, unionSize );
-
-            double jaccard_similarity = calculateJaccardSimilarity( interSize, unionSize );
-            double dice_similarity = calculateDiceSimilarity( interSize, *it1, *it2, program_arguments );
-            double distance_similarity = calculateNormalizedVectorSimilarity( *it1, *it2 );
-
-            dice[it1 - thread_arguments.begin()][it2 - thread_arguments.begin()] = dice_similarity;
-            jaccard[it1 - thread_arguments.begin()][it2 - thread_arguments.begin()] = jaccard_similarity;
-            distance[it1 - thread_arguments.begin()][it2 - thread_arguments.begin()] = distance_similarity;
-
-            // set values to transposed locations
-            dice[it2 - thread_arguments.begin()][it1 - thread_arguments.begin()] = dice_similarity;
-            jaccard[it2 - thread_arguments.begin()][it1 - thread_arguments.begin()] = jaccard_similarity;
-            distance[it2 - thread_arguments.begin()][it1 - thread_arguments.begin()] = distance_similarity;
+    // Shards of other inputs are planned once the cores are computed
+    if ( program_arguments.shardCount > 0 && !program_arguments.readCores ) {
+        std::vector<size_t> lengths;
+        std::vector<bool> genomes;
+
+        for ( std::vector<struct targs>::const_iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+            lengths.push_back( it->cores.size() );
         }
+
+        plan_shard( lengths, program_arguments );
+        shard_genomes( numGenomes, program_arguments.shardBegin, program_arguments.shardEnd, genomes, row_begin, row_end );
     }
 
-    log(INFO, "Writing distance matrices to files...");
-    
-    // Write outputs to files
-    std::fstream dice_out, jaccard_out, distance_out;
-    dice_out.open( program_arguments.prefix + ".dice.phy", std::ios::out );
-    jaccard_out.open( program_arguments.prefix + ".jaccard.phy", std::ios::out );
-    distance_out.open( program_arguments.prefix + ".ns.phy", std::ios::out );
-
-    if ( dice_out.is_open() ) {  
-
-        dice_out << numGenomes << std::endl;
-        dice_out << std::setprecision(15);
-        
-        for(size_t i = 0; i < numGenomes; i++ ) {
-            
-            dice_out << thread_arguments[i].shortName;  
-
-            for(size_t j = 0; j < numGenomes; j++ ) {
-                dice_out << std::fixed << std::setprecision(15) << " " << 1-dice[i][j];
+    if ( program_arguments.command == INDEX ) {
+        log(INFO, "Building reference database...");
+        build_index( thread_arguments, program_arguments );
+        return 0;
+    }
+
+    if ( program_arguments.command == QUERY ) {
+        for ( std::vector<struct targs>::iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+            if ( it->scale != db.header.scale ) {
+                log(ERROR, "Query %s is sketched at scale %zu, larger than the scale of the database.", it->inFileName.c_str(), it->scale);
+                exit(1);
             }
-            dice_out << std::endl;
         }
-        dice_out.close();
+
+        log(INFO, "Querying reference database...");
+        query_database( thread_arguments, program_arguments, db );
+        close_database( db );
+        return 0;
     }
-    
-    if ( jaccard_out.is_open() ) {  
 
-        jaccard_out << numGenomes << std::endl;
-        jaccard_out << std::setprecision(15);
+    // Only the nearest neighbours are kept, no matrix is allocated
+    if ( program_arguments.topK > 0 ) {
+        log(INFO, "Searching nearest neighbours...");
 
-        for(size_t i = 0; i < numGenomes; i++ ) {
-            
-            jaccard_out << thread_arguments[i].shortName;  
+        std::vector<std::vector<struct neighbour>> neighbours;
+        find_neighbours( thread_arguments, program_arguments, neighbours );
+        write_neighbours( thread_arguments, program_arguments, neighbours );
+        return 0;
+    }
 
-            for(size_t j = 0; j < numGenomes; j++ ) {
-                jaccard_out << std::fixed << std::setprecision(15) << " " << 1-jaccard[i][j];
-            }
-            jaccard_out << std::endl;
-        }
-        jaccard_out.close();
+    log(INFO, "Calculating distance matrices...");
+
+    // Initialize similarity matrix, large matrices are backed by a temporary file
+    TriangularMatrix matrix( numGenomes, row_begin, row_end, ( program_arguments.prefix + ".matrix" ).c_str(), program_arguments.memoryBudget > 0 ? 0 : MATRIX_HEAP_LIMIT );
+
+    if ( !matrix ) {
+        log(ERROR, "Failed to allocate the similarity matrix of %zu genomes", numGenomes);
+        exit(1);
     }
 
-    if ( distance_out.is_open() ) {  
+    if ( matrix.mapped() ) {
+        log(INFO, "Similarity matrix is backed by %s.matrix", program_arguments.prefix.c_str());
+    }
+
+    // Restore the pairs of the genomes of a previous run
+    std::vector<bool> known( numGenomes, false );
+    std::vector<uint64_t> checksums;
 
-        distance_out << numGenomes << std::endl;
-        distance_out << std::setprecision(15);
+    const bool checksummed = program_arguments.writeState || program_arguments.shardCount > 0;
 
-        for(size_t i = 0; i < numGenomes; i++ ) {
-            
-            distance_out << thread_arguments[i].shortName;  
+    if ( checksummed && program_arguments.memoryBudget > 0 ) {
+        block_checksums( thread_arguments, program_arguments, store, checksums );
+    } else if ( checksummed ) {
+        signature_checksums( thread_arguments, program_arguments, checksums );
 
-            for(size_t j = 0; j < numGenomes; j++ ) {
-                distance_out << std::fixed << std::setprecision(15) << ' ' << 1-distance[i][j];
+        // genomes that are not read have no checksum, merge takes it from the other shards
+        for ( size_t i = 0; i < numGenomes; i++ ) {
+            if ( !selected[i] ) {
+                checksums[i] = 0;
             }
-            distance_out << std::endl;
         }
-        distance_out.close();
+    }
+
+    if ( !program_arguments.updateFile.empty() ) {
+        load_state( thread_arguments, checksums, program_arguments, matrix, known );
+    }
+    
+    // Compute similarity scores
+    if ( program_arguments.memoryBudget > 0 ) {
+        compute_blocks( thread_arguments, program_arguments, store, matrix, known );
+        close_store( store );
+    } else if ( program_arguments.usePostings ) {
+        compute_postings( thread_arguments, program_arguments, matrix, known );
+    } else {
+        compute_matrices( thread_arguments, program_arguments, matrix, known );
+    }
+
+    // Shards are written as they are, to be merged later
+    if ( program_arguments.shardCount > 0 ) {
+        save_shard( thread_arguments, checksums, program_arguments, matrix );
+        return 0;
+    }
+
+    log(INFO, "Writing distance matrices to files...");
+    
+    // Write outputs to files
+    write_matrices( thread_arguments, program_arguments, matrix );
+
+    if ( program_arguments.writeState ) {
+        save_state( thread_arguments, checksums, program_arguments, matrix );
     }
 
     return 0;
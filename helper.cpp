@@ -30,7 +30,7 @@ void flatten(std::vector<lcp::lps*>& strs, std::vector<uint32_t>& lcp_cores) {
         size += (*it_str)->cores->size();
     }
 
-    lcp_cores.reserve(size);
+    lcp_cores.reserve(lcp_cores.size() + size);
 
     for(std::vector<lcp::lps*>::iterator it_str = strs.begin(); it_str != strs.end(); it_str++) {
         for ( std::vector<lcp::core*>::iterator it_lcp = (*it_str)->cores->begin(); it_lcp != (*it_str)->cores->end(); it_lcp++ ) {
@@ -83,4 +83,133 @@ void initializeSetAndCounts( std::vector<uint32_t>& cores, std::vector<uint32_t>
 
     // add the count for the last element
     counts.push_back(count); 
+};
+
+
+void mergeSetAndCounts( const std::vector<uint32_t>& set1, const std::vector<size_t>& counts1, const std::vector<uint32_t>& set2, const std::vector<size_t>& counts2, std::vector<uint32_t>& set, std::vector<size_t>& counts ) {
+
+    set.clear();
+    counts.clear();
+    set.reserve( set1.size() + set2.size() );
+    counts.reserve( set1.size() + set2.size() );
+
+    size_t i = 0, j = 0;
+
+    while ( i < set1.size() && j < set2.size() ) {
+        if ( set1[i] < set2[j] ) {
+            set.push_back(set1[i]);
+            counts.push_back(counts1[i]);
+            i++;
+        } else if ( set1[i] > set2[j] ) {
+            set.push_back(set2[j]);
+            counts.push_back(counts2[j]);
+            j++;
+        } else {
+            set.push_back(set1[i]);
+            counts.push_back(counts1[i] + counts2[j]);
+            i++;
+            j++;
+        }
+    }
+
+    // append the remaining elements of either set
+    set.insert( set.end(), set1.begin() + i, set1.end() );
+    counts.insert( counts.end(), counts1.begin() + i, counts1.end() );
+    set.insert( set.end(), set2.begin() + j, set2.end() );
+    counts.insert( counts.end(), counts2.begin() + j, counts2.end() );
+};
+
+
+void makeRun( std::vector<uint32_t>& lcp_cores, struct run& result ) {
+
+    result.cores.clear();
+    result.counts.clear();
+
+    generateSignature( lcp_cores );
+    initializeSetAndCounts( lcp_cores, result.cores, result.counts );
+
+    lcp_cores.clear();
+};
+
+
+void makeRun( std::unordered_map<uint32_t, size_t>& table, struct run& result ) {
+
+    std::vector<std::pair<uint32_t, size_t>> entries( table.begin(), table.end() );
+    table.clear();
+
+    std::sort( entries.begin(), entries.end() );
+
+    result.cores.clear();
+    result.counts.clear();
+    result.cores.reserve( entries.size() );
+    result.counts.reserve( entries.size() );
+
+    for ( std::vector<std::pair<uint32_t, size_t>>::iterator it = entries.begin(); it != entries.end(); it++ ) {
+        result.cores.push_back( it->first );
+        result.counts.push_back( it->second );
+    }
+};
+
+
+void pushRun( std::vector<struct run>& runs, struct run& result ) {
+
+    runs.push_back( run() );
+    runs.back().cores.swap( result.cores );
+    runs.back().counts.swap( result.counts );
+
+    // merge runs of similar sizes to keep the stack logarithmic
+    while ( runs.size() > 1 && runs[runs.size() - 2].cores.size() <= runs.back().cores.size() ) {
+        struct run merged;
+        mergeSetAndCounts( runs[runs.size() - 2].cores, runs[runs.size() - 2].counts, runs.back().cores, runs.back().counts, merged.cores, merged.counts );
+        
+        runs.pop_back();
+        runs.back().cores.swap( merged.cores );
+        runs.back().counts.swap( merged.counts );
+    }
+};
+
+
+void collapseRuns( std::vector<struct run>& runs, std::vector<uint32_t>& set, std::vector<size_t>& counts ) {
+
+    set.clear();
+    counts.clear();
+
+    // merge from the top of the stack, where the smallest runs are
+    while ( runs.size() > 1 ) {
+        struct run merged;
+        mergeSetAndCounts( runs[runs.size() - 2].cores, runs[runs.size() - 2].counts, runs.back().cores, runs.back().counts, merged.cores, merged.counts );
+        
+        runs.pop_back();
+        runs.back().cores.swap( merged.cores );
+        runs.back().counts.swap( merged.counts );
+    }
+
+    if ( !runs.empty() ) {
+        set.swap( runs.back().cores );
+        counts.swap( runs.back().counts );
+        runs.clear();
+    }
+};
+
+
+void sketchCores( std::vector<uint32_t>& set, std::vector<size_t>& counts, uint32_t threshold ) {
+
+    if ( threshold == MAX_CORE_HASH ) {
+        return;
+    }
+
+    size_t kept = 0;
+
+    for ( size_t i = 0; i < set.size(); i++ ) {
+        if ( hashCore( set[i] ) <= threshold ) {
+            set[kept] = set[i];
+            counts[kept] = counts[i];
+            kept++;
+        }
+    }
+
+    set.resize( kept );
+    counts.resize( kept );
+    set.shrink_to_fit();
+    counts.shrink_to_fit();
 };
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include <cstdint>
 #include <string>
 #include <vector>
+#include <utility>
+#include <unordered_map>
 #include <algorithm>
 #include "logging.h"
 #include "lps.h"
@@ -13,6 +15,16 @@
 #endif
 
 
+// largest hash of a core label, sketches at scale s keep the labels hashed below MAX_CORE_HASH / s
+#define MAX_CORE_HASH 0xFFFFFFFFu
+
+
+struct run {
+    std::vector<uint32_t> cores;
+    std::vector<size_t> counts;
+};
+
+
 /**
  * @brief Generates the reverse complement of a DNA sequence.
  *
@@ -36,8 +48,8 @@ bool reverseComplement( std::string& sequence );
  * 
  * @param strs A reference to a vector of pointers to `lcp::lps` structures, each containing a collection of cores.
  * @param lcp_cores A reference to a vector of 32-bit unsigned integers that will be populated with core labels.
- *                  This vector is modified in-place, and its capacity is pre-allocated based on the total number 
- *                  of cores across all locally parsed strings.
+ *                  Labels are appended to the vector in-place, and its capacity is pre-allocated based on the 
+ *                  total number of cores across all locally parsed strings.
  */
 void flatten(std::vector<lcp::lps*>& strs, std::vector<uint32_t>& lcp_cores);
 
@@ -71,4 +83,107 @@ void generateSignature( std::vector<uint32_t>& hash_values );
  */
 void initializeSetAndCounts( std::vector<uint32_t>& lcp_cores, std::vector<uint32_t>& set, std::vector<size_t>& counts );
 
+/**
+ * @brief Merges two sorted sets of LCP cores and their counts.
+ *
+ * This function merges two sorted and distinct core sets in a single linear pass. Cores present 
+ * in both inputs appear once in the output, with the sum of their counts.
+ *
+ * @param set1 The first sorted set of cores.
+ * @param counts1 The counts of the cores in `set1`.
+ * @param set2 The second sorted set of cores.
+ * @param counts2 The counts of the cores in `set2`.
+ * @param set An output vector that will contain the union of `set1` and `set2`. It must not alias 
+ *            any of the inputs.
+ * @param counts An output vector that will contain the counts of the cores in `set`.
+ */
+void mergeSetAndCounts( const std::vector<uint32_t>& set1, const std::vector<size_t>& counts1, const std::vector<uint32_t>& set2, const std::vector<size_t>& counts2, std::vector<uint32_t>& set, std::vector<size_t>& counts );
+
+/**
+ * @brief Reduces a batch of LCP core labels into a sorted run of cores and counts.
+ *
+ * The labels are sorted in-place and summarized with `initializeSetAndCounts()`. Afterwards the 
+ * label vector is cleared, keeping its capacity, so that it can be reused for the next batch.
+ *
+ * @param lcp_cores The core labels of the batch, e.g. cores of one chromosome.
+ * @param result An output run that will hold the distinct cores and their counts.
+ */
+void makeRun( std::vector<uint32_t>& lcp_cores, struct run& result );
+
+/**
+ * @brief Converts a table of LCP core labels and their counts into a sorted run.
+ *
+ * The entries of the table are sorted by label, so that the result can be merged with other 
+ * runs. Afterwards the table is cleared.
+ *
+ * @param table The table that maps each core label to its number of occurrences.
+ * @param result An output run that will hold the distinct cores and their counts.
+ */
+void makeRun( std::unordered_map<uint32_t, size_t>& table, struct run& result );
+
+/**
+ * @brief Adds a run to a stack of runs that are merged incrementally.
+ *
+ * The run is moved onto the stack, and the two topmost runs are merged as long as the lower one 
+ * is not larger than the upper one. Each merge at least doubles the size of a run, so the stack 
+ * has a logarithmic depth and every core is merged a logarithmic number of times, regardless of 
+ * the number and sizes of the runs.
+ *
+ * @param runs The stack of runs.
+ * @param result The run to be added. It is left empty.
+ */
+void pushRun( std::vector<struct run>& runs, struct run& result );
+
+/**
+ * @brief Merges all runs of a stack into a single set of cores and counts.
+ *
+ * @param runs The stack of runs. It is emptied.
+ * @param set An output vector that will contain all distinct cores.
+ * @param counts An output vector that will contain the counts of the cores in `set`.
+ */
+void collapseRuns( std::vector<struct run>& runs, std::vector<uint32_t>& set, std::vector<size_t>& counts );
+
+/**
+ * @brief Hashes an LCP core label for sketching.
+ *
+ * Labels are not uniformly distributed, so they are mixed with the finalizer of MurmurHash3, a 
+ * bijection on 32-bit integers, before they are compared with the threshold of a sketch.
+ *
+ * @param label The core label.
+ * @return The hash of the label.
+ */
+inline uint32_t hashCore( uint32_t label ) {
+    label ^= label >> 16;
+    label *= 0x85ebca6b;
+    label ^= label >> 13;
+    label *= 0xc2b2ae35;
+    label ^= label >> 16;
+    return label;
+};
+
+/**
+ * @brief Calculates the largest core hash kept by a FracMinHash sketch.
+ *
+ * @param scale The scale of the sketch, about one in `scale` distinct cores is kept. Scales of 0 
+ *        and 1 keep all cores.
+ * @return The threshold of the sketch.
+ */
+inline uint32_t sketchThreshold( size_t scale ) {
+    return scale <= 1 ? MAX_CORE_HASH : MAX_CORE_HASH / scale;
+};
+
+/**
+ * @brief Reduces a sorted set of cores and their counts to a FracMinHash sketch.
+ *
+ * Only the cores whose hash, see `hashCore()`, does not exceed the threshold are kept, together 
+ * with their counts, in their original order. Since the same cores are kept from every genome, the 
+ * sketches can be compared and merged like full sets of cores, and a sketch can be reduced further 
+ * to any smaller threshold.
+ *
+ * @param set The sorted set of cores, filtered in-place.
+ * @param counts The counts of the cores in `set`, filtered in-place.
+ * @param threshold The threshold of the sketch, see `sketchThreshold()`.
+ */
+void sketchCores( std::vector<uint32_t>& set, std::vector<size_t>& counts, uint32_t threshold );
+
 #endif
\ No newline at end of file
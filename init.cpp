@@ -2,16 +2,24 @@
 
 
 void printUsage() {
-    std::cout << "Usage: ./gencore [OPTIONS] [FILES]" << std::endl << std::endl;
+    std::cout << "Usage: ./gencore [index|query|merge] [OPTIONS] [FILES]" << std::endl << std::endl;
+    std::cout << "Commands:" << std::endl;
+    std::cout << "  index           Build a reference database of the input files, written to the file given with --db." << std::endl;
+    std::cout << "                  Usage: ./gencore index -r ref1.cores,ref2.cores --db refs.gcdb" << std::endl << std::endl;
+    std::cout << "  merge           Assemble the shard files computed with --shard into the distance matrices." << std::endl;
+    std::cout << "                  Usage: ./gencore merge gc.1-2.shard,gc.2-2.shard -p gc" << std::endl << std::endl;
+    std::cout << "  query           Compare the input files with the references of the database given with --db." << std::endl;
+    std::cout << "                  Usage: ./gencore query fq reads1.fq.gz,reads2.fq.gz --db refs.gcdb -p triage" << std::endl << std::endl;
     std::cout << "Options:" << std::endl;
     std::cout << "  -r              Read cores from specified files (read mode)" << std::endl;
     std::cout << "                  Usage: ./gencore -r file1.cores,file2.cores" << std::endl;
     std::cout << "                  Usage: ./gencore -r -f files.txt" << std::endl << std::endl;
     std::cout << "  [fa|fq|bam]     Execute program with specified files in the given format" << std::endl;
-    std::cout << "                  Supported formats: [ fa | fq.gz | bam ]" << std::endl;
+    std::cout << "                  Supported formats: [ fa | fa.gz | fq.gz | bam | cram ]" << std::endl;
     std::cout << "                  Usage: ./gencore fa ref1.fa,ref2.fa" << std::endl;
     std::cout << "                         ./gencore fq reads1.fq.gz,reads2.fq.gz" << std::endl;
-    std::cout << "                         ./gencore bam aln1.bam,aln2.bam" << std::endl << std::endl;
+    std::cout << "                         ./gencore bam aln1.bam,aln2.bam" << std::endl;
+    std::cout << "                         samtools view -b aln1.bam chr1 | ./gencore bam -,aln2.bam" << std::endl << std::endl;
     std::cout << "  -f [filename]   Execute program with a file that contains input/output file names" << std::endl;
     std::cout << "                  Usage: ./gencore fa -f files.txt" << std::endl << std::endl;
     std::cout << "  -l [level]      Set lcp-level. [Default: 4]" << std::endl;
@@ -20,11 +28,47 @@ void printUsage() {
     std::cout << "                  Usage: ./gencore fa ref1.fa,ref2.fa -t 2" << std::endl << std::endl;
     std::cout << "  [--set|--vec]   Set program to calculate distances based or set or vector of cores. [Default: vector]" << std::endl;
     std::cout << "                  Usage: ./gencore fa ref1.fa,ref2.fa --set" << std::endl << std::endl;
+    std::cout << "  --chr           Process chromosomes of fasta files as separate tasks. [Default: false]" << std::endl;
+    std::cout << "                  Usage: ./gencore fa ref1.fa,ref2.fa --chr" << std::endl << std::endl;
+    std::cout << "  --seg [length]  Split chromosomes longer than length into segments processed in parallel. Implies --chr." << std::endl;
+    std::cout << "                  Segments are parsed with a margin of 100 kbp, a warning is logged if it is too short for the LCP level." << std::endl;
+    std::cout << "                  Usage: ./gencore fa ref1.fa,ref2.fa --seg 10000000" << std::endl << std::endl;
+    std::cout << "  --bed [file]    Only process BAM records in the target regions of the BED file." << std::endl;
+    std::cout << "                  Usage: ./gencore bam aln1.bam,aln2.bam --bed targets.bed" << std::endl << std::endl;
+    std::cout << "  --ref [file]    Reference FASTA used to decode CRAM files." << std::endl;
+    std::cout << "                  Usage: ./gencore cram aln1.cram,aln2.cram --ref ref.fa" << std::endl << std::endl;
+    std::cout << "  -F [flags]      Skip BAM records having any of the flags set. [Default: 0x900]" << std::endl;
+    std::cout << "                  Usage: ./gencore bam aln1.bam,aln2.bam -F 0xF00" << std::endl << std::endl;
+    std::cout << "  [--mapped|--unmapped] Only process mapped or unmapped BAM records." << std::endl;
+    std::cout << "                  Usage: ./gencore bam aln1.bam,aln2.bam --unmapped" << std::endl << std::endl;
+    std::cout << "  --scale [scale] Compare FracMinHash sketches keeping about one in scale distinct cores. [Default: 1, all cores]" << std::endl;
+    std::cout << "                  Usage: ./gencore fa ref1.fa,ref2.fa --scale 1000" << std::endl << std::endl;
+    std::cout << "  --sketch [filenames] Store the sketches of the input files, readable with -r. Inputs joined with + are merged." << std::endl;
+    std::cout << "                  Usage: ./gencore fa ref1.fa,ref2.fa --scale 1000 --sketch ref1.sketch,ref2.sketch" << std::endl;
+    std::cout << "                         ./gencore -r ref1.sketch,ref2.sketch+ref3.sketch" << std::endl << std::endl;
     std::cout << "  -w [filenames]  Store cores processed from input files." << std::endl;
     std::cout << "                  Usage: ./gencore fa ref1.fa,ref2.fa -w -f files.txt" << std::endl << std::endl;
     std::cout << "                         ./gencore fa ref1.fa,ref2.fa -w ref1.cores,ref2.cores" << std::endl;
     std::cout << "  -p [prefix]     Prefix for the output of the similarity matrices results. [Default: gc]" << std::endl;
     std::cout << "                  Usage ./gencore fa -i infiles.txt -o outfiles.txt -p primates" << std::endl << std::endl;
+    std::cout << "  --db [file]     Reference database built by the index command and used by the query command." << std::endl;
+    std::cout << "                  Usage: ./gencore query fa sample.fa --db refs.gcdb" << std::endl << std::endl;
+    std::cout << "  --memory [size] Memory budget of the signatures, with K, M or G suffixes, excluding the matrix and its writer. Core files are compared in blocks read from disk." << std::endl;
+    std::cout << "                  Usage: ./gencore -r -f cores.txt --memory 64G" << std::endl << std::endl;
+    std::cout << "  --top-k [k]     Write the k nearest neighbours of every genome to <prefix>.topk.tsv instead of the matrices." << std::endl;
+    std::cout << "                  Usage: ./gencore -r -f cores.txt --top-k 10" << std::endl << std::endl;
+    std::cout << "  --prefilter [scale] Compare only candidates found on sketches at the given scale with --top-k." << std::endl;
+    std::cout << "                  Usage: ./gencore -r -f cores.txt --top-k 10 --prefilter 1000" << std::endl << std::endl;
+    std::cout << "  --postings      Compare all pairs through an inverted index of the cores, faster when most pairs share few cores." << std::endl;
+    std::cout << "                  Usage: ./gencore -r -f cores.txt --postings" << std::endl << std::endl;
+    std::cout << "  --shard [i/n]   Compute the i-th of n parts of the pairs and save them to <prefix>.<i>-<n>.shard, see merge." << std::endl;
+    std::cout << "                  Usage: ./gencore -r -f cores.txt --shard 3/8" << std::endl << std::endl;
+    std::cout << "  --state         Save the state of the similarity matrix to <prefix>.state, to be updated with --update." << std::endl;
+    std::cout << "                  Usage: ./gencore -r ref1.cores,ref2.cores --state" << std::endl << std::endl;
+    std::cout << "  --update [file] Reuse the similarities of the genomes of a saved state, only pairs with new genomes are computed." << std::endl;
+    std::cout << "                  Usage: ./gencore -r ref1.cores,ref2.cores,ref3.cores --update gc.state" << std::endl << std::endl;
+    std::cout << "  --format [name] Format of the distance matrices: phy, lower, bin, bin32 or npy. [Default: phy]" << std::endl;
+    std::cout << "                  Usage: ./gencore fa ref1.fa,ref2.fa --format npy" << std::endl << std::endl;
     std::cout << "  -s [shortnames] Set short names of input files. Default is first 10 characters of input file names." << std::endl;
     std::cout << "                  Usage: ./gencore fa ref1.fa,ref2.fa -s -f files.txt" << std::endl << std::endl;
     std::cout << "                         ./gencore fa ref1.fa,ref2.fa -s ref1,ref2" << std::endl;
@@ -41,21 +85,68 @@ void parse( int argc, char **argv, std::vector<struct targs>& thread_arguments,
     }
 
     // set program arguments with their default values
+    program_arguments.command = COMPARE;
     program_arguments.mode = FA;
     program_arguments.type = VECTOR;
     program_arguments.readCores = false;
     program_arguments.writeCores = false;
+    program_arguments.splitChromosomes = false;
+    program_arguments.segmentLength = 0;
+    program_arguments.bedFile = "";
+    program_arguments.referenceFile = "";
+    program_arguments.databaseFile = "";
+    program_arguments.updateFile = "";
+    program_arguments.writeState = false;
+    program_arguments.skipFlags = SKIP_FLAGS;
+    program_arguments.requiredFlags = 0;
     program_arguments.prefix = PREFIX;
+    program_arguments.format = PHY;
     program_arguments.threadNumber = THREAD_NUMBER;
     program_arguments.lcpLevel = 7;
+    program_arguments.scale = 1;
+    program_arguments.memoryBudget = 0;
+    program_arguments.shardIndex = 0;
+    program_arguments.shardCount = 0;
+    program_arguments.shardBegin = 0;
+    program_arguments.shardEnd = 0;
+    program_arguments.topK = 0;
+    program_arguments.prefilterScale = 0;
+    program_arguments.usePostings = false;
     program_arguments.verbose = false;
 
     int index = 1;
     
+    // ------------------------------------------------------------------
+    // Read `command` 
+    // ------------------------------------------------------------------
+    if ( strcmp(argv[index], "index") == 0 || strcmp(argv[index], "query") == 0 ) {
+        program_arguments.command = strcmp(argv[index], "index") == 0 ? INDEX : QUERY;
+
+        // move next argument
+        index++;
+
+        // validate if following next argument exists
+        if ( index >= argc ) {
+            log(ERROR, "Missing program mode.");
+            exit(1);
+        }
+    } else if ( strcmp(argv[index], "merge") == 0 ) {
+        program_arguments.command = MERGE;
+
+        // shard files are given instead of a mode and input files
+        program_arguments.readCores = true;
+
+        // move next argument
+        index++;
+    }
+
+    // a database can be built of, or queried with, a single genome
+    const size_t min_files = program_arguments.command == COMPARE ? 2 : 1;
+
     // ------------------------------------------------------------------
     // Read `read mode` 
     // ------------------------------------------------------------------
-    if ( strcmp(argv[index], "-r") == 0 ) {
+    if ( program_arguments.command != MERGE && index < argc && strcmp(argv[index], "-r") == 0 ) {
         program_arguments.readCores = true;
 
         // move next argument
@@ -78,7 +169,7 @@ void parse( int argc, char **argv, std::vector<struct targs>& thread_arguments,
             program_arguments.mode = FA;
         } else if ( strcmp(argv[index], "fq") == 0 ) {
             program_arguments.mode = FQ;
-        } else if ( strcmp(argv[index], "bam") == 0 ) {
+        } else if ( strcmp(argv[index], "bam") == 0 || strcmp(argv[index], "cram") == 0 ) {
             program_arguments.mode = BAM;
         } else {
             log(ERROR, "Invalid mode provided.");
@@ -118,6 +209,7 @@ void parse( int argc, char **argv, std::vector<struct targs>& thread_arguments,
             while ( getline( file, line ) ) {
                 struct targs args;
                 args.inFileName = line;
+                args.scale = 1;
                 thread_arguments.push_back(args);
             }
         } else {
@@ -127,9 +219,9 @@ void parse( int argc, char **argv, std::vector<struct targs>& thread_arguments,
 
         file.close();
         
-        // validate if at least 2 files are provided
-        if ( thread_arguments.size() < 2 ) {
-            log(ERROR, "There should be at least 2 files in %s", filename.c_str());
+        // validate if enough files are provided
+        if ( thread_arguments.size() < min_files ) {
+            log(ERROR, "There should be at least %zu files in %s", min_files, filename.c_str());
             exit(1);
         }
     } else {                                    // if file names are given in comma seperated format
@@ -140,18 +232,31 @@ void parse( int argc, char **argv, std::vector<struct targs>& thread_arguments,
         while ( std::getline(ss, filename, ',') ) {
             struct targs args;
             args.inFileName = filename;
+            args.scale = 1;
             thread_arguments.push_back(args);
         }
 
-        // validate if at least 2 files are provided
-        if ( thread_arguments.size() < 2 ) {
-            log(ERROR, "There should be at least 2 files in %s, separated by commas.", argv[index]);
+        // validate if enough files are provided
+        if ( thread_arguments.size() < min_files ) {
+            log(ERROR, "There should be at least %zu files in %s, separated by commas.", min_files, argv[index]);
             exit(1);
         }
     }
     // move next argument
     index++;
 
+    // standard input can only be read once
+    size_t stdin_count = 0;
+
+    for ( std::vector<struct targs>::iterator it = thread_arguments.begin(); it < thread_arguments.end(); it++ ) {
+        stdin_count += ( it->inFileName == "-" );
+    }
+
+    if ( stdin_count > 1 ) {
+        log(ERROR, "Only one input can be read from standard input.");
+        exit(1);
+    }
+
     // Set short names' default values (first 10 characters of input file names)
     // If the file name is less than 10 characters, fill with space.
     for ( std::vector<struct targs>::iterator it = thread_arguments.begin(); it < thread_arguments.end(); it++ ) {
@@ -206,6 +311,128 @@ void parse( int argc, char **argv, std::vector<struct targs>& thread_arguments,
             index++;               
         } 
         // ------------------------------------------------------------------
+        // Read `chromosome split` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--chr") == 0 ) {
+            program_arguments.splitChromosomes = true;
+            
+            // move next argument
+            index++;
+        }
+        // ------------------------------------------------------------------
+        // Read `segment length` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--seg") == 0 ) {
+
+            // move next argument, skip `--seg`
+            index++;
+
+            // validate if following next argument exists
+            if ( index >= argc ) {
+                log(ERROR, "Missing value for segment length.");
+                exit(1);
+            }
+
+            // get segment length and validate it
+            try {
+                if ( std::stoll(argv[index]) <= 0 ) {
+                    throw std::invalid_argument("Invalid segment length");
+                }
+                program_arguments.segmentLength = std::stoll(argv[index]);
+            } catch ( const std::invalid_argument& e) {
+                log(ERROR, "Invalid segment length provided.");
+                exit(1);
+            }
+
+            // segments are scheduled as chromosome tasks
+            program_arguments.splitChromosomes = true;
+
+            // move next argument
+            index++;
+        }
+        // ------------------------------------------------------------------
+        // Read `target regions` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--bed") == 0 ) {
+
+            // move next argument, skip `--bed`
+            index++;
+
+            // validate if following next argument exists
+            if ( index >= argc ) {
+                log(ERROR, "Missing BED file name.");
+                exit(1);
+            }
+
+            program_arguments.bedFile = argv[index];
+
+            // move next argument
+            index++;
+        }
+        // ------------------------------------------------------------------
+        // Read `reference` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--ref") == 0 ) {
+
+            // move next argument, skip `--ref`
+            index++;
+
+            // validate if following next argument exists
+            if ( index >= argc ) {
+                log(ERROR, "Missing reference file name.");
+                exit(1);
+            }
+
+            program_arguments.referenceFile = argv[index];
+
+            // move next argument
+            index++;
+        }
+        // ------------------------------------------------------------------
+        // Read `skip flags` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "-F") == 0 ) {
+
+            // move next argument, skip `-F`
+            index++;
+
+            // validate if following next argument exists
+            if ( index >= argc ) {
+                log(ERROR, "Missing value for skip flags.");
+                exit(1);
+            }
+
+            // get flags, decimal, hexadecimal or octal, and validate them
+            try {
+                long flags = std::stol(argv[index], NULL, 0);
+                if ( flags < 0 || flags > 0xFFFF ) {
+                    throw std::invalid_argument("Invalid skip flags");
+                }
+                program_arguments.skipFlags = flags;
+            } catch ( const std::invalid_argument& e) {
+                log(ERROR, "Invalid skip flags provided.");
+                exit(1);
+            }
+
+            // move next argument
+            index++;
+        }
+        // ------------------------------------------------------------------
+        // Read `mapping selection` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--mapped") == 0 || strcmp(argv[index], "--unmapped") == 0 ) {
+            if ( strcmp(argv[index], "--mapped") == 0 ) {
+                program_arguments.requiredFlags &= ~UNMAPPED_FLAG;
+                program_arguments.skipFlags |= UNMAPPED_FLAG;
+            } else {
+                program_arguments.requiredFlags |= UNMAPPED_FLAG;
+                program_arguments.skipFlags &= ~UNMAPPED_FLAG;
+            }
+
+            // move next argument
+            index++;
+        }
+        // ------------------------------------------------------------------
         // Read `LCP level` 
         // ------------------------------------------------------------------
         else if( strcmp(argv[index], "-l") == 0 ) {
@@ -234,6 +461,99 @@ void parse( int argc, char **argv, std::vector<struct targs>& thread_arguments,
             index++;
         } 
         // ------------------------------------------------------------------
+        // Read `sketch scale` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--scale") == 0 ) {
+            
+            // move next argument, skip `--scale`
+            index++;
+            
+            // validate if following next argument exists
+            if ( index >= argc ) {
+                log(ERROR, "Missing value for sketch scale.");
+                exit(1);
+            }
+
+            // get scale and validate it
+            try {
+                if ( std::stol(argv[index]) <= 0 ) {
+                    throw std::invalid_argument("Invalid sketch scale");
+                }
+                program_arguments.scale = std::stol(argv[index]);
+            } catch ( const std::invalid_argument& e) {
+                log(ERROR, "Invalid sketch scale provided.");
+                exit(1);
+            }
+
+            // move next argument
+            index++;
+        } 
+        // ------------------------------------------------------------------
+        // Read `sketch file names` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--sketch") == 0 ) {
+
+            // move next argument, skip `--sketch`
+            index++;
+            
+            // validate if following next argument exists
+            if ( index >= argc ) {
+                log(ERROR, "Missing sketch files names.");
+                exit(1);
+            }
+            
+            if ( strcmp(argv[index], "-f") == 0 ) {         // if sketch file names are provided in txt file
+                
+                // move next argument, skip `-f`
+                index++;
+                
+                // validate if following next argument exists
+                if ( index >= argc ) {
+                    log(ERROR, "Missing file name.");
+                    exit(1);
+                }
+
+                // read file names from file
+                std::string filename(argv[index]);        
+                std::fstream file;
+                file.open( filename, std::ios::in );
+                
+                if ( file.is_open() ) {  
+                    try {
+                        for ( std::vector<struct targs>::iterator it = thread_arguments.begin(); it < thread_arguments.end(); it++ ) {
+                            if ( !std::getline(file, it->sketchFileName) ) {
+                                throw std::invalid_argument("Missing sketch file name.");
+                            }
+                        }
+                    } catch ( const std::invalid_argument& e) {
+                        log(ERROR, "Number of input file should match sketch file names count.");
+                        exit(1);
+                    }
+                } else {
+                    log(ERROR, "Couldn't open %s", filename.c_str());
+                    exit(1);
+                }
+
+                file.close();
+            } else {                                        // if sketch file names are provided in comma seperated format
+                try {
+                    std::stringstream ss(argv[index]);
+                    // parse given file names w.r.t comma and set to thread arguments' sketchFileName
+                    for ( std::vector<struct targs>::iterator it = thread_arguments.begin(); it < thread_arguments.end(); it++ ) {
+                        if ( !std::getline(ss, it->sketchFileName, ',') ) {
+                            throw std::invalid_argument("Failed to parse sketch file name.");
+                        }
+                    }
+                } catch ( const std::invalid_argument& e) {
+                    log(ERROR, "Number of input file should match sketch file names count.");
+                    exit(1);
+                }
+            }
+            
+            // move next argument
+            index++;
+        }
+        // ------------------------------------------------------------------
         // Read `output file names` 
         // ------------------------------------------------------------------
         else if( strcmp(argv[index], "-w") == 0 ) {
@@ -321,6 +641,193 @@ void parse( int argc, char **argv, std::vector<struct targs>& thread_arguments,
             index++;
         } 
         // ------------------------------------------------------------------
+        // Read `database` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--db") == 0 ) {
+
+            // move next argument, skip `--db`
+            index++;
+
+            // validate if following next argument exists
+            if ( index >= argc ) {
+                log(ERROR, "Missing database file name.");
+                exit(1);
+            }
+
+            program_arguments.databaseFile = argv[index];
+
+            // move next argument
+            index++;
+        }
+        // ------------------------------------------------------------------
+        // Read `memory budget` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--memory") == 0 ) {
+
+            // move next argument, skip `--memory`
+            index++;
+
+            // validate if following next argument exists
+            if ( index >= argc ) {
+                log(ERROR, "Missing value for memory budget.");
+                exit(1);
+            }
+
+            // get budget with an optional binary unit
+            char* unit;
+            unsigned long long budget = strtoull( argv[index], &unit, 10 );
+
+            if ( strcmp(unit, "K") == 0 || strcmp(unit, "k") == 0 ) {
+                budget <<= 10;
+            } else if ( strcmp(unit, "M") == 0 || strcmp(unit, "m") == 0 ) {
+                budget <<= 20;
+            } else if ( strcmp(unit, "G") == 0 || strcmp(unit, "g") == 0 ) {
+                budget <<= 30;
+            } else if ( *unit != '\0' ) {
+                budget = 0;
+            }
+
+            if ( budget == 0 || unit == argv[index] ) {
+                log(ERROR, "Invalid memory budget provided: %s", argv[index]);
+                exit(1);
+            }
+
+            program_arguments.memoryBudget = budget;
+
+            // move next argument
+            index++;
+        }
+        // ------------------------------------------------------------------
+        // Read `top k` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--top-k") == 0 || strcmp(argv[index], "--prefilter") == 0 ) {
+
+            const bool prefilter = strcmp(argv[index], "--prefilter") == 0;
+
+            // move next argument, skip `--top-k` or `--prefilter`
+            index++;
+
+            // validate if following next argument exists
+            if ( index >= argc ) {
+                log(ERROR, "Missing value for %s.", prefilter ? "prefilter scale" : "number of neighbours");
+                exit(1);
+            }
+
+            // get value and validate it
+            try {
+                if ( std::stol(argv[index]) <= 0 ) {
+                    throw std::invalid_argument("Invalid value");
+                }
+                ( prefilter ? program_arguments.prefilterScale : program_arguments.topK ) = std::stol(argv[index]);
+            } catch ( const std::invalid_argument& e) {
+                log(ERROR, "Invalid %s provided.", prefilter ? "prefilter scale" : "number of neighbours");
+                exit(1);
+            }
+
+            // move next argument
+            index++;
+        }
+        // ------------------------------------------------------------------
+        // Read `postings` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--postings") == 0 ) {
+            program_arguments.usePostings = true;
+
+            // move next argument
+            index++;
+        }
+        // ------------------------------------------------------------------
+        // Read `shard` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--shard") == 0 ) {
+
+            // move next argument, skip `--shard`
+            index++;
+
+            // validate if following next argument exists
+            if ( index >= argc ) {
+                log(ERROR, "Missing shard.");
+                exit(1);
+            }
+
+            // get shard as i/n and validate it
+            size_t shard = 0, shards = 0;
+            char rest;
+
+            if ( sscanf( argv[index], "%zu/%zu%c", &shard, &shards, &rest ) != 2 || shard == 0 || shard > shards ) {
+                log(ERROR, "Invalid shard provided: %s, expected i/n with 1 <= i <= n.", argv[index]);
+                exit(1);
+            }
+
+            program_arguments.shardIndex = shard;
+            program_arguments.shardCount = shards;
+
+            // move next argument
+            index++;
+        }
+        // ------------------------------------------------------------------
+        // Read `state` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--state") == 0 ) {
+            program_arguments.writeState = true;
+
+            // move next argument
+            index++;
+        }
+        // ------------------------------------------------------------------
+        // Read `update` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--update") == 0 ) {
+
+            // move next argument, skip `--update`
+            index++;
+
+            // validate if following next argument exists
+            if ( index >= argc ) {
+                log(ERROR, "Missing matrix state file name.");
+                exit(1);
+            }
+
+            // the updated state replaces the previous one
+            program_arguments.updateFile = argv[index];
+            program_arguments.writeState = true;
+
+            // move next argument
+            index++;
+        }
+        // ------------------------------------------------------------------
+        // Read `output format` 
+        // ------------------------------------------------------------------
+        else if( strcmp(argv[index], "--format") == 0 ) { 
+
+            // move next argument, skip `--format`
+            index++;
+
+            // validate if following next argument exists
+            if ( index >= argc ) {
+                log(ERROR, "Missing output format.");
+                exit(1);
+            }
+
+            if ( strcmp(argv[index], "phy") == 0 ) {
+                program_arguments.format = PHY;
+            } else if ( strcmp(argv[index], "lower") == 0 ) {
+                program_arguments.format = LOWER;
+            } else if ( strcmp(argv[index], "bin") == 0 ) {
+                program_arguments.format = BIN;
+            } else if ( strcmp(argv[index], "bin32") == 0 ) {
+                program_arguments.format = BIN32;
+            } else if ( strcmp(argv[index], "npy") == 0 ) {
+                program_arguments.format = NPY;
+            } else {
+                log(ERROR, "Invalid output format provided: %s", argv[index]);
+                exit(1);
+            }
+            
+            // move next argument
+            index++;
+        } 
+        // ------------------------------------------------------------------
         // Read `short names` 
         // ------------------------------------------------------------------
         else if( strcmp(argv[index], "-s") == 0 ) { 
@@ -417,7 +924,57 @@ void parse( int argc, char **argv, std::vector<struct targs>& thread_arguments,
         }
     }
 
+    if ( ( program_arguments.command == INDEX || program_arguments.command == QUERY ) && program_arguments.databaseFile.empty() ) {
+        log(ERROR, "Missing database file, set it with --db.");
+        exit(1);
+    }
+
+    if ( program_arguments.memoryBudget > 0 ) {
+        if ( program_arguments.command != COMPARE || !program_arguments.readCores ) {
+            log(ERROR, "Memory budget is only supported for all-vs-all comparisons of core files, write them with -w first.");
+            exit(1);
+        }
+        for ( std::vector<struct targs>::iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+            if ( !it->sketchFileName.empty() ) {
+                log(ERROR, "Sketches cannot be saved with a memory budget.");
+                exit(1);
+            }
+        }
+    }
+
+    if ( ( program_arguments.command != COMPARE && program_arguments.command != MERGE && program_arguments.writeState ) || ( program_arguments.command == MERGE && !program_arguments.updateFile.empty() ) ) {
+        log(ERROR, "Matrix states are only used by all-vs-all comparisons.");
+        exit(1);
+    }
+
+    if ( program_arguments.prefilterScale > 0 && program_arguments.topK == 0 ) {
+        log(ERROR, "Prefilter is only used with --top-k.");
+        exit(1);
+    }
+
+    if ( program_arguments.topK > 0 && ( program_arguments.command != COMPARE || program_arguments.shardCount > 0 || program_arguments.memoryBudget > 0 || program_arguments.writeState || !program_arguments.updateFile.empty() ) ) {
+        log(ERROR, "Nearest neighbours are searched by all-vs-all comparisons in memory, without --shard, --memory, --state or --update.");
+        exit(1);
+    }
+
+    if ( program_arguments.usePostings && ( program_arguments.command != COMPARE || program_arguments.memoryBudget > 0 || program_arguments.topK > 0 ) ) {
+        log(ERROR, "Postings are only used by all-vs-all comparisons in memory, without --memory or --top-k.");
+        exit(1);
+    }
+
+    if ( program_arguments.shardCount > 0 && ( program_arguments.command != COMPARE || program_arguments.writeState || !program_arguments.updateFile.empty() ) ) {
+        log(ERROR, "Shards are computed by all-vs-all comparisons without --update, their state is saved by the merge command.");
+        exit(1);
+    }
+
     // Log parameters
+    if ( program_arguments.command == MERGE ) {
+        log(INFO, "Command: merge, shards: %zu", thread_arguments.size());
+        return;
+    }
+    if ( program_arguments.command != COMPARE ) {
+        log(INFO, "Command: %s, database: %s", ( program_arguments.command == INDEX ? "index" : "query" ), program_arguments.databaseFile.c_str());
+    }
     if( program_arguments.readCores ) { 
         log(INFO, "Reading cores from file.");
     } else {
@@ -427,7 +984,53 @@ void parse( int argc, char **argv, std::vector<struct targs>& thread_arguments,
     log(INFO, "Distance calculation mode: %s", ( program_arguments.type == SET ? "set" : "vector" ) );
     log(INFO, "Thread number: %d", program_arguments.threadNumber);
     log(INFO, "LCP level: %d", program_arguments.lcpLevel);
+
+    if ( program_arguments.scale > 1 ) {
+        log(INFO, "Sketch scale: %zu", program_arguments.scale);
+    }
+
+    if ( program_arguments.topK > 0 ) {
+        log(INFO, "Nearest neighbours: %zu", program_arguments.topK);
+    }
+
+    if ( program_arguments.prefilterScale > 0 ) {
+        log(INFO, "Prefilter sketch scale: %zu", program_arguments.prefilterScale);
+    }
+
+    if ( program_arguments.usePostings ) {
+        log(INFO, "Comparing through postings of the cores.");
+    }
+
+    if ( program_arguments.memoryBudget > 0 ) {
+        log(INFO, "Memory budget: %.2f GB", program_arguments.memoryBudget / 1e9);
+    }
+
+    if ( !program_arguments.updateFile.empty() ) {
+        log(INFO, "Updating matrix state: %s", program_arguments.updateFile.c_str());
+    }
+
+    if ( program_arguments.splitChromosomes ) {
+        log(INFO, "Chromosomes are processed as separate tasks.");
+    }
+    if ( program_arguments.segmentLength != 0 ) {
+        log(INFO, "Segment length: %d", program_arguments.segmentLength);
+    }
+    if ( !program_arguments.bedFile.empty() ) {
+        if ( program_arguments.mode != BAM || program_arguments.readCores ) {
+            log(WARN, "Target regions are only used in BAM mode, %s is ignored.", program_arguments.bedFile.c_str());
+        } else {
+            log(INFO, "Target regions: %s", program_arguments.bedFile.c_str());
+        }
+    }
+    if ( program_arguments.mode == BAM && !program_arguments.readCores ) {
+        log(INFO, "Skip flags: 0x%x, required flags: 0x%x", program_arguments.skipFlags, program_arguments.requiredFlags);
+
+        if ( !program_arguments.referenceFile.empty() ) {
+            log(INFO, "Reference: %s", program_arguments.referenceFile.c_str());
+        }
+    }
     log(INFO, "Prefix: %s", program_arguments.prefix.c_str());
+    log(INFO, "Output format: %s", ( program_arguments.format == PHY ? "phy" : ( program_arguments.format == LOWER ? "lower" : ( program_arguments.format == BIN ? "bin" : ( program_arguments.format == BIN32 ? "bin32" : "npy" ) ) ) ) );
 
     for ( std::vector<struct targs>::iterator it = thread_arguments.begin(); it < thread_arguments.end(); it++ ) {
         log(INFO, "inFileName: %s, shortName: %s, outFileName: %s", it->inFileName.c_str(), it->shortName.c_str(), it->outFileName.c_str());
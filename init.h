@@ -22,6 +22,16 @@
 #define PREFIX "gc"
 #endif
 
+// secondary (0x100) and supplementary (0x800) records repeat the sequence of a primary record
+#ifndef SKIP_FLAGS
+#define SKIP_FLAGS 0x900
+#endif
+
+// flag of unmapped records, see the SAM specification
+#ifndef UNMAPPED_FLAG
+#define UNMAPPED_FLAG 0x4
+#endif
+
 /**
  * @brief Displays the usage information for the program.
  *
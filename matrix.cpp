@@ -0,0 +1,228 @@
+#include "matrix.h"
+
+
+void compute_matrices( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, TriangularMatrix& matrix, const std::vector<bool>& known ) {
+
+    const size_t numGenomes = thread_arguments.size();
+
+    std::vector<struct tile> tiles;
+    struct tile area = { 0, numGenomes, 0, numGenomes, 0, 0 };
+
+    // a shard only has pairs in the rows of its tiles
+    if ( program_arguments.shardCount > 0 ) {
+        std::vector<bool> genomes;
+        shard_genomes( numGenomes, program_arguments.shardBegin, program_arguments.shardEnd, genomes, area.row_begin, area.row_end );
+    }
+
+    make_tiles( thread_arguments, program_arguments, known, area, tiles );
+
+    // the per-genome terms of the comparisons
+    std::vector<double> sizes;
+    std::vector<size_t> totals;
+    sizes.reserve( numGenomes );
+    totals.reserve( numGenomes );
+
+    for ( std::vector<struct targs>::const_iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+        sizes.push_back( calculateTotalSize( *it, program_arguments ) );
+        totals.push_back( calculateCountTotal( *it ) );
+    }
+
+    // merged elements and compared pairs
+    size_t elements = 0, pairs = 0;
+
+    for ( std::vector<struct tile>::const_iterator it = tiles.begin(); it != tiles.end(); it++ ) {
+        elements += it->cost;
+        pairs += it->pairs;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+
+    for ( size_t i = 0; i < std::min( tiles.size(), program_arguments.threadNumber ); i++ ) {
+        threads.emplace_back( compute_tiles, std::cref(tiles), std::ref(next), std::cref(thread_arguments), std::cref(sizes), std::cref(totals), std::cref(program_arguments), std::cref(known), std::ref(matrix) );
+    }
+
+    for ( std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++ ) {
+        if ((*it).joinable()) {
+            (*it).join();
+        }
+    }
+
+    if ( program_arguments.verbose && pairs > 0 ) {
+        double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+        log(INFO, "Compared %zu pairs in %.2f seconds (%.0f elements/s, %zu threads)", pairs, seconds, elements / seconds, program_arguments.threadNumber);
+    }
+};
+
+
+void make_tiles( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const std::vector<bool>& known, const struct tile& area, std::vector<struct tile>& tiles ) {
+
+    for ( size_t row = area.row_begin; row < area.row_end; row += MATRIX_TILE_SIZE ) {
+        for ( size_t column = std::max( area.column_begin, row ); column < area.column_end; column += MATRIX_TILE_SIZE ) {
+            struct tile t = { row, std::min( row + MATRIX_TILE_SIZE, area.row_end ), column, std::min( column + MATRIX_TILE_SIZE, area.column_end ), 0, 0 };
+
+            // a merge of two core sets is linear in their sizes
+            for ( size_t i = t.row_begin; i < t.row_end; i++ ) {
+                for ( size_t j = std::max( t.column_begin, i + 1 ); j < t.column_end; j++ ) {
+                    if ( ( !known[i] || !known[j] ) && in_shard( i, j, thread_arguments.size(), program_arguments ) ) {
+                        t.cost += thread_arguments[i].cores.size() + thread_arguments[j].cores.size();
+                        t.pairs++;
+                    }
+                }
+            }
+
+            if ( t.pairs > 0 ) {
+                tiles.push_back(t);
+            }
+        }
+    }
+
+    // longest processing time first
+    std::stable_sort( tiles.begin(), tiles.end(), []( const struct tile& a, const struct tile& b ) {
+        return a.cost > b.cost;
+    });
+};
+
+
+void compute_tiles( const std::vector<struct tile>& tiles, std::atomic<size_t>& next, const std::vector<struct targs>& thread_arguments, const std::vector<double>& sizes, const std::vector<size_t>& totals, const struct pargs& program_arguments, const std::vector<bool>& known, TriangularMatrix& matrix ) {
+
+    size_t index;
+
+    while ( ( index = next++ ) < tiles.size() ) {
+        const struct tile& t = tiles[index];
+
+        for ( size_t i = t.row_begin; i < t.row_end; i++ ) {
+            for ( size_t j = std::max( t.column_begin, i + 1 ); j < t.column_end; j++ ) {
+
+                if ( ( known[i] && known[j] ) || !in_shard( i, j, thread_arguments.size(), program_arguments ) ) {
+                    continue;
+                }
+
+                struct comparison result;
+                compareCores( thread_arguments[i], thread_arguments[j], totals[i], totals[j], program_arguments, result );
+
+                struct similarity& cell = matrix.at( i, j );
+                cell.jaccard = calculateJaccardSimilarity( result.interSize, result.unionSize );
+                cell.dice = calculateDiceSimilarity( result.interSize, sizes[i], sizes[j] );
+                cell.distance = calculateNormalizedVectorSimilarity( result.numerator, result.denominator );
+            }
+        }
+    }
+};
+
+
+void shard_bounds( const std::vector<size_t>& lengths, size_t shardCount, std::vector<size_t>& bounds ) {
+
+    const size_t numGenomes = lengths.size();
+    const size_t rows = ( numGenomes + MATRIX_TILE_SIZE - 1 ) / MATRIX_TILE_SIZE;
+    const size_t tiles = tile_count( numGenomes );
+
+    // cores of the genomes of every row of tiles, and of the rows from it to the last one
+    std::vector<uint64_t> cores( rows, 0 ), after( rows + 1, 0 );
+
+    for ( size_t i = 0; i < numGenomes; i++ ) {
+        cores[i / MATRIX_TILE_SIZE] += lengths[i];
+    }
+    for ( size_t row = rows; row-- > 0; ) {
+        after[row] = after[row + 1] + cores[row];
+    }
+
+    auto genomes = [&]( size_t row ) -> uint64_t {
+        return std::min( ( row + 1 ) * MATRIX_TILE_SIZE, numGenomes ) - row * MATRIX_TILE_SIZE;
+    };
+
+    // every genome of a tile is compared with every genome of the other side
+    auto tile_cost = [&]( size_t row, size_t column ) -> uint64_t {
+        return row == column ? ( genomes(row) - 1 ) * cores[row] : genomes(row) * cores[column] + genomes(column) * cores[row];
+    };
+    auto row_cost = [&]( size_t row ) -> uint64_t {
+        const uint64_t later = numGenomes - std::min( ( row + 1 ) * MATRIX_TILE_SIZE, numGenomes );
+        return ( genomes(row) - 1 ) * cores[row] + genomes(row) * after[row + 1] + later * cores[row];
+    };
+
+    uint64_t total = 0;
+
+    for ( size_t row = 0; row < rows; row++ ) {
+        total += row_cost( row );
+    }
+
+    bounds.assign( shardCount + 1, tiles );
+    bounds[0] = 0;
+
+    if ( total == 0 ) {
+        for ( size_t k = 1; k < shardCount; k++ ) {
+            bounds[k] = tiles * k / shardCount;
+        }
+        return;
+    }
+
+    // the shard k starts at the first tile whose preceding tiles cost k / shardCount of the total
+    auto target = [&]( size_t k ) -> uint64_t {
+        return (uint64_t)( (unsigned __int128)total * k / shardCount );
+    };
+
+    size_t k = 1, index = 0;
+    uint64_t before = 0;
+
+    for ( size_t row = 0; row < rows && k < shardCount; row++ ) {
+        const uint64_t cost = row_cost( row );
+
+        if ( before + cost < target( k ) ) {
+            before += cost;
+            index += rows - row;
+            continue;
+        }
+
+        for ( size_t column = row; column < rows; column++, index++ ) {
+            while ( k < shardCount && before >= target( k ) ) {
+                bounds[k++] = index;
+            }
+            before += tile_cost( row, column );
+        }
+    }
+};
+
+
+void shard_genomes( size_t numGenomes, size_t first, size_t last, std::vector<bool>& genomes, size_t& row_begin, size_t& row_end ) {
+
+    const size_t rows = ( numGenomes + MATRIX_TILE_SIZE - 1 ) / MATRIX_TILE_SIZE;
+
+    genomes.assign( numGenomes, false );
+    row_begin = numGenomes;
+    row_end = numGenomes;
+
+    // the tiles of a row of the grid are numbered consecutively from the diagonal, so the rows and the 
+    // columns of the range are marked as intervals of rows of tiles
+    std::vector<long long> marks( rows + 1, 0 );
+    size_t index = 0;
+
+    for ( size_t row = 0; row < rows && index < last; index += rows - row, row++ ) {
+        const size_t begin = std::max( first, index ), end = std::min( last, index + rows - row );
+
+        if ( begin >= end ) {
+            continue;
+        }
+
+        if ( row_begin == numGenomes ) {
+            row_begin = row * MATRIX_TILE_SIZE;
+        }
+        row_end = std::min( ( row + 1 ) * MATRIX_TILE_SIZE, numGenomes );
+
+        marks[row]++;
+        marks[row + 1]--;
+        marks[row + ( begin - index )]++;
+        marks[row + ( end - index )]--;
+    }
+
+    long long covered = 0;
+
+    for ( size_t row = 0; row < rows; row++ ) {
+        covered += marks[row];
+
+        for ( size_t i = row * MATRIX_TILE_SIZE; covered > 0 && i < std::min( ( row + 1 ) * MATRIX_TILE_SIZE, numGenomes ); i++ ) {
+            genomes[i] = true;
+        }
+    }
+};
@@ -0,0 +1,167 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "args.h"
+#include "logging.h"
+#include "similarity_metrics.h"
+#include "utils/TriangularMatrix.hpp"
+
+#ifndef MATRIX_TILE_SIZE
+#define MATRIX_TILE_SIZE 32
+#endif
+
+
+struct tile {
+    size_t row_begin;       // first genome of the rows
+    size_t row_end;         // genome after the last row
+    size_t column_begin;    // first genome of the columns
+    size_t column_end;      // genome after the last column
+    size_t cost;            // estimated work, sum of the sizes of the compared core sets
+    size_t pairs;           // number of pairs to be computed
+};
+
+
+/**
+ * @brief Numbers the tile of the pair (i, j), where i < j, in the grid of `MATRIX_TILE_SIZE` tiles.
+ *
+ * The tiles of the upper triangle are numbered row by row, starting from 0.
+ *
+ * @param i The first genome of the pair.
+ * @param j The second genome of the pair.
+ * @param numGenomes The number of genomes.
+ * @return The number of the tile.
+ */
+inline size_t tile_index( size_t i, size_t j, size_t numGenomes ) {
+    const size_t rows = ( numGenomes + MATRIX_TILE_SIZE - 1 ) / MATRIX_TILE_SIZE;
+    const size_t row = i / MATRIX_TILE_SIZE, column = j / MATRIX_TILE_SIZE;
+
+    return row * ( 2 * rows - row + 1 ) / 2 + ( column - row );
+};
+
+/**
+ * @brief Counts the tiles of the upper triangle of the grid of `MATRIX_TILE_SIZE` tiles.
+ *
+ * @param numGenomes The number of genomes.
+ * @return The number of tiles, the tile after the last one of `tile_index()`.
+ */
+inline size_t tile_count( size_t numGenomes ) {
+    const size_t rows = ( numGenomes + MATRIX_TILE_SIZE - 1 ) / MATRIX_TILE_SIZE;
+
+    return rows * ( rows + 1 ) / 2;
+};
+
+/**
+ * @brief Checks if the pair (i, j) is computed by the shard set with `--shard`.
+ *
+ * The shard computes the tiles from `shardBegin` up to, but not including, `shardEnd`, see 
+ * `shard_bounds()`. All pairs belong to the program if it is not sharded.
+ *
+ * @param i The first genome of the pair, i < j.
+ * @param j The second genome of the pair.
+ * @param numGenomes The number of genomes.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @return True if the pair is computed by the program; otherwise, false.
+ */
+inline bool in_shard( size_t i, size_t j, size_t numGenomes, const struct pargs& program_arguments ) {
+    if ( program_arguments.shardCount == 0 ) {
+        return true;
+    }
+
+    const size_t index = tile_index( i, j, numGenomes );
+
+    return program_arguments.shardBegin <= index && index < program_arguments.shardEnd;
+};
+
+/**
+ * @brief Splits the tiles of the grid into ranges of consecutive tiles of about the same cost.
+ *
+ * The cost of a tile is estimated as by `make_tiles()`, the sum of the sizes of the core sets of its 
+ * pairs, from an estimate of the number of cores of every genome. The ranges follow `tile_index()`, 
+ * so the rows of a shard are close to each other, and the first shards take fewer rows than the last 
+ * ones, whose rows are shorter. If all genomes are empty, the ranges have the same number of tiles.
+ *
+ * @param lengths A constant reference to the number of cores of every genome, or to any estimate of 
+ *        it in a unit common to all genomes.
+ * @param shardCount The number of shards.
+ * @param bounds An output vector of `shardCount` + 1 tile numbers; the shard i, from 1, computes the 
+ *        tiles from `bounds[i - 1]` up to, but not including, `bounds[i]`.
+ */
+void shard_bounds( const std::vector<size_t>& lengths, size_t shardCount, std::vector<size_t>& bounds );
+
+/**
+ * @brief Finds the genomes of the pairs of the tiles of a shard.
+ *
+ * @param numGenomes The number of genomes.
+ * @param first The first tile of the shard.
+ * @param last The tile after the last tile of the shard.
+ * @param genomes An output vector of n flags, set for the genomes in a row or a column of a tile.
+ * @param row_begin The first genome of the rows of the tiles, n if the shard has no tile.
+ * @param row_end The genome after the last genome of the rows of the tiles.
+ */
+void shard_genomes( size_t numGenomes, size_t first, size_t last, std::vector<bool>& genomes, size_t& row_begin, size_t& row_end );
+
+/**
+ * @brief Computes the similarity matrices of all pairs of genomes using multiple threads.
+ *
+ * The upper triangle of the pair space is partitioned into tiles of `MATRIX_TILE_SIZE` rows and 
+ * columns by `make_tiles()`. The tiles are sorted by their estimated cost, largest first, and taken 
+ * by `threadNumber` threads running `compute_tiles()`, so that the threads finish at about the same 
+ * time. The sizes of the core sets are calculated once per genome, and every pair is compared in 
+ * a single pass over its common cores by `compareCores()`. In verbose mode, the number of merged 
+ * elements per second is reported; `bench/intersect_bench.cpp` compares the kernels of 
+ * `intersectSorted()` with the previous merge loop.
+ * Every cell is computed independently and is written by exactly one thread, and `compareCores()` 
+ * adds up the terms of a pair in the order of its common cores, so the matrices do not depend on 
+ * the number of threads or on the order in which the tiles are taken.
+ *
+ * Only the pairs above the diagonal are stored, see `TriangularMatrix`. Pairs of genomes that are 
+ * both marked as known, e.g. restored from the state of a previous run by `load_state()`, are 
+ * already in the matrix and are skipped, so adding k genomes to n costs O(n k) comparisons. Pairs 
+ * outside the shard set with `--shard` are skipped as well, see `in_shard()`.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param matrix A reference to the matrix of similarities, of size n.
+ * @param known A constant reference to a vector of n flags, set for the genomes whose pairs with each 
+ *        other are already in the matrix.
+ */
+void compute_matrices( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, TriangularMatrix& matrix, const std::vector<bool>& known );
+
+/**
+ * @brief Partitions the upper triangle of an area of the pair space into tiles.
+ *
+ * Tiles without pairs to be computed are left out.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param known A constant reference to the flags of the genomes whose pairs are already computed.
+ * @param area A constant reference to the rows and columns to be partitioned, the whole matrix or a 
+ *        pair of blocks of genomes.
+ * @param tiles An output vector the tiles are appended to, largest estimated cost first.
+ */
+void make_tiles( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const std::vector<bool>& known, const struct tile& area, std::vector<struct tile>& tiles );
+
+/**
+ * @brief Computes the cells of tiles until no tile is left.
+ *
+ * Worker routine of `compute_matrices()`. Only cells above the diagonal are computed, unless both 
+ * genomes are known or the pair is outside the shard.
+ *
+ * @param tiles A constant reference to the tiles.
+ * @param next The index of the next tile to be computed, shared by the threads.
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param sizes A constant reference to the sizes of the core sets of the genomes, see `calculateTotalSize()`.
+ * @param totals A constant reference to the sums of the counts of the genomes, see `calculateCountTotal()`.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param known A constant reference to the flags of the genomes whose pairs are already computed.
+ * @param matrix A reference to the matrix of similarities.
+ */
+void compute_tiles( const std::vector<struct tile>& tiles, std::atomic<size_t>& next, const std::vector<struct targs>& thread_arguments, const std::vector<double>& sizes, const std::vector<size_t>& totals, const struct pargs& program_arguments, const std::vector<bool>& known, TriangularMatrix& matrix );
+
+#endif
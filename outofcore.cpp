@@ -0,0 +1,302 @@
+#include "outofcore.h"
+
+
+// bytes of a core and its count, on disk and in memory
+static const size_t CORE_BYTES = sizeof(uint32_t) + sizeof(size_t);
+
+
+static bool write_fully( int fd, const void* data, size_t bytes, uint64_t offset ) {
+    const char* buffer = static_cast<const char*>(data);
+
+    while ( bytes > 0 ) {
+        ssize_t written = pwrite( fd, buffer, bytes, offset );
+        if ( written <= 0 ) {
+            return false;
+        }
+        buffer += written;
+        bytes -= written;
+        offset += written;
+    }
+
+    return true;
+};
+
+
+static bool read_fully( int fd, void* data, size_t bytes, uint64_t offset ) {
+    char* buffer = static_cast<char*>(data);
+
+    while ( bytes > 0 ) {
+        ssize_t read = pread( fd, buffer, bytes, offset );
+        if ( read <= 0 ) {
+            return false;
+        }
+        buffer += read;
+        bytes -= read;
+        offset += read;
+    }
+
+    return true;
+};
+
+
+static void spill_genomes( std::vector<struct targs>& thread_arguments, struct pargs& program_arguments, struct signature_store& store, std::atomic<size_t>& next, std::atomic<uint64_t>& end ) {
+
+    size_t index;
+
+    while ( ( index = next.fetch_add(1) ) < thread_arguments.size() ) {
+        struct targs& genome = thread_arguments[index];
+
+        read_from_file( genome, program_arguments );
+
+        // cores are followed by their counts
+        const size_t length = genome.cores.size();
+        const uint64_t offset = end.fetch_add( length * CORE_BYTES );
+
+        if ( !write_fully( store.fd, genome.cores.data(), length * sizeof(uint32_t), offset ) ||
+             !write_fully( store.fd, genome.counts.data(), length * sizeof(size_t), offset + length * sizeof(uint32_t) ) ) {
+            log(ERROR, "Failed to write the signature of %s to %s.signatures", genome.inFileName.c_str(), program_arguments.prefix.c_str());
+            exit(1);
+        }
+
+        store.offsets[index] = offset;
+        store.lengths[index] = length;
+        store.scales[index] = std::max( genome.scale, (size_t)1 );
+
+        std::vector<uint32_t>().swap( genome.cores );
+        std::vector<size_t>().swap( genome.counts );
+    }
+};
+
+
+void spill_signatures( std::vector<struct targs>& thread_arguments, struct pargs& program_arguments, struct signature_store& store ) {
+
+    const size_t numGenomes = thread_arguments.size();
+    const std::string filename = program_arguments.prefix + ".signatures";
+
+    store.fd = open( filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600 );
+
+    if ( store.fd < 0 ) {
+        log(ERROR, "Couldn't open %s", filename.c_str());
+        exit(1);
+    }
+
+    // the file is removed when it is closed
+    unlink( filename.c_str() );
+
+    store.offsets.assign( numGenomes, 0 );
+    store.lengths.assign( numGenomes, 0 );
+    store.scales.assign( numGenomes, 1 );
+
+    std::atomic<size_t> next(0);
+    std::atomic<uint64_t> end(0);
+    std::vector<std::thread> threads;
+
+    for ( size_t i = 0; i < std::min( program_arguments.threadNumber, numGenomes ); i++ ) {
+        threads.emplace_back( spill_genomes, std::ref(thread_arguments), std::ref(program_arguments), std::ref(store), std::ref(next), std::ref(end) );
+    }
+
+    for ( std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++ ) {
+        it->join();
+    }
+
+    // a sketch can only be reduced further, see sketch_genomes()
+    store.scale = std::max( program_arguments.scale, (size_t)1 );
+
+    for ( std::vector<size_t>::const_iterator it = store.scales.begin(); it != store.scales.end(); it++ ) {
+        store.scale = std::max( store.scale, *it );
+    }
+
+    for ( std::vector<struct targs>::iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+        it->scale = store.scale;
+    }
+
+    if ( store.scale > 1 ) {
+        if ( store.scale != program_arguments.scale ) {
+            log(WARN, "Sketches are compared at scale %zu, the largest scale of the inputs.", store.scale);
+        }
+        log(INFO, "Sketch scale: %zu", store.scale);
+    }
+
+    log(INFO, "Stored signatures of %zu genomes, %.2f GB, in %s", numGenomes, end.load() / 1e9, filename.c_str());
+};
+
+
+void make_blocks( const struct signature_store& store, const struct pargs& program_arguments, std::vector<struct block>& blocks ) {
+
+    const size_t limit = program_arguments.memoryBudget / 2;
+    size_t bytes = 0;
+
+    for ( size_t i = 0; i < store.lengths.size(); i++ ) {
+        const size_t genome = store.lengths[i] * CORE_BYTES;
+
+        if ( blocks.empty() || ( bytes + genome > limit && bytes > 0 ) ) {
+            struct block b = { i, i };
+            blocks.push_back( b );
+            bytes = 0;
+        }
+
+        blocks.back().end = i + 1;
+        bytes += genome;
+    }
+};
+
+
+static void load_genomes( std::vector<struct targs>& thread_arguments, const struct signature_store& store, const struct block& range, std::atomic<size_t>& next ) {
+
+    size_t index;
+
+    while ( ( index = range.begin + next.fetch_add(1) ) < range.end ) {
+        struct targs& genome = thread_arguments[index];
+        const size_t length = store.lengths[index];
+
+        genome.cores.resize( length );
+        genome.counts.resize( length );
+
+        if ( !read_fully( store.fd, genome.cores.data(), length * sizeof(uint32_t), store.offsets[index] ) ||
+             !read_fully( store.fd, genome.counts.data(), length * sizeof(size_t), store.offsets[index] + length * sizeof(uint32_t) ) ) {
+            log(ERROR, "Failed to read the signature of %s", genome.inFileName.c_str());
+            exit(1);
+        }
+
+        if ( store.scales[index] != store.scale ) {
+            sketchCores( genome.cores, genome.counts, sketchThreshold( store.scale ) );
+        }
+    }
+};
+
+
+void load_block( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const struct signature_store& store, const struct block& range ) {
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+
+    for ( size_t i = 0; i < std::min( program_arguments.threadNumber, range.end - range.begin ); i++ ) {
+        threads.emplace_back( load_genomes, std::ref(thread_arguments), std::cref(store), std::cref(range), std::ref(next) );
+    }
+
+    for ( std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++ ) {
+        it->join();
+    }
+};
+
+
+void release_block( std::vector<struct targs>& thread_arguments, const struct block& range ) {
+    for ( size_t i = range.begin; i < range.end; i++ ) {
+        std::vector<uint32_t>().swap( thread_arguments[i].cores );
+        std::vector<size_t>().swap( thread_arguments[i].counts );
+    }
+};
+
+
+void block_checksums( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const struct signature_store& store, std::vector<uint64_t>& checksums ) {
+
+    std::vector<struct block> blocks;
+    make_blocks( store, program_arguments, blocks );
+
+    checksums.assign( thread_arguments.size(), 0 );
+    std::vector<uint64_t> block_sums;
+
+    for ( std::vector<struct block>::const_iterator it = blocks.begin(); it != blocks.end(); it++ ) {
+        load_block( thread_arguments, program_arguments, store, *it );
+        signature_checksums( thread_arguments, program_arguments, block_sums );
+        std::copy( block_sums.begin() + it->begin, block_sums.begin() + it->end, checksums.begin() + it->begin );
+        release_block( thread_arguments, *it );
+    }
+};
+
+
+// loads a block and the per-genome terms of its comparisons
+static void load_terms( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const struct signature_store& store, const struct block& range, std::vector<double>& sizes, std::vector<size_t>& totals ) {
+
+    load_block( thread_arguments, program_arguments, store, range );
+
+    for ( size_t i = range.begin; i < range.end; i++ ) {
+        sizes[i] = calculateTotalSize( thread_arguments[i], program_arguments );
+        totals[i] = calculateCountTotal( thread_arguments[i] );
+    }
+};
+
+
+void compute_blocks( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const struct signature_store& store, TriangularMatrix& matrix, const std::vector<bool>& known ) {
+
+    const size_t numGenomes = thread_arguments.size();
+
+    std::vector<struct block> blocks;
+    make_blocks( store, program_arguments, blocks );
+
+    log(INFO, "Comparing %zu genomes in %zu blocks", numGenomes, blocks.size());
+
+    // the per-genome terms of the comparisons, set when a block is loaded
+    std::vector<double> sizes( numGenomes, 0 );
+    std::vector<size_t> totals( numGenomes, 0 );
+    size_t elements = 0, pairs = 0, loads = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for ( size_t a = 0; a < blocks.size(); a++ ) {
+        bool resident = false;
+
+        for ( size_t b = a; b < blocks.size(); b++ ) {
+            // pairs of blocks without pairs to be computed are not loaded
+            std::vector<struct tile> tiles;
+            struct tile area = { blocks[a].begin, blocks[a].end, blocks[b].begin, blocks[b].end, 0, 0 };
+            make_tiles( thread_arguments, program_arguments, known, area, tiles );
+
+            if ( tiles.empty() ) {
+                continue;
+            }
+
+            // the block of the rows is loaded once, the blocks of the columns one after another
+            if ( !resident ) {
+                load_terms( thread_arguments, program_arguments, store, blocks[a], sizes, totals );
+                resident = true;
+                loads++;
+            }
+            if ( b != a ) {
+                load_terms( thread_arguments, program_arguments, store, blocks[b], sizes, totals );
+                loads++;
+            }
+
+            // the tiles are sorted by the sizes of the loaded cores
+            tiles.clear();
+            make_tiles( thread_arguments, program_arguments, known, area, tiles );
+
+            for ( std::vector<struct tile>::const_iterator it = tiles.begin(); it != tiles.end(); it++ ) {
+                elements += it->cost;
+                pairs += it->pairs;
+            }
+
+            std::atomic<size_t> next(0);
+            std::vector<std::thread> threads;
+
+            for ( size_t i = 0; i < std::min( tiles.size(), program_arguments.threadNumber ); i++ ) {
+                threads.emplace_back( compute_tiles, std::cref(tiles), std::ref(next), std::cref(thread_arguments), std::cref(sizes), std::cref(totals), std::cref(program_arguments), std::cref(known), std::ref(matrix) );
+            }
+
+            for ( std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++ ) {
+                it->join();
+            }
+
+            if ( b != a ) {
+                release_block( thread_arguments, blocks[b] );
+            }
+        }
+
+        if ( resident ) {
+            release_block( thread_arguments, blocks[a] );
+        }
+    }
+
+    if ( program_arguments.verbose && pairs > 0 ) {
+        double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+        log(INFO, "Compared %zu pairs in %.2f seconds (%.0f elements/s, %zu threads, %zu block loads)", pairs, seconds, elements / seconds, program_arguments.threadNumber, loads);
+    }
+};
+
+
+void close_store( struct signature_store& store ) {
+    if ( store.fd >= 0 ) {
+        close( store.fd );
+        store.fd = -1;
+    }
+};
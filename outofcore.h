@@ -0,0 +1,128 @@
+#ifndef OUTOFCORE_H
+#define OUTOFCORE_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include "args.h"
+#include "logging.h"
+#include "helper.h"
+#include "fileio.h"
+#include "matrix.h"
+#include "state.h"
+#include "utils/TriangularMatrix.hpp"
+
+
+struct signature_store {
+    int fd;                         // unlinked file holding the signatures
+    std::vector<uint64_t> offsets;  // first byte of the signature of every genome
+    std::vector<uint64_t> lengths;  // number of cores of every genome in the file
+    std::vector<size_t> scales;     // scale of every signature in the file
+    size_t scale;                   // common scale of the comparison
+};
+
+struct block {
+    size_t begin;           // first genome of the block
+    size_t end;             // genome after the last genome of the block
+};
+
+
+/**
+ * @brief Reads the core and sketch files of all genomes into a signature store on disk.
+ *
+ * Out-of-core counterpart of `read_cores()` and `sketch_genomes()`, used when a memory budget is set
+ * with `--memory`. The genomes are read by `threadNumber` threads with `read_from_file()`, and the
+ * cores and counts of a genome are appended to `<prefix>.signatures` and released right away, so
+ * that only one genome per thread is resident. The file is unlinked as soon as it is created and
+ * disappears when the program exits. The common scale is chosen as in `sketch_genomes()`; the
+ * signatures are reduced to it when they are loaded by `load_block()`.
+ *
+ * @param thread_arguments A reference to the vector of `targs` structures, one per genome. Their
+ *        sizes and scales are set, their cores are left empty.
+ * @param program_arguments A reference to the `pargs` structure.
+ * @param store An output structure describing the signatures in the file.
+ */
+void spill_signatures( std::vector<struct targs>& thread_arguments, struct pargs& program_arguments, struct signature_store& store );
+
+/**
+ * @brief Partitions the genomes into consecutive blocks whose signatures fit into half of the budget.
+ *
+ * Two blocks are resident at a time. A genome larger than half of the budget forms a block of its own.
+ *
+ * @param store A constant reference to the signature store.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param blocks An output vector that will contain the blocks.
+ */
+void make_blocks( const struct signature_store& store, const struct pargs& program_arguments, std::vector<struct block>& blocks );
+
+/**
+ * @brief Loads the signatures of a block of genomes from the store.
+ *
+ * The genomes are read by `threadNumber` threads with `pread()` and reduced to the common scale.
+ *
+ * @param thread_arguments A reference to the vector of `targs` structures, the cores and counts of
+ *        the genomes of the block are set.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param store A constant reference to the signature store.
+ * @param range The block to be loaded.
+ */
+void load_block( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const struct signature_store& store, const struct block& range );
+
+/**
+ * @brief Releases the memory of the signatures of a block of genomes.
+ *
+ * @param thread_arguments A reference to the vector of `targs` structures.
+ * @param range The block to be released.
+ */
+void release_block( std::vector<struct targs>& thread_arguments, const struct block& range );
+
+/**
+ * @brief Computes the signature checksums of all genomes block by block.
+ *
+ * Out-of-core counterpart of `signature_checksums()`.
+ *
+ * @param thread_arguments A reference to the vector of `targs` structures, one per genome.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param store A constant reference to the signature store.
+ * @param checksums An output vector that will contain the checksum of every genome.
+ */
+void block_checksums( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const struct signature_store& store, std::vector<uint64_t>& checksums );
+
+/**
+ * @brief Computes the similarity matrices of all pairs of genomes within a memory budget.
+ *
+ * Out-of-core counterpart of `compute_matrices()`. The genomes are partitioned into blocks by
+ * `make_blocks()`, and the pairs of blocks are visited row by row: a block stays resident while the
+ * blocks after it are loaded one by one, so two blocks are in memory at a time and the store is
+ * read about b / 2 times for b blocks. The pairs of the loaded blocks are partitioned by
+ * `make_tiles()` and computed by `threadNumber` threads running `compute_tiles()`, so the matrices
+ * are identical to those of `compute_matrices()`. Pairs of blocks without pairs to be computed,
+ * i.e. of known genomes or outside the shard, are skipped without being loaded. The cells are
+ * written into a matrix mapped onto disk, so the panel size is limited by disk space rather than
+ * memory. The budget only bounds the signatures: the pages of the mapped matrix are left to the
+ * kernel, and the buffers of `write_matrices()` come on top of it.
+ *
+ * @param thread_arguments A reference to the vector of `targs` structures, one per genome.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param store A constant reference to the signature store.
+ * @param matrix A reference to the matrix of similarities, of size n.
+ * @param known A constant reference to a vector of n flags, set for the genomes whose pairs with each
+ *        other are already in the matrix.
+ */
+void compute_blocks( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const struct signature_store& store, TriangularMatrix& matrix, const std::vector<bool>& known );
+
+/**
+ * @brief Closes the file of a signature store.
+ *
+ * @param store The signature store.
+ */
+void close_store( struct signature_store& store );
+
+#endif
@@ -0,0 +1,260 @@
+#include "postings.h"
+
+
+// bytes of a block per posting at most: its genome and count, and a label and offset if it is the only one
+static const size_t POSTING_BYTES = sizeof(uint32_t) + sizeof(size_t) + sizeof(uint32_t) + sizeof(size_t);
+
+
+void make_label_blocks( const std::vector<struct targs>& thread_arguments, std::vector<uint64_t>& bounds ) {
+
+    size_t total = 0;
+    std::vector<uint32_t> sample;
+
+    for ( std::vector<struct targs>::const_iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+        total += it->cores.size();
+
+        for ( size_t k = POSTINGS_SAMPLE / 2; k < it->cores.size(); k += POSTINGS_SAMPLE ) {
+            sample.push_back( it->cores[k] );
+        }
+    }
+
+    std::sort( sample.begin(), sample.end() );
+
+    const size_t blocks = std::max( ( total * POSTING_BYTES + POSTINGS_BLOCK_SIZE - 1 ) / POSTINGS_BLOCK_SIZE, (size_t)1 );
+
+    bounds.assign( 1, 0 );
+
+    for ( size_t k = 1; k < blocks && !sample.empty(); k++ ) {
+        const uint64_t bound = sample[ k * sample.size() / blocks ];
+
+        if ( bound > bounds.back() ) {
+            bounds.push_back( bound );
+        }
+    }
+
+    bounds.push_back( (uint64_t)1 << 32 );
+};
+
+
+// visits the postings of the block genome by genome, with the index of their label; the cores of a
+// genome are ascending, so every label is searched from the previous one
+template <typename Visit>
+static void for_postings( const std::vector<struct targs>& thread_arguments, const std::vector<size_t>& begins, const std::vector<size_t>& ends, const std::vector<uint32_t>& labels, Visit visit ) {
+
+    for ( size_t g = 0; g < thread_arguments.size(); g++ ) {
+        std::vector<uint32_t>::const_iterator label = labels.begin();
+
+        for ( size_t k = begins[g]; k < ends[g]; k++ ) {
+            label = std::lower_bound( label, labels.end(), thread_arguments[g].cores[k] );
+            visit( label - labels.begin(), g, k );
+        }
+    }
+};
+
+
+void build_postings( const std::vector<struct targs>& thread_arguments, const std::vector<size_t>& begins, const std::vector<size_t>& ends, struct postings& block ) {
+
+    const size_t numGenomes = thread_arguments.size();
+    size_t total = 0;
+
+    // the previous block is released first, so that two blocks are never held at once
+    block = postings();
+
+    for ( size_t g = 0; g < numGenomes; g++ ) {
+        total += ends[g] - begins[g];
+    }
+
+    // the distinct labels of the block
+    block.labels.reserve( total );
+
+    for ( size_t g = 0; g < numGenomes; g++ ) {
+        block.labels.insert( block.labels.end(), thread_arguments[g].cores.begin() + begins[g], thread_arguments[g].cores.begin() + ends[g] );
+    }
+
+    std::sort( block.labels.begin(), block.labels.end() );
+    block.labels.erase( std::unique( block.labels.begin(), block.labels.end() ), block.labels.end() );
+    block.labels.shrink_to_fit();
+
+    // the postings of every label are counted, then placed in genome order, so the genomes are ascending
+    block.offsets.assign( block.labels.size() + 1, 0 );
+
+    for_postings( thread_arguments, begins, ends, block.labels, [&]( size_t label, size_t, size_t ) {
+        block.offsets[label + 1]++;
+    });
+
+    for ( size_t k = 1; k < block.offsets.size(); k++ ) {
+        block.offsets[k] += block.offsets[k - 1];
+    }
+
+    block.genomes.resize( total );
+    block.counts.resize( total );
+
+    // the offset of a label is moved to its next posting, and back to its first one afterwards
+    for_postings( thread_arguments, begins, ends, block.labels, [&]( size_t label, size_t g, size_t k ) {
+        const size_t p = block.offsets[label]++;
+        block.genomes[p] = (uint32_t)g;
+        block.counts[p] = thread_arguments[g].counts[k];
+    });
+
+    for ( size_t k = block.offsets.size() - 1; k > 0; k-- ) {
+        block.offsets[k] = block.offsets[k - 1];
+    }
+    block.offsets[0] = 0;
+};
+
+
+// runs the work of every row on the threads, rows are taken in order as the first ones are the longest
+static void for_rows( size_t numGenomes, size_t threadNumber, const std::function<void(size_t)>& work ) {
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+
+    for ( size_t t = 0; t < std::min( numGenomes, threadNumber ); t++ ) {
+        threads.emplace_back( [&]() {
+            size_t row;
+            while ( ( row = next++ ) < numGenomes ) {
+                work( row );
+            }
+        });
+    }
+
+    for ( std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++ ) {
+        it->join();
+    }
+};
+
+
+// adds the postings of the later genomes sharing a core of the genome to its row
+template <data_type TYPE>
+static size_t accumulate_row( size_t a, const std::vector<struct targs>& thread_arguments, const struct postings& block, size_t begin, size_t end, const struct pargs& program_arguments, const std::vector<bool>& known, TriangularMatrix& matrix ) {
+
+    size_t matches1[INTERSECTION_BUFFER_SIZE], matches2[INTERSECTION_BUFFER_SIZE];
+    struct intersection_cursor cursor = { 0, 0, false };
+
+    const struct targs& argument1 = thread_arguments[a];
+    const size_t numGenomes = thread_arguments.size();
+    const size_t size1 = end - begin, size2 = block.labels.size();
+    const double depth1 = 1;
+
+    const uint32_t* genomes = block.genomes.data();
+    size_t visited = 0;
+
+    while ( cursor.position1 < size1 && cursor.position2 < size2 ) {
+        size_t count = intersectSorted( argument1.cores.data() + begin, size1, block.labels.data(), size2, cursor, matches1, matches2, INTERSECTION_BUFFER_SIZE );
+
+        for ( size_t k = 0; k < count; k++ ) {
+            const size_t count1 = argument1.counts[begin + matches1[k]];
+            const size_t last = block.offsets[matches2[k] + 1];
+
+            for ( size_t p = std::upper_bound( genomes + block.offsets[matches2[k]], genomes + last, (uint32_t)a ) - genomes; p < last; p++ ) {
+                const size_t b = genomes[p];
+
+                if ( ( known[a] && known[b] ) || !in_shard( a, b, numGenomes, program_arguments ) ) {
+                    continue;
+                }
+
+                const size_t count2 = block.counts[p];
+                const double depth2 = static_cast<double>(thread_arguments[b].size) / static_cast<double>(argument1.size);
+
+                struct similarity& cell = matrix.at( a, b );
+                cell.jaccard += TYPE == SET ? 1 : std::min(count1, count2);
+                cell.dice += 2 * std::min(count1 * depth2, count2 * depth1);
+                visited++;
+            }
+        }
+    }
+
+    return visited;
+};
+
+
+void compute_postings( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, TriangularMatrix& matrix, const std::vector<bool>& known ) {
+
+    const size_t numGenomes = thread_arguments.size();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // the per-genome terms of the comparisons
+    std::vector<double> sizes;
+    std::vector<size_t> totals;
+    sizes.reserve( numGenomes );
+    totals.reserve( numGenomes );
+
+    for ( std::vector<struct targs>::const_iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+        sizes.push_back( calculateTotalSize( *it, program_arguments ) );
+        totals.push_back( calculateCountTotal( *it ) );
+    }
+
+    std::vector<uint64_t> bounds;
+    make_label_blocks( thread_arguments, bounds );
+
+    // until the last block, a cell holds the intersection size and the shared weight of the pair
+    for_rows( numGenomes, program_arguments.threadNumber, [&]( size_t a ) {
+        for ( size_t b = a + 1; b < numGenomes; b++ ) {
+            if ( ( !known[a] || !known[b] ) && in_shard( a, b, numGenomes, program_arguments ) ) {
+                struct similarity& cell = matrix.at( a, b );
+                cell.jaccard = 0;
+                cell.dice = 0;
+                cell.distance = 0;
+            }
+        }
+    });
+
+    std::vector<size_t> begins( numGenomes, 0 ), ends( numGenomes, 0 );
+    std::atomic<size_t> visited(0), pairs(0);
+    struct postings block;
+
+    for ( size_t k = 0; k + 1 < bounds.size(); k++ ) {
+        for ( size_t g = 0; g < numGenomes; g++ ) {
+            const std::vector<uint32_t>& cores = thread_arguments[g].cores;
+            begins[g] = ends[g];
+            ends[g] = std::lower_bound( cores.begin() + begins[g], cores.end(), bounds[k + 1] ) - cores.begin();
+        }
+
+        build_postings( thread_arguments, begins, ends, block );
+
+        for_rows( numGenomes, program_arguments.threadNumber, [&]( size_t a ) {
+            if ( begins[a] < ends[a] ) {
+                if ( program_arguments.type == SET ) {
+                    visited += accumulate_row<SET>( a, thread_arguments, block, begins[a], ends[a], program_arguments, known, matrix );
+                } else {
+                    visited += accumulate_row<VECTOR>( a, thread_arguments, block, begins[a], ends[a], program_arguments, known, matrix );
+                }
+            }
+        });
+    }
+
+    block = postings();
+
+    // the similarities are derived from the sums as by compareCores()
+    for_rows( numGenomes, program_arguments.threadNumber, [&]( size_t a ) {
+        size_t count = 0;
+
+        for ( size_t b = a + 1; b < numGenomes; b++ ) {
+            if ( ( known[a] && known[b] ) || !in_shard( a, b, numGenomes, program_arguments ) ) {
+                continue;
+            }
+
+            const double depth1 = 1, depth2 = static_cast<double>(thread_arguments[b].size) / static_cast<double>(thread_arguments[a].size);
+
+            struct similarity& cell = matrix.at( a, b );
+            struct comparison result;
+            result.interSize = static_cast<size_t>( cell.jaccard );
+            result.unionSize = ( program_arguments.type == SET ? thread_arguments[a].cores.size() + thread_arguments[b].cores.size() : totals[a] + totals[b] ) - result.interSize;
+            result.denominator = totals[a] * depth2 + totals[b] * depth1;
+            result.numerator = result.denominator - cell.dice;
+
+            cell.jaccard = calculateJaccardSimilarity( result.interSize, result.unionSize );
+            cell.dice = calculateDiceSimilarity( result.interSize, sizes[a], sizes[b] );
+            cell.distance = calculateNormalizedVectorSimilarity( result.numerator, result.denominator );
+            count++;
+        }
+
+        pairs += count;
+    });
+
+    if ( program_arguments.verbose && pairs > 0 ) {
+        double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+        log(INFO, "Compared %zu pairs over %zu blocks of postings in %.2f seconds (%zu shared cores visited, %zu threads)", pairs.load(), bounds.size() - 1, seconds, visited.load(), program_arguments.threadNumber);
+    }
+};
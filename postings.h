@@ -0,0 +1,89 @@
+#ifndef POSTINGS_H
+#define POSTINGS_H
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include "args.h"
+#include "logging.h"
+#include "similarity_metrics.h"
+#include "matrix.h"
+#include "utils/TriangularMatrix.hpp"
+
+// bytes of a block of postings at most, the label space is split into blocks of about this size
+#ifndef POSTINGS_BLOCK_SIZE
+#define POSTINGS_BLOCK_SIZE 268435456
+#endif
+
+// every POSTINGS_SAMPLE-th core of a genome is sampled to place the bounds of the blocks
+#ifndef POSTINGS_SAMPLE
+#define POSTINGS_SAMPLE 64
+#endif
+
+
+struct postings {
+    std::vector<uint32_t> labels;   // distinct core labels of the block, ascending
+    std::vector<size_t> offsets;    // first posting of every label, followed by the number of postings
+    std::vector<uint32_t> genomes;  // genomes containing the labels, ascending per label
+    std::vector<size_t> counts;     // counts of the labels in the genomes
+};
+
+
+/**
+ * @brief Splits the space of core labels into blocks of at most about `POSTINGS_BLOCK_SIZE` bytes.
+ *
+ * The bounds are quantiles of a sample of the cores of all genomes, so that the blocks have about the
+ * same number of postings. A block is sized by the peak of `build_postings()`, 24 bytes per posting
+ * when every label has a single posting, and less when the labels are shared. A single label is
+ * never split, so a block may be larger than the limit.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param bounds An output vector of b + 1 ascending bounds; the block k holds the labels from
+ *        `bounds[k]` up to, but not including, `bounds[k + 1]`.
+ */
+void make_label_blocks( const std::vector<struct targs>& thread_arguments, std::vector<uint64_t>& bounds );
+
+/**
+ * @brief Builds the postings of a block of core labels.
+ *
+ * The postings are built in place: the distinct labels are gathered first, the postings of every
+ * label are counted, and the genomes and counts are then placed in genome order, so they are ascending
+ * per label without sorting the postings. The previous content of the block is released first.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param begins A constant reference to the first core of every genome in the block.
+ * @param ends A constant reference to the core after the last core of every genome in the block.
+ * @param block An output structure that will contain the postings of the block.
+ */
+void build_postings( const std::vector<struct targs>& thread_arguments, const std::vector<size_t>& begins, const std::vector<size_t>& ends, struct postings& block );
+
+/**
+ * @brief Computes the similarity matrices of all pairs of genomes from an inverted index of their cores.
+ *
+ * Counterpart of `compute_matrices()` for large collections of sparsely related genomes, set with
+ * `--postings`. Instead of merging the core sets of every pair, the cores are inverted into postings,
+ * lists of the genomes and counts of every label, built for one block of labels at a time by
+ * `make_label_blocks()` and `build_postings()`. Every row of the matrix is owned by one of
+ * `threadNumber` threads, which walks the postings of the cores of its genome and adds every
+ * posting of a later genome to the cell of the pair, so the work is proportional to the number of
+ * shared cores of the pairs rather than to the sizes of all pairs. Pairs without a shared core are
+ * never visited until their cells are completed from the per-genome totals.
+ *
+ * The cells hold the intersection size and the shared weight of the normalized vector similarity
+ * until all blocks are visited. The labels are visited in ascending order, as by `compareCores()`,
+ * so the sums and the matrices are bit-identical to those of `compute_matrices()`. Pairs of known
+ * genomes and pairs outside the shard are skipped, as by `compute_tiles()`.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param matrix A reference to the matrix of similarities, of size n.
+ * @param known A constant reference to a vector of n flags, set for the genomes whose pairs with each
+ *        other are already in the matrix.
+ */
+void compute_postings( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, TriangularMatrix& matrix, const std::vector<bool>& known );
+
+#endif
@@ -1,6 +1,13 @@
 #ifndef PROGRAM_MODE_H
 #define PROGRAM_MODE_H
 
+enum program_command {
+    COMPARE,
+    INDEX,
+    QUERY,
+    MERGE
+};
+
 enum program_mode {
     FA,
     FQ,
@@ -12,4 +19,12 @@ enum data_type {
     VECTOR
 };
 
+enum output_format {
+    PHY,
+    LOWER,
+    BIN,
+    BIN32,
+    NPY
+};
+
 #endif
\ No newline at end of file
@@ -1,15 +1,408 @@
 #include "rbam.h"
 
 
-void read_bam( struct targs& arguments, const struct pargs& program_arguments ) {
+// maps a byte of the 4-bit encoding to its two bases
+struct nt16_pairs {
+    char pairs[512];
+
+    nt16_pairs() {
+        for ( int i = 0; i < 256; i++ ) {
+            pairs[2 * i] = seq_nt16_str[i >> 4];
+            pairs[2 * i + 1] = seq_nt16_str[i & 15];
+        }
+    }
+};
+
+
+/**
+ * @brief Checks if an alignment record should be processed, before its sequence is decoded.
+ *
+ * @param aln The alignment record.
+ * @param program_arguments The `pargs` structure containing the flags to skip and to require.
+ * @return True if the record has none of the skip flags, all of the required flags, and a sequence.
+ */
+bool keep_record( const bam1_t* aln, const struct pargs& program_arguments ) {
+    return ( aln->core.flag & program_arguments.skipFlags ) == 0 && 
+           ( aln->core.flag & program_arguments.requiredFlags ) == program_arguments.requiredFlags && 
+           aln->core.l_qseq > 0;
+};
+
+
+/**
+ * @brief Appends the sequence of an alignment record to a buffer of bases.
+ *
+ * The 4-bit encoded sequence of the record is decoded two bases at a time with a lookup table, 
+ * straight into the buffer, without an intermediate string.
+ *
+ * @param aln The alignment record.
+ * @param bases The buffer the decoded bases are appended to.
+ */
+void decode_sequence( const bam1_t* aln, std::string& bases ) {
+    static const nt16_pairs table;
+
+    const uint8_t* seq = bam_get_seq(aln);
+    const size_t length = aln->core.l_qseq;
+    const size_t offset = bases.size();
+
+    bases.resize( offset + length );
+    char* out = &bases[offset];
+
+    for ( size_t i = 0; i + 1 < length; i += 2 ) {
+        memcpy( out + i, table.pairs + 2 * seq[i >> 1], 2 );
+    }
+
+    if ( length & 1 ) {
+        out[length - 1] = seq_nt16_str[bam_seqi(seq, length - 1)];
+    }
+};
+
+
+/**
+ * @brief Appends the sequence of an alignment record to the current batch.
+ *
+ * The full batch is handed over to the workers of the pool, and replaced with an empty one.
+ *
+ * @param aln The alignment record.
+ * @param task The batch being filled.
+ * @param sample The index of the sample in the pool.
+ * @param pool The pool of workers shared by all samples.
+ * @param length The total length of the reads, incremented by the call.
+ * @param stats The statistics of the reader, whose number of reads is incremented.
+ */
+void add_record( const bam1_t* aln, Task& task, size_t sample, struct read_pool& pool, size_t& length, struct sample_stats& stats ) {
+
+    decode_sequence( aln, task.bases );
+    task.ends.push_back( task.bases.size() );
+    length += aln->core.l_qseq;
+    stats.reads++;
+
+    // hand over full batch and take an empty one, blocks while all batches are in use
+    if ( task.ends.size() == READ_BATCH_SIZE ) {
+        hand_over( task, sample, pool );
+    }
+};
+
+
+/**
+ * @brief Loads the target regions of a BED file.
+ *
+ * Header, comment and empty lines are skipped. Regions on contigs that are not in the BAM header 
+ * are ignored with a warning. The regions are sorted, and overlapping or adjacent regions are 
+ * merged, so that the result is a set of disjoint regions.
+ *
+ * @param filename The name of the BED file.
+ * @param header The header of the BAM file, used to map contig names to their ids.
+ * @param regions An output vector that will contain the merged regions.
+ */
+void load_bed( const std::string& filename, bam_hdr_t* header, std::vector<struct region>& regions ) {
+
+    std::ifstream file( filename.c_str() );
+
+    if ( !file.is_open() ) {
+        log(ERROR, "Couldn't open %s", filename.c_str());
+        exit(1);
+    }
+
+    std::vector<struct region> targets;
+    std::set<std::string> unknown;
+    std::string line;
+
+    while ( std::getline(file, line) ) {
+
+        if ( line.empty() || line[0] == '#' || line.compare(0, 5, "track") == 0 || line.compare(0, 7, "browser") == 0 ) {
+            continue;
+        }
+
+        std::istringstream ss(line);
+        std::string name;
+        struct region target;
+
+        if ( !( ss >> name >> target.begin >> target.end ) || target.begin < 0 || target.end < target.begin ) {
+            log(ERROR, "Invalid line in %s: %s", filename.c_str(), line.c_str());
+            exit(1);
+        }
+
+        target.tid = sam_hdr_name2tid( header, name.c_str() );
+
+        if ( target.tid < 0 ) {
+            if ( unknown.insert(name).second ) {
+                log(WARN, "Contig %s of %s is not in the BAM header, its regions are ignored.", name.c_str(), filename.c_str());
+            }
+            continue;
+        }
+
+        if ( target.end > target.begin ) {
+            targets.push_back(target);
+        }
+    }
+
+    file.close();
+
+    std::sort( targets.begin(), targets.end(), []( const struct region& a, const struct region& b ) {
+        return a.tid < b.tid || ( a.tid == b.tid && a.begin < b.begin );
+    });
+
+    // merge overlapping and adjacent regions
+    for ( std::vector<struct region>::iterator it = targets.begin(); it != targets.end(); it++ ) {
+        if ( !regions.empty() && regions.back().tid == it->tid && it->begin <= regions.back().end ) {
+            regions.back().end = std::max( regions.back().end, it->end );
+        } else {
+            regions.push_back(*it);
+        }
+    }
+};
+
+
+/**
+ * @brief Splits the contigs, or the target regions, of a BAM file into shards.
+ *
+ * Without a BED file, every contig of the header is a region, and unplaced records are read by an 
+ * additional shard. Regions longer than `BAM_SHARD_LENGTH` are split. An iterator returns every 
+ * record overlapping its shard, so a record spanning several shards is only counted by the shard 
+ * it starts in, or, if it starts before a target region, by the first region it overlaps. This is 
+ * encoded in the claim position of each shard.
+ *
+ * @param header The header of the BAM file.
+ * @param bed_file The name of the BED file, or an empty string to process all contigs.
+ * @param shards An output vector that will contain the shards, in the order of the file.
+ */
+void make_shards( bam_hdr_t* header, const std::string& bed_file, std::vector<struct region>& shards ) {
+
+    std::vector<struct region> regions;
+
+    if ( !bed_file.empty() ) {
+        load_bed( bed_file, header, regions );
+    } else {
+        for ( int tid = 0; tid < sam_hdr_nref(header); tid++ ) {
+            struct region contig = { tid, 0, sam_hdr_tid2len(header, tid), 0 };
+            regions.push_back(contig);
+        }
+    }
+
+    for ( std::vector<struct region>::iterator it = regions.begin(); it != regions.end(); it++ ) {
+
+        // records starting between two regions belong to the next one they overlap
+        hts_pos_t claim = ( it != regions.begin() && (it - 1)->tid == it->tid ) ? (it - 1)->end : 0;
+
+        for ( hts_pos_t begin = it->begin; begin < it->end; begin += BAM_SHARD_LENGTH ) {
+            struct region shard = { it->tid, begin, std::min( begin + BAM_SHARD_LENGTH, it->end ), begin == it->begin ? claim : begin };
+            shards.push_back(shard);
+        }
+    }
+
+    if ( bed_file.empty() ) {
+        struct region unplaced = { HTS_IDX_NOCOOR, 0, 0, 0 };
+        shards.push_back(unplaced);
+    }
+};
+
+
+/**
+ * @brief Reads shards of a BAM file through its index and feeds their reads to the worker pool.
+ *
+ * This function runs in one of the region threads of `read_bam()`. It opens its own handle on the 
+ * file and takes the next shard until none is left. Each shard is read with its own iterator, and 
+ * only the records claimed by the shard are added, see `make_shards()`.
+ *
+ * @param arguments A reference to the `targs` structure of the sample, whose total length of the 
+ *        reads is incremented under the mutex of the pool.
+ * @param sample The index of the sample in the pool.
+ * @param pool The pool of workers shared by all samples.
+ * @param shards The shards of the file.
+ * @param next The index of the next shard to be read, shared by the region threads.
+ * @param program_arguments The `pargs` structure containing the reference and the record filters.
+ */
+void read_shards( struct targs& arguments, size_t sample, struct read_pool& pool, const std::vector<struct region>& shards, std::atomic<size_t>& next, const struct pargs& program_arguments ) {
+
+    chtslib* c = NULL;
+
+    // exceptions cannot leave the thread, so a file that cannot be reopened ends the program here
+    try {
+        c = new chtslib( arguments.inFileName.c_str(), program_arguments.referenceFile.empty() ? NULL : program_arguments.referenceFile.c_str(), true );
+    } catch ( const std::runtime_error& e ) {
+        log(ERROR, "%s: %s", arguments.inFileName.c_str(), e.what());
+        exit(1);
+    }
+
+    bam1_t* aln = bam_init1();
+    struct sample_stats stats = { 0, 0, 0, 0 };
+    size_t length = 0;
+    size_t index;
+
+    Task task;
+    pool.free_queue.pop(task);
+    task.sample = sample;
+
+    while ( ( index = next++ ) < shards.size() ) {
+        const struct region& shard = shards[index];
+
+        // unplaced records are all unmapped
+        if ( shard.tid < 0 && ( program_arguments.skipFlags & BAM_FUNMAP ) ) {
+            continue;
+        }
+
+        hts_itr_t* iter = c->create_iter( shard.tid, shard.begin, shard.end );
+
+        if ( iter == NULL ) {
+            log(ERROR, "Could not be able to query a region of %s", arguments.inFileName.c_str());
+            exit(1);
+        }
+
+        int result;
+
+        while ( true ) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            result = c->read(iter, aln);
+            std::chrono::steady_clock::time_point decode_start = std::chrono::steady_clock::now();
+            stats.inflate += std::chrono::duration<double>( decode_start - start ).count();
+
+            if ( result < 0 ) {
+                break;
+            }
+
+            if ( !keep_record( aln, program_arguments ) ) {
+                continue;
+            }
+
+            // records of placed shards are counted by the shard they are claimed by
+            if ( shard.tid >= 0 && ( aln->core.pos < shard.claim || aln->core.pos >= shard.end ) ) {
+                continue;
+            }
+
+            add_record( aln, task, sample, pool, length, stats );
+
+            stats.parse += std::chrono::duration<double>( std::chrono::steady_clock::now() - decode_start ).count();
+        }
+
+        destroy_iter(iter);
+
+        if ( result < -1 ) {
+            log(ERROR, "Could not be able to read a record of %s", arguments.inFileName.c_str());
+            exit(1);
+        }
+    }
+
+    release( task, pool );
+    bam_destroy1(aln);
+    delete c;
+
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    arguments.size += length;
+    pool.stats[sample].reads += stats.reads;
+    pool.stats[sample].inflate += stats.inflate;
+    pool.stats[sample].parse += stats.parse;
+};
+
+
+/**
+ * @brief Reads a BAM file and feeds its reads to the shared worker pool.
+ *
+ * The contigs of the file, or the target regions of the BED file given with `--bed`, are split 
+ * into shards by `make_shards()`, which are read through the index by the `read_threads` of the pool 
+ * running `read_shards()`, each with its own file handle, so that decompression and decoding scale 
+ * with the number of threads, and only the targeted part of the file is decompressed. Records 
+ * are filtered by their flags with `keep_record()` before their sequence is decoded, as set with 
+ * `-F`, `--mapped` and `--unmapped`. The sequence of every other record is decoded with `decode_sequence()` into batches of `READ_BATCH_SIZE` reads, which are 
+ * taken from the free batches of the pool and processed by its workers exactly like the reads of a 
+ * FASTQ file. Without an index, e.g. for standard input (`-`), the file is streamed sequentially, 
+ * with its blocks decompressed by an htslib thread pool of the other `read_threads`. CRAM files 
+ * are decoded against the reference given with `--ref`; only the flags, positions and sequences of 
+ * their records are decoded, so the names, qualities and auxiliary fields of the records are never 
+ * decoded. The function tracks the number and the total length of the reads.
+ *
+ * @param arguments A reference to the `targs` structure containing the input file name and 
+ *        receiving the total length of the reads.
+ * @param sample The index of the sample in the pool.
+ * @param pool The pool of workers shared by all samples.
+ * @param program_arguments The `pargs` structure containing the program settings.
+ */
+void read_bam( struct targs& arguments, size_t sample, struct read_pool& pool, const struct pargs& program_arguments ) {
     
-    chtslib c(arguments.inFileName.c_str());
+    chtslib* c = NULL;
+
+    try {
+        c = new chtslib(arguments.inFileName.c_str(), program_arguments.referenceFile.empty() ? NULL : program_arguments.referenceFile.c_str());
+    } catch ( const std::runtime_error& e ) {
+        log(ERROR, "%s", e.what());
+        exit(1);
+    }
+
+    program_arguments.verbose && std::cout << "Processing is started for " << arguments.inFileName << std::endl;
+
+    arguments.size = 0;
+
+    if ( c->bam_file_index != NULL ) {
+
+        std::vector<struct region> shards;
+        make_shards( c->bam_hdr, program_arguments.bedFile, shards );
+        delete c;
+
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> readers;
+
+        for ( size_t i = 0; i < std::min( shards.size(), pool.read_threads ); i++ ) {
+            readers.emplace_back( read_shards, std::ref(arguments), sample, std::ref(pool), std::cref(shards), std::ref(next), std::cref(program_arguments) );
+        }
+
+        for ( std::vector<std::thread>::iterator it = readers.begin(); it != readers.end(); it++ ) {
+            if ((*it).joinable()) {
+                (*it).join();
+            }
+        }
+
+        return;
+    }
+
+    if ( !program_arguments.bedFile.empty() ) {
+        log(ERROR, "Target regions require an index of %s", arguments.inFileName.c_str());
+        exit(1);
+    }
+
+    // the calling thread decodes the records, the other reading threads decompress blocks
+    if ( pool.read_threads > 1 ) {
+        c->set_threads( std::min( pool.read_threads - 1, (size_t)BAM_HTS_THREADS ) );
+    }
 
     bam1_t* aln = bam_init1();
+    struct sample_stats stats = { 0, 0, 0, 0 };
+    size_t length = 0;
+    int result;
+
+    Task task;
+    pool.free_queue.pop(task);
+    task.sample = sample;
+
+    while ( true ) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        result = c->read(aln);
+        std::chrono::steady_clock::time_point decode_start = std::chrono::steady_clock::now();
+        stats.inflate += std::chrono::duration<double>( decode_start - start ).count();
 
-    while( c.read(aln) > 0 ) {
-        printf("%s\n", bam_get_qname(aln));
+        if ( result < 0 ) {
+            break;
+        }
+
+        if ( !keep_record( aln, program_arguments ) ) {
+            continue;
+        }
+
+        add_record( aln, task, sample, pool, length, stats );
+
+        stats.parse += std::chrono::duration<double>( std::chrono::steady_clock::now() - decode_start ).count();
     }
 
+    if ( result < -1 ) {
+        log(ERROR, "Could not be able to read a record of %s", arguments.inFileName.c_str());
+        exit(1);
+    }
+
+    release( task, pool );
     bam_destroy1(aln);
-}
\ No newline at end of file
+    delete c;
+
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    arguments.size += length;
+    pool.stats[sample].reads += stats.reads;
+    pool.stats[sample].inflate += stats.inflate;
+    pool.stats[sample].parse += stats.parse;
+};
@@ -3,12 +3,50 @@
 
 #include <string>
 #include <vector>
+#include <set>
 #include <fstream>
+#include <sstream>
 #include <iostream>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
 #include "args.h"
 #include "lps.h"
 #include "chtslib.h"
+#include "rfastq.h"
 
-void read_bam( struct targs& arguments, const struct pargs& program_arguments );
+// most htslib threads decompressing a streamed BAM file, taken out of the threads set with -t
+#ifndef BAM_HTS_THREADS
+#define BAM_HTS_THREADS 4
+#endif
+
+// most threads reading the regions of an indexed BAM file, taken out of the threads set with -t
+#ifndef BAM_REGION_THREADS
+#define BAM_REGION_THREADS 4
+#endif
+
+#ifndef BAM_SHARD_LENGTH
+#define BAM_SHARD_LENGTH 10000000
+#endif
+
+
+struct region {
+    int tid;                // contig of the region, or HTS_IDX_NOCOOR for unplaced records
+    hts_pos_t begin;        // first position queried
+    hts_pos_t end;          // position after the last one queried
+    hts_pos_t claim;        // records starting in [claim, end) are counted by this region
+};
+
+
+bool keep_record( const bam1_t* aln, const struct pargs& program_arguments );
+void decode_sequence( const bam1_t* aln, std::string& bases );
+void add_record( const bam1_t* aln, Task& task, size_t sample, struct read_pool& pool, size_t& length, struct sample_stats& stats );
+void load_bed( const std::string& filename, bam_hdr_t* header, std::vector<struct region>& regions );
+void make_shards( bam_hdr_t* header, const std::string& bed_file, std::vector<struct region>& shards );
+void read_shards( struct targs& arguments, size_t sample, struct read_pool& pool, const std::vector<struct region>& shards, std::atomic<size_t>& next, const struct pargs& program_arguments );
+void read_bam( struct targs& arguments, size_t sample, struct read_pool& pool, const struct pargs& program_arguments );
 
 #endif
\ No newline at end of file
@@ -2,14 +2,27 @@
 
 
 void read_fastas( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments ) {
+
+    if ( program_arguments.splitChromosomes ) {
+        read_chromosomes( thread_arguments, program_arguments );
+        return;
+    }
     
     std::vector<std::thread> threads;
     std::vector<struct targs>::iterator current_argument = thread_arguments.begin();
 
     while (current_argument < thread_arguments.end()) {
 
-        while (threads.size() < program_arguments.threadNumber && current_argument < thread_arguments.end()) {
-            threads.emplace_back(read_fasta, std::ref(*current_argument), std::ref(program_arguments));
+        size_t used = 0;
+
+        while (used < program_arguments.threadNumber && current_argument < thread_arguments.end()) {
+
+            // decompression threads of a compressed genome are taken out of the thread budget
+            MmapFile file( current_argument->inFileName.c_str() );
+            const size_t inflaters = ( file && is_compressed( file ) ) ? inflate_threads( program_arguments.threadNumber - used - 1 ) : 0;
+
+            threads.emplace_back(read_fasta, std::ref(*current_argument), std::ref(program_arguments), inflaters);
+            used += 1 + inflaters;
             current_argument++;
         }
 
@@ -29,89 +42,830 @@ void read_fastas( std::vector<struct targs>& thread_arguments, const struct parg
 };
 
 
-void read_fasta( struct targs& thread_arguments, const struct pargs& program_arguments ) {
-    
+void read_chromosomes( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments ) {
+
+    struct schedule tasks( thread_arguments.size() );
+    std::vector<size_t> compressed;
+
+    // segmented chromosomes only produce labels, so they cannot be saved
+    size_t segment_length = program_arguments.segmentLength;
+
+    if ( segment_length != 0 && program_arguments.writeCores ) {
+        log(WARN, "Chromosomes are not segmented since cores are written to files.");
+        segment_length = 0;
+    }
+
+    // neighbouring windows of shorter segments end too close to each other for the margin check
+    if ( segment_length != 0 && segment_length < SEGMENT_MARGIN ) {
+        log(WARN, "Segment length is raised to the margin of %d bases.", SEGMENT_MARGIN);
+        segment_length = SEGMENT_MARGIN;
+    }
+
+    // locate chromosomes of all genomes
+    for ( size_t i = 0; i < thread_arguments.size(); i++ ) {
+
+        struct genome& gen = tasks.genomes[i];
+        gen.file = new MmapFile( thread_arguments[i].inFileName.c_str() );
+        thread_arguments[i].size = 0;
+
+        if ( !(*gen.file) ) {
+            log(ERROR, "Could not be able to open %s", thread_arguments[i].inFileName.c_str());
+            exit(1);
+        }
+
+        // compressed genomes are streamed once workers are started, the stream holds them open
+        if ( is_compressed( *gen.file ) ) {
+            delete gen.file;
+            gen.file = NULL;
+            gen.remaining = 1;
+            compressed.push_back(i);
+            continue;
+        }
+
+        const char* cursor = gen.file->data();
+        const char* end = gen.file->data() + gen.file->size();
+        struct chromosome chr;
+        chr.genome = i;
+        chr.index = 0;
+
+        while ( find_record( cursor, end, chr.id, chr.begin, chr.end ) ) {
+            
+            if ( chr.begin == chr.end ) {
+                continue;
+            }
+
+            size_t length = ( segment_length != 0 && (size_t)( chr.end - chr.begin ) > segment_length ) ? compacted_length( chr.begin, chr.end ) : 0;
+            
+            add_chromosome( tasks, chr, length, segment_length, tasks.segments );
+            chr.index++;
+        }
+
+        gen.strs.resize( chr.index, NULL );
+        gen.remaining = chr.index;
+
+        log(INFO, "Located %d chromosomes in %s", chr.index, thread_arguments[i].inFileName.c_str());
+
+        // genomes without sequences have nothing to wait for
+        if ( gen.remaining == 0 ) {
+            finalize_genome( gen, thread_arguments[i], program_arguments );
+        }
+    }
+
+    // schedule longest tasks first
+    std::stable_sort( tasks.segments.begin(), tasks.segments.end(), [](const struct segment& a, const struct segment& b) {
+        return a.cost > b.cost;
+    });
+
+    if ( compressed.empty() ) {
+        tasks.streamed.markFinished();
+    }
+
+    // decompression threads of the streamed genomes are taken out of the workers
+    const size_t inflaters = compressed.empty() ? 0 : inflate_threads( program_arguments.threadNumber / 2 );
+    const size_t workers = program_arguments.threadNumber - inflaters;
+
+    std::vector<std::thread> threads;
+
+    for ( size_t i = 0; i < workers && ( i < tasks.segments.size() || !compressed.empty() ); i++ ) {
+        threads.emplace_back(process_chromosomes, std::ref(tasks), std::ref(thread_arguments), std::ref(program_arguments));
+    }
+
+    // decompress compressed genomes while workers deepen chromosomes
+    for ( std::vector<size_t>::iterator it = compressed.begin(); it != compressed.end(); it++ ) {
+        stream_chromosomes( tasks, *it, segment_length, inflaters, thread_arguments, program_arguments );
+    }
+
+    if ( !compressed.empty() ) {
+        tasks.streamed.markFinished();
+    }
+
+    for ( std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++ ) {
+        it->join();
+    }
+};
+
+
+void process_chromosomes( struct schedule& tasks, std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments ) {
+
     // get thread id
     std::ostringstream ss;
     ss << std::this_thread::get_id();
 
-    // log initiation of reading fasta
-    log(INFO, "Thread ID: %s started processing %s", ss.str().c_str(), thread_arguments.inFileName.c_str());
+    std::string sequence;
+    std::vector<uint32_t> labels;
+    struct run result;
+    struct segment seg;
 
-    // open fasta file
-    std::fstream file;
-    file.open( thread_arguments.inFileName, std::ios::in );
+    while ( true ) {
 
-    std::vector<lcp::lps*> strs;
-    thread_arguments.size = 0;
+        // streamed chromosomes are in memory already, so they are processed first
+        if ( !tasks.streamed.tryPop(seg) ) {
+            size_t task = tasks.next++;
 
-    // read file
-    if ( file.is_open() ) {  
-        
-        
-        std::string sequence, id, line;
-        sequence.reserve(250000000);
-        
-        while (getline(file, line)) {
+            if ( task < tasks.segments.size() ) {
+                seg = tasks.segments[task];
+            } else if ( !tasks.streamed.pop(seg) ) {
+                break;
+            }
+        }
 
-            if (line[0] == '>') {
+        struct chromosome& chr = *seg.chromosome;
+        struct genome& gen = tasks.genomes[chr.genome];
 
-                // process previous chromosome before moving into new one
-                if (sequence.size() != 0) {
-                
-                    lcp::lps* str = new lcp::lps(sequence);
-                    str->deepen(program_arguments.lcpLevel);
-                    strs.push_back(str);
+        if ( program_arguments.verbose ) {
+            log(INFO, "Thread ID: %s, Processing started for %s of %s [%d, %d)", ss.str().c_str(), chr.id.c_str(), thread_arguments[chr.genome].inFileName.c_str(), seg.owned_begin, seg.owned_end);
+        }
 
-                    // increment processed sequence size
-                    thread_arguments.size += sequence.size();
+        lcp::lps* str = NULL;
+        size_t processed = 0;
+        uint64_t left = 0, right = 0;
 
-                    if ( program_arguments.verbose ) {
-                        log(INFO, "Thread ID: %s, Length of the processed sequence: %d", ss.str().c_str(), sequence.size());
-                    }
+        // streamed tasks come with their sequence, segments of mapped files only compact their window
+        if ( chr.begin == NULL ) {
+            sequence.swap( seg.sequence );
+            std::string().swap( seg.sequence );
+        } else if ( !chr.segmented ) {
+            compact_record( chr.begin, chr.end, sequence );
+        } else {
+            compact_window( seg.raw, chr.end, seg.end - seg.begin, sequence );
+        }
 
-                    // cleanup
-                    sequence.clear();
-                }
-                
-                // get new chromosome's id
-                id = line.substr(1);
-                
-                if ( program_arguments.verbose ) {
-                    log(INFO, "Thread ID: %s, Processing started for %s", ss.str().c_str(), id.c_str());
+        if ( !chr.segmented ) {
+            // whole chromosome
+            if ( sequence.size() != 0 ) {
+                str = new lcp::lps(sequence);
+                str->deepen(program_arguments.lcpLevel);
+            }
+
+            processed = sequence.size();
+
+            // reduce chromosome right away unless its cores are saved
+            if ( str != NULL && !program_arguments.writeCores ) {
+                for ( std::vector<lcp::core*>::iterator it = str->cores->begin(); it != str->cores->end(); it++ ) {
+                    labels.push_back( (*it)->label );
                 }
+                delete str;
+                str = NULL;
             }
-            else if (line[0] != '>'){
-                sequence += line;
+        } else {
+            // window of a segmented chromosome
+            lcp::lps* window = new lcp::lps(sequence);
+            window->deepen(program_arguments.lcpLevel);
+
+            // bands of half a margin after both boundaries, clipped at the end of the chromosome
+            const size_t left_end = std::min( seg.owned_begin + SEGMENT_MARGIN / 2, seg.owned_end );
+            const size_t right_end = std::min( seg.owned_end + SEGMENT_MARGIN / 2, seg.end );
+
+            // keep cores starting in the owned range, the others belong to neighbouring segments
+            for ( std::vector<lcp::core*>::iterator it = window->cores->begin(); it != window->cores->end(); it++ ) {
+                size_t start = seg.begin + (*it)->start;
+                if ( seg.owned_begin <= start && start < seg.owned_end ) {
+                    labels.push_back( (*it)->label );
+                }
+                if ( seg.owned_begin <= start && start < left_end ) {
+                    left = ( left ^ start ^ ( (uint64_t)(*it)->label << 32 ) ) * 0x100000001b3ULL;
+                } else if ( seg.owned_end <= start && start < right_end ) {
+                    right = ( right ^ start ^ ( (uint64_t)(*it)->label << 32 ) ) * 0x100000001b3ULL;
+                }
             }
+
+            delete window;
+
+            processed = seg.owned_end - seg.owned_begin;
         }
 
-        // process last chromosome set into sequence string
-        if ( sequence.size() != 0 ) {
-            lcp::lps* str = new lcp::lps(sequence);
-            str->deepen(program_arguments.lcpLevel);
-            strs.push_back(str);
+        if ( !labels.empty() ) {
+            makeRun( labels, result );
+        }
+
+        if ( program_arguments.verbose ) {
+            log(INFO, "Thread ID: %s, Length of the processed sequence: %d", ss.str().c_str(), processed);
+        }
+
+        bool last = false, warn = false;
+        {
+            std::lock_guard<std::mutex> lock(gen.mutex);
+            
+            if ( str != NULL ) {
+                gen.strs[chr.index] = str;
+            } else if ( !result.cores.empty() ) {
+                pushRun( gen.runs, result );
+            }
 
-            // increment processed sequence size
-            thread_arguments.size += sequence.size();
+            thread_arguments[chr.genome].size += processed;
 
-            if ( program_arguments.verbose ) {
-                log(INFO, "Thread ID: %s, Length of the processed sequence: %d", ss.str().c_str(), sequence.size());
+            // compare the cores around the boundaries with the neighbouring segments, warn once per chromosome
+            if ( chr.segmented ) {
+                bool matched = ( seg.owned_begin == 0 || match_band( chr, seg.owned_begin, left ) );
+                matched = ( seg.end == seg.owned_end || match_band( chr, seg.owned_end, right ) ) && matched;
+                warn = !matched && !chr.warned;
+                chr.warned = chr.warned || !matched;
             }
+            
+            if ( --chr.remaining == 0 ) {
+                last = ( --gen.remaining == 0 );
+            }
+        }
 
-            // cleanup
-            sequence.clear();
+        if ( warn ) {
+            log(WARN, "Cores of %s in %s differ between segments, SEGMENT_MARGIN of %d bases is too short for LCP level %d and labels may differ from an unsegmented run.", chr.id.c_str(), thread_arguments[chr.genome].inFileName.c_str(), SEGMENT_MARGIN, program_arguments.lcpLevel);
+        }
+
+        // let the stream read the next task
+        if ( chr.begin == NULL ) {
+            {
+                std::lock_guard<std::mutex> lock(tasks.mutex);
+                tasks.pending--;
+            }
+            tasks.cond_var.notify_one();
         }
+
+        // the last chromosome of a genome finalizes it
+        if ( last ) {
+            log(INFO, "Thread ID: %s ended processing %s", ss.str().c_str(), thread_arguments[chr.genome].inFileName.c_str());
+            finalize_genome( gen, thread_arguments[chr.genome], program_arguments );
+        }
+    }
+};
+
+
+bool match_band( struct chromosome& chr, size_t boundary, uint64_t fingerprint ) {
+
+    std::map<size_t, uint64_t>::iterator it = chr.bands.find( boundary );
+
+    if ( it == chr.bands.end() ) {
+        chr.bands[boundary] = fingerprint;
+        return true;
+    }
+
+    bool matched = ( it->second == fingerprint );
+    chr.bands.erase( it );
+
+    return matched;
+};
+
+
+void add_chromosome( struct schedule& tasks, struct chromosome& chr, size_t length, size_t segment_length, std::vector<struct segment>& segments ) {
+
+    tasks.chromosomes.push_back( chromosome() );
+    
+    struct chromosome& stored = tasks.chromosomes.back();
+    stored.genome = chr.genome;
+    stored.index = chr.index;
+    stored.id = chr.id;
+    stored.begin = chr.begin;
+    stored.end = chr.end;
+    stored.segmented = ( segment_length != 0 && length > segment_length );
+    stored.warned = false;
+
+    struct segment seg;
+    seg.chromosome = &stored;
+    seg.cost = stored.end - stored.begin;
+    seg.begin = 0;
+    seg.end = 0;
+    seg.owned_begin = 0;
+    seg.owned_end = 0;
+    seg.raw = stored.begin;
+
+    if ( stored.segmented ) {
+        // split chromosome into segments, each extended by margins on both sides
+        stored.remaining = 0;
         
-        file.close();
+        for ( size_t owned = 0; owned < length; owned += segment_length ) {
+            seg.owned_begin = owned;
+            seg.owned_end = std::min( owned + segment_length, length );
+            
+            // windows start in increasing order, so the raw lines are skipped once in total
+            size_t begin = owned < SEGMENT_MARGIN ? 0 : owned - SEGMENT_MARGIN;
+            seg.raw = skip_sequence( seg.raw, stored.end, begin - seg.begin );
+            seg.begin = begin;
+            seg.end = std::min( seg.owned_end + SEGMENT_MARGIN, length );
+            seg.cost = seg.end - seg.begin;
+            segments.push_back(seg);
+            stored.remaining++;
+        }
     } else {
+        stored.remaining = 1;
+        segments.push_back(seg);
+    }
+};
+
+
+void stream_chromosomes( struct schedule& tasks, size_t genome_index, size_t segment_length, size_t decompress_threads, std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments ) {
+
+    struct genome& gen = tasks.genomes[genome_index];
+
+    log(INFO, "Streaming chromosomes of %s", thread_arguments[genome_index].inFileName.c_str());
+
+    struct fasta_stream stream;
+    stream.file = new BgzfFile( thread_arguments[genome_index].inFileName.c_str(), decompress_threads );
+    stream.buffer.resize( STREAM_BUFFER_SIZE );
+    stream.position = 0;
+    stream.length = 0;
+    stream.line_start = true;
+
+    if ( !(*stream.file) ) {
+        log(ERROR, "Could not be able to open %s", thread_arguments[genome_index].inFileName.c_str());
+        exit(1);
+    }
+
+    std::string id, sequence;
+    size_t index = 0;
+
+    while ( stream_header( stream, id ) ) {
+
+        struct chromosome* chr = NULL;
+        struct segment seg;
+        size_t offset = 0;      // position of the first buffered base in the chromosome
+        size_t owned = 0;       // beginning of the next segment
+        bool more = true;
+        sequence.clear();
+
+        while ( true ) {
+            
+            // read until the window of the next segment is complete, i.e. followed by another base, or the record ends
+            const size_t window_end = owned + segment_length + SEGMENT_MARGIN;
+            const size_t limit = segment_length == 0 ? SIZE_MAX : window_end + 1;
+
+            if ( more && offset + sequence.size() < limit ) {
+                more = stream_sequence( stream, sequence, limit - offset );
+            }
+
+            const size_t length = offset + sequence.size();
+
+            if ( length == 0 ) {
+                break;
+            }
+
+            // bound the number of decompressed tasks in memory
+            {
+                std::unique_lock<std::mutex> lock(tasks.mutex);
+                tasks.cond_var.wait(lock, [&tasks, &program_arguments]{ return tasks.pending < program_arguments.threadNumber; });
+                tasks.pending++;
+            }
+
+            if ( chr == NULL ) {
+                tasks.chromosomes.push_back( chromosome() );
+                chr = &tasks.chromosomes.back();
+                chr->genome = genome_index;
+                chr->index = index++;
+                chr->id = id;
+                chr->begin = NULL;
+                chr->end = NULL;
+                chr->remaining = 1;
+                chr->segmented = ( segment_length != 0 && length > segment_length );
+                chr->warned = false;
+
+                std::lock_guard<std::mutex> lock(gen.mutex);
+                gen.strs.push_back(NULL);
+                gen.remaining++;
+            }
+
+            seg.chromosome = chr;
+            seg.raw = NULL;
+
+            if ( !chr->segmented ) {
+                seg.begin = 0;
+                seg.end = 0;
+                seg.owned_begin = 0;
+                seg.owned_end = 0;
+                seg.cost = sequence.size();
+                seg.sequence.swap( sequence );
+                tasks.streamed.push( std::move(seg) );
+                break;
+            }
+
+            // the window is not clipped unless the record ended
+            seg.owned_begin = owned;
+            seg.owned_end = std::min( owned + segment_length, length );
+            seg.begin = owned < SEGMENT_MARGIN ? 0 : owned - SEGMENT_MARGIN;
+            seg.end = std::min( window_end, length );
+            seg.cost = seg.end - seg.begin;
+            seg.sequence.assign( sequence, seg.begin - offset, seg.end - seg.begin );
+
+            // the chromosome is held by the stream until its last segment is queued
+            const bool last = ( !more && seg.owned_end == length );
+
+            if ( !last ) {
+                std::lock_guard<std::mutex> lock(gen.mutex);
+                chr->remaining++;
+            }
+
+            owned = seg.owned_end;
+            tasks.streamed.push( std::move(seg) );
+
+            if ( last ) {
+                break;
+            }
+
+            // drop the bases no later window needs
+            const size_t keep = owned < SEGMENT_MARGIN ? 0 : owned - SEGMENT_MARGIN;
+            sequence.erase( 0, keep - offset );
+            offset = keep;
+        }
+    }
+
+    delete stream.file;
+
+    log(INFO, "Located %d chromosomes in %s", index, thread_arguments[genome_index].inFileName.c_str());
+
+    // release the hold of the stream on the genome
+    bool last;
+    {
+        std::lock_guard<std::mutex> lock(gen.mutex);
+        last = ( --gen.remaining == 0 );
+    }
+
+    if ( last ) {
+        finalize_genome( gen, thread_arguments[genome_index], program_arguments );
+    }
+};
+
+
+void finalize_genome( struct genome& gen, struct targs& thread_arguments, const struct pargs& program_arguments ) {
+
+    if ( program_arguments.writeCores ) {
+        gen.strs.erase( std::remove( gen.strs.begin(), gen.strs.end(), (lcp::lps*)NULL ), gen.strs.end() );
+        set_signature( thread_arguments, program_arguments, gen.strs );
+    } else {
+        collapseRuns( gen.runs, thread_arguments.cores, thread_arguments.counts );
+    }
+    
+    delete gen.file;
+    gen.file = NULL;
+};
+
+
+size_t inflate_threads( size_t available ) {
+    const size_t threads = std::min( (size_t)FASTA_BGZF_THREADS, available );
+
+    // a single thread inflates on the reading thread itself
+    return threads > 1 ? threads : 0;
+};
+
+
+bool is_compressed( const MmapFile& file ) {
+    return file.size() >= 2 && (unsigned char)file.data()[0] == 0x1f && (unsigned char)file.data()[1] == 0x8b;
+};
+
+
+bool stream_record( struct fasta_stream& stream, std::string& id, std::string& sequence ) {
+
+    if ( !stream_header( stream, id ) ) {
+        return false;
+    }
+
+    sequence.clear();
+    stream_sequence( stream, sequence, SIZE_MAX );
+
+    return true;
+};
+
+
+bool fill_stream( struct fasta_stream& stream ) {
+
+    // read next block of decompressed bytes
+    ssize_t length = stream.file->read( stream.buffer.data(), stream.buffer.size() );
+
+    if ( length < 0 ) {
+        log(ERROR, "Could not be able to decompress the file.");
+        exit(1);
+    }
+
+    stream.position = 0;
+    stream.length = length;
+
+    return length > 0;
+};
+
+
+bool stream_header( struct fasta_stream& stream, std::string& id ) {
+
+    id.clear();
+
+    if ( stream.position == stream.length && !fill_stream( stream ) ) {
+        return false;
+    }
+
+    // read header line if the record has one
+    if ( stream.buffer[stream.position] == '>' ) {
+        stream.position++;
+
+        while ( stream.position < stream.length || fill_stream( stream ) ) {
+            const char* begin = stream.buffer.data() + stream.position;
+            const char* line_end = static_cast<const char*>( memchr(begin, '\n', stream.length - stream.position) );
+
+            if ( line_end ) {
+                id.append( begin, line_end );
+                stream.position = line_end - stream.buffer.data() + 1;
+                break;
+            }
+
+            id.append( begin, stream.length - stream.position );
+            stream.position = stream.length;
+        }
+
+        if ( !id.empty() && id[id.size() - 1] == '\r' ) {
+            id.erase( id.size() - 1 );
+        }
+    }
+
+    stream.line_start = true;
+
+    return true;
+};
+
+
+bool stream_sequence( struct fasta_stream& stream, std::string& sequence, size_t limit ) {
+
+    // append sequence lines until the next header line
+    while ( stream.position < stream.length || fill_stream( stream ) ) {
+        const char* begin = stream.buffer.data() + stream.position;
+
+        if ( stream.line_start && *begin == '>' ) {
+            return false;
+        }
+        if ( sequence.size() >= limit ) {
+            return true;
+        }
+
+        const char* line_end = static_cast<const char*>( memchr(begin, '\n', stream.length - stream.position) );
+
+        if ( line_end ) {
+            sequence.append( begin, line_end );
+            stream.position = line_end - stream.buffer.data() + 1;
+            stream.line_start = true;
+
+            if ( !sequence.empty() && sequence[sequence.size() - 1] == '\r' ) {
+                sequence.erase( sequence.size() - 1 );
+            }
+        } else {
+            sequence.append( begin, stream.length - stream.position );
+            stream.position = stream.length;
+            stream.line_start = false;
+        }
+    }
+
+    return false;
+};
+
+
+bool find_record( const char*& cursor, const char* buffer_end, std::string& id, const char*& begin, const char*& end ) {
+
+    if ( cursor >= buffer_end ) {
+        return false;
+    }
+
+    // read header line if the record has one
+    id.clear();
+    
+    if ( *cursor == '>' ) {
+        const char* header_end = static_cast<const char*>( memchr(cursor, '\n', buffer_end - cursor) );
+        const char* next = header_end ? header_end + 1 : buffer_end;
+        
+        if ( !header_end ) {
+            header_end = buffer_end;
+        }
+        if ( header_end > cursor + 1 && *(header_end - 1) == '\r' ) {
+            header_end--;
+        }
+
+        id.assign( cursor + 1, header_end );
+        cursor = next;
+    }
+
+    // find the beginning of the next record, i.e. a `>` placed at the start of a line
+    begin = cursor;
+    end = cursor;
+    
+    while ( true ) {
+        end = static_cast<const char*>( memchr(end, '>', buffer_end - end) );
+
+        if ( !end ) {
+            end = buffer_end;
+            break;
+        }
+        if ( end == begin || *(end - 1) == '\n' ) {
+            break;
+        }
+        end++;
+    }
+
+    cursor = end;
+
+    return true;
+};
+
+
+size_t compacted_length( const char* begin, const char* end ) {
+
+    size_t length = 0;
+
+    while ( begin < end ) {
+        const char* line_end = static_cast<const char*>( memchr(begin, '\n', end - begin) );
+        const char* next = line_end ? line_end + 1 : end;
+
+        if ( !line_end ) {
+            line_end = end;
+        }
+        if ( line_end > begin && *(line_end - 1) == '\r' ) {
+            line_end--;
+        }
+
+        length += line_end - begin;
+        begin = next;
+    }
+
+    return length;
+};
+
+
+const char* skip_sequence( const char* begin, const char* end, size_t count ) {
+
+    while ( begin < end ) {
+        const char* line_end = static_cast<const char*>( memchr(begin, '\n', end - begin) );
+        const char* next = line_end ? line_end + 1 : end;
+
+        if ( !line_end ) {
+            line_end = end;
+        }
+        if ( line_end > begin && *(line_end - 1) == '\r' ) {
+            line_end--;
+        }
+
+        if ( count < (size_t)( line_end - begin ) ) {
+            return begin + count;
+        }
+
+        count -= line_end - begin;
+        begin = next;
+    }
+
+    return end;
+};
+
+
+void compact_record( const char* begin, const char* end, std::string& sequence ) {
+
+    // record size is an upper bound of sequence size
+    sequence.resize( end - begin );
+    char* out = &sequence[0];
+
+    while ( begin < end ) {
+        const char* line_end = static_cast<const char*>( memchr(begin, '\n', end - begin) );
+        const char* next = line_end ? line_end + 1 : end;
+
+        if ( !line_end ) {
+            line_end = end;
+        }
+        if ( line_end > begin && *(line_end - 1) == '\r' ) {
+            line_end--;
+        }
+
+        memcpy( out, begin, line_end - begin );
+        out += line_end - begin;
+        begin = next;
+    }
+
+    sequence.resize( out - sequence.data() );
+};
+
+
+void compact_window( const char* begin, const char* end, size_t length, std::string& sequence ) {
+
+    sequence.resize( length );
+    char* out = &sequence[0];
+    char* out_end = out + length;
+
+    while ( begin < end && out < out_end ) {
+        const char* line_end = static_cast<const char*>( memchr(begin, '\n', end - begin) );
+        const char* next = line_end ? line_end + 1 : end;
+
+        if ( !line_end ) {
+            line_end = end;
+        }
+        if ( line_end > begin && *(line_end - 1) == '\r' ) {
+            line_end--;
+        }
+
+        size_t copied = std::min( (size_t)( line_end - begin ), (size_t)( out_end - out ) );
+        memcpy( out, begin, copied );
+        out += copied;
+        begin = next;
+    }
+
+    sequence.resize( out - sequence.data() );
+};
+
+
+void read_fasta( struct targs& thread_arguments, const struct pargs& program_arguments, size_t decompress_threads ) {
+    
+    // get thread id
+    std::ostringstream ss;
+    ss << std::this_thread::get_id();
+
+    // log initiation of reading fasta
+    log(INFO, "Thread ID: %s started processing %s", ss.str().c_str(), thread_arguments.inFileName.c_str());
+
+    // map fasta file into memory
+    MmapFile file( thread_arguments.inFileName.c_str() );
+
+    if ( !file ) {
         log(ERROR, "Could not be able to open %s", thread_arguments.inFileName.c_str());
         exit(1);
     }
 
+    std::vector<lcp::lps*> strs;
+    std::vector<uint32_t> labels;
+    std::vector<struct run> runs;
+    struct run result;
+    thread_arguments.size = 0;
+
+    // compressed files are decompressed on the fly instead
+    struct fasta_stream stream;
+    stream.file = NULL;
+
+    if ( is_compressed( file ) ) {
+        stream.file = new BgzfFile( thread_arguments.inFileName.c_str(), decompress_threads );
+        stream.buffer.resize( STREAM_BUFFER_SIZE );
+        stream.position = 0;
+        stream.length = 0;
+        stream.line_start = true;
+
+        if ( !(*stream.file) ) {
+            log(ERROR, "Could not be able to open %s", thread_arguments.inFileName.c_str());
+            exit(1);
+        }
+    }
+
+    // read file
+    const char* cursor = file.data();
+    const char* end = file.data() + file.size();
+    const char *begin, *record_end;
+    std::string sequence, id;
+    
+    while ( true ) {
+
+        if ( stream.file != NULL ) {
+            if ( !stream_record( stream, id, sequence ) ) {
+                break;
+            }
+        } else {
+            if ( !find_record( cursor, end, id, begin, record_end ) ) {
+                break;
+            }
+            compact_record( begin, record_end, sequence );
+        }
+
+        if ( program_arguments.verbose ) {
+            log(INFO, "Thread ID: %s, Processing started for %s", ss.str().c_str(), id.c_str());
+        }
+
+        if ( sequence.size() == 0 ) {
+            continue;
+        }
+
+        lcp::lps* str = new lcp::lps(sequence);
+        str->deepen(program_arguments.lcpLevel);
+
+        if ( program_arguments.writeCores ) {
+            strs.push_back(str);
+        } else {
+            // reduce chromosome right away, only its run of labels and counts is kept
+            for ( std::vector<lcp::core*>::iterator it = str->cores->begin(); it != str->cores->end(); it++ ) {
+                labels.push_back( (*it)->label );
+            }
+            delete str;
+
+            makeRun( labels, result );
+            pushRun( runs, result );
+        }
+
+        // increment processed sequence size
+        thread_arguments.size += sequence.size();
+
+        if ( program_arguments.verbose ) {
+            log(INFO, "Thread ID: %s, Length of the processed sequence: %d", ss.str().c_str(), sequence.size());
+        }
+    }
+
+    // release the largest chromosome buffer before flattening
+    std::string().swap(sequence);
+    delete stream.file;
+
     // log ending of processing fasta
     log(INFO, "Thread ID: %s ended processing %s", ss.str().c_str(), thread_arguments.inFileName.c_str());
 
+    if ( program_arguments.writeCores ) {
+        set_signature( thread_arguments, program_arguments, strs );
+    } else {
+        collapseRuns( runs, thread_arguments.cores, thread_arguments.counts );
+    }
+};
+
+
+void set_signature( struct targs& thread_arguments, const struct pargs& program_arguments, std::vector<lcp::lps*>& strs ) {
+
     // write cores to file if user specified to do so
     if ( program_arguments.writeCores ) {
         save( thread_arguments, strs );
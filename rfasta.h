@@ -8,11 +8,88 @@
 #include <iostream>
 #include <sstream>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <map>
 #include "args.h"
 #include "logging.h"
 #include "helper.h"
 #include "lps.h"
 #include "fileio.h"
+#include "utils/MmapFile.hpp"
+#include "utils/BgzfFile.hpp"
+#include "utils/ThreadSafeQueue.hpp"
+
+// bases added on both sides of a segment, must exceed the context of the LCP level, see `match_band()`
+#ifndef SEGMENT_MARGIN
+#define SEGMENT_MARGIN 100000
+#endif
+
+#ifndef STREAM_BUFFER_SIZE
+#define STREAM_BUFFER_SIZE 4194304
+#endif
+
+// decompression threads of a BGZF-compressed FASTA file, taken out of the threads set with -t
+#ifndef FASTA_BGZF_THREADS
+#define FASTA_BGZF_THREADS 4
+#endif
+
+
+struct chromosome {
+    size_t genome;          // index of the genome in thread arguments
+    size_t index;           // order of the chromosome within its genome
+    std::string id;
+    const char* begin;      // sequence lines in the mapped file, NULL if the chromosome is streamed
+    const char* end;
+    size_t remaining;       // number of segments not processed yet
+    bool segmented;
+    bool warned;            // the margin check failed for one of the segment boundaries
+    std::map<size_t, uint64_t> bands;   // fingerprints of the first segment to reach a boundary, see `match_band()`
+};
+
+struct segment {
+    struct chromosome* chromosome;
+    size_t cost;            // number of bytes processed, used for scheduling
+    size_t begin;           // window given to lcp, in compacted coordinates
+    size_t end;
+    size_t owned_begin;     // cores starting in the owned range are kept
+    size_t owned_end;
+    const char* raw;        // first byte of the window in the mapped file
+    std::string sequence;   // window of a streamed chromosome, moved to the worker
+};
+
+struct genome {
+    MmapFile* file;
+    std::vector<lcp::lps*> strs;
+    std::vector<struct run> runs;   // reduced chromosomes, if cores are not written
+    size_t remaining;               // number of chromosomes not processed yet
+    std::mutex mutex;
+};
+
+struct schedule {
+    std::vector<struct genome> genomes;
+    std::deque<struct chromosome> chromosomes;
+    std::vector<struct segment> segments;       // segments of mapped files, longest first
+    std::atomic<size_t> next;                   // next segment of mapped files to be processed
+    ThreadSafeQueue<struct segment> streamed;   // segments of compressed files, in reading order
+    size_t pending;                             // streamed segments that are not processed yet
+    std::mutex mutex;
+    std::condition_variable cond_var;
+
+    schedule(size_t genome_count) : genomes(genome_count), next(0), pending(0) {}
+};
+
+struct fasta_stream {
+    BgzfFile* file;
+    std::vector<char> buffer;
+    size_t position;
+    size_t length;
+    bool line_start;        // the next byte starts a line
+};
 
 
 /**
@@ -34,13 +111,252 @@
  *   based on `program_arguments.threadNumber`. 
  * - Threads are launched until the maximum thread limit is reached, and once a 
  *   thread finishes its work, it is joined and removed from the active thread pool.
+ * - A compressed genome takes the BGZF decompression threads of `inflate_threads()` out of the 
+ *   same limit, so the process never runs more than `threadNumber` threads.
  * - The function continues to launch new threads until all FASTA files in 
  *   `thread_arguments` have been processed.
  * - Once all threads are launched, the function ensures that all threads are 
  *   joined before exiting, preventing any orphan threads from continuing execution.
+ * - If `program_arguments.splitChromosomes` is set, chromosomes are scheduled as separate tasks 
+ *   instead by `read_chromosomes()`.
  */
 void read_fastas( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments );
 
+/**
+ * @brief Reads FASTA files by scheduling each chromosome as a separate task.
+ * 
+ * This function maps every FASTA file in `thread_arguments`, locates the records of all genomes 
+ * with `find_record()` and runs a pool of `program_arguments.threadNumber` workers over the 
+ * resulting chromosome tasks. Tasks are ordered from the longest to the shortest sequence, so that 
+ * wall time is bounded by the largest chromosome rather than by the largest genome. Once the last 
+ * chromosome of a genome is deepened, its cores are merged into the genome's `cores` and `counts` 
+ * by `set_signature()`.
+ * 
+ * @param thread_arguments A reference to a vector of `targs` structures, one per genome.
+ * @param program_arguments A constant reference to a `pargs` structure representing the global 
+ *        program arguments.
+ * 
+ * @details
+ * - Unless cores are written to files, each chromosome is reduced to a sorted run of core labels 
+ *   and counts as soon as it is deepened, its `lps` object is released and the run is merged 
+ *   incrementally into the genome with `pushRun()`. Only one chromosome per thread is resident.
+ * - If `program_arguments.segmentLength` is set, chromosomes longer than it are split into 
+ *   segments of that length. Each segment is processed as a separate task on a window extended 
+ *   by `SEGMENT_MARGIN` bases on both sides, and only the cores starting inside the segment are 
+ *   kept. Since LCP cores only depend on their local neighbourhood, cores away from the window 
+ *   ends are identical to the ones of the whole chromosome, and the resulting label multiset is 
+ *   identical to the unsegmented run as long as the margin exceeds the context of the LCP level. 
+ *   Only the window of a segment is compacted, so memory is bounded by the window length rather 
+ *   than by the chromosome length.
+ * - The margin is checked at run time: neighbouring segments compare the cores starting in the 
+ *   first `SEGMENT_MARGIN / 2` bases after their boundary with `match_band()`, and a warning is 
+ *   logged if they differ, i.e. if the margin is too short for `lcpLevel`.
+ * - Segmented chromosomes are reduced to core labels, so they cannot be saved with `-w`.
+ * - Gzip and BGZF-compressed files cannot be located up front. They are decompressed by the calling 
+ *   thread, with BGZF blocks inflated in parallel by up to half of the `threadNumber` threads, which 
+ *   are taken out of the workers, and their chromosomes or segments are queued as soon as they are 
+ *   read, so decompression overlaps with deepening. At most `threadNumber` streamed tasks are kept 
+ *   in memory, and workers prefer them over the segments of mapped files.
+ */
+void read_chromosomes( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments );
+
+/**
+ * @brief Processes chromosome segments until none is left.
+ * 
+ * Worker routine of `read_chromosomes()`. Each worker takes the next streamed segment if there is 
+ * one, otherwise atomically takes the next segment of the mapped files. A whole chromosome is 
+ * compacted into a reusable buffer, deepened, and its `lps` object is stored at the chromosome's 
+ * position in its genome. For a segmented chromosome, only the window of the segment is compacted 
+ * with `compact_window()`, or taken over from the stream, and deepened; the labels of the cores it 
+ * owns are reduced to a run of the genome, and the cores next to its boundaries are checked 
+ * against the neighbouring segments with `match_band()`. The worker that completes the last 
+ * chromosome of a genome finalizes that genome.
+ * 
+ * @param tasks A reference to the shared schedule of segments, chromosomes and genomes.
+ * @param thread_arguments A reference to a vector of `targs` structures, one per genome.
+ * @param program_arguments A constant reference to a `pargs` structure representing the global 
+ *        program arguments.
+ */
+void process_chromosomes( struct schedule& tasks, std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments );
+
+/**
+ * @brief Checks the cores next to a segment boundary against the neighbouring segment.
+ * 
+ * The first of the two segments around `boundary` to be processed stores its fingerprint, the 
+ * second one compares its fingerprint with it. Must be called with the genome mutex held.
+ * 
+ * @param chr A reference to the segmented chromosome.
+ * @param boundary The position where the owned ranges of the two segments meet.
+ * @param fingerprint The fingerprint of the positions and labels of the cores starting in the 
+ *        band after `boundary`.
+ * @return False if the neighbouring segment computed different cores in the band.
+ */
+bool match_band( struct chromosome& chr, size_t boundary, uint64_t fingerprint );
+
+/**
+ * @brief Adds a chromosome of a mapped file to the schedule, splitting it into segments if it is long.
+ * 
+ * @param tasks A reference to the shared schedule.
+ * @param chr A reference to the chromosome, which is copied into the schedule.
+ * @param length The compacted length of the chromosome.
+ * @param segment_length The length of segments, or 0 if chromosomes are not segmented.
+ * @param segments A reference to the vector the segments of the chromosome are appended to.
+ */
+void add_chromosome( struct schedule& tasks, struct chromosome& chr, size_t length, size_t segment_length, std::vector<struct segment>& segments );
+
+/**
+ * @brief Decompresses a FASTA file and queues its chromosomes in reading order.
+ * 
+ * Producer routine of `read_chromosomes()` for gzip and BGZF-compressed files. Each record is read 
+ * with `stream_sequence()` in pieces; a chromosome longer than the segment length is split while 
+ * it is read, and a segment is queued as soon as its window is complete, so only the windows are 
+ * kept in memory. A task is queued once fewer than `threadNumber` streamed tasks are pending. The 
+ * genome is finalized by the last thread that is done with it, which might be the producer.
+ * 
+ * @param tasks A reference to the shared schedule.
+ * @param genome_index The index of the genome in `thread_arguments`.
+ * @param segment_length The length of segments, or 0 if chromosomes are not segmented.
+ * @param decompress_threads The number of threads inflating BGZF blocks, see `inflate_threads()`.
+ * @param thread_arguments A reference to a vector of `targs` structures, one per genome.
+ * @param program_arguments A constant reference to a `pargs` structure representing the global 
+ *        program arguments.
+ */
+void stream_chromosomes( struct schedule& tasks, size_t genome_index, size_t segment_length, size_t decompress_threads, std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments );
+
+/**
+ * @brief Finalizes a genome once all its chromosomes are processed.
+ * 
+ * @param gen A reference to the state of the genome.
+ * @param thread_arguments A reference to the `targs` structure of the genome.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ */
+void finalize_genome( struct genome& gen, struct targs& thread_arguments, const struct pargs& program_arguments );
+
+/**
+ * @brief Chooses the number of threads inflating the BGZF blocks of a compressed file.
+ * 
+ * @param available The number of threads that can be taken out of the thread budget.
+ * @return Up to `FASTA_BGZF_THREADS` threads, or 0 if fewer than two are available, in which case 
+ *         the blocks are inflated by the reading thread itself.
+ */
+size_t inflate_threads( size_t available );
+
+/**
+ * @brief Checks if a mapped file is gzip or BGZF-compressed.
+ * 
+ * @param file A constant reference to the mapped file.
+ * @return True if the file starts with the gzip magic bytes.
+ */
+bool is_compressed( const MmapFile& file );
+
+/**
+ * @brief Reads the next FASTA record from a compressed stream.
+ * 
+ * This function is the streaming counterpart of `find_record()` and `compact_record()`. It reads 
+ * the header with `stream_header()` and the whole sequence with `stream_sequence()`.
+ * 
+ * @param stream A reference to the stream, opened on a gzip or BGZF-compressed file.
+ * @param id A reference to the string that will hold the header of the record.
+ * @param sequence A reference to the string that will hold the compacted sequence of the record.
+ * @return True if a record was read; false if the end of the stream was reached.
+ */
+bool stream_record( struct fasta_stream& stream, std::string& id, std::string& sequence );
+
+/**
+ * @brief Reads the next block of decompressed bytes into the buffer of a stream.
+ * 
+ * @param stream A reference to the stream, whose buffer is consumed.
+ * @return True if bytes were read; false if the end of the stream was reached.
+ */
+bool fill_stream( struct fasta_stream& stream );
+
+/**
+ * @brief Reads the header line of the next FASTA record from a compressed stream.
+ * 
+ * @param stream A reference to the stream, positioned at the beginning of a record.
+ * @param id A reference to the string that will hold the header of the record. It is left empty if 
+ *        the record does not start with a header line.
+ * @return True if a record follows; false if the end of the stream was reached.
+ */
+bool stream_header( struct fasta_stream& stream, std::string& id );
+
+/**
+ * @brief Appends the sequence lines of the current FASTA record from a compressed stream.
+ * 
+ * Large blocks of decompressed bytes are scanned with `memchr`, and sequence lines are appended to 
+ * `sequence` without a per-line allocation. Records and lines may span several blocks. Reading 
+ * stops at the end of the record, or once `sequence` holds at least `limit` characters, in which 
+ * case it overshoots by at most one line or one block.
+ * 
+ * @param stream A reference to the stream, positioned after the header or a previous call.
+ * @param sequence A reference to the string the compacted sequence is appended to.
+ * @param limit The size of `sequence` to stop at.
+ * @return True if the record may continue; false if its end was reached.
+ */
+bool stream_sequence( struct fasta_stream& stream, std::string& sequence, size_t limit );
+
+/**
+ * @brief Locates the next FASTA record in an in-memory buffer.
+ * 
+ * This function reads the record starting at `cursor`, stores its header (without the leading 
+ * `>`) in `id` and sets `[begin, end)` to the raw sequence lines of the record. Record boundaries 
+ * are located with `memchr`, which is vectorized by the C library, so no sequence byte is copied.
+ * 
+ * @param cursor A reference to the current position in the buffer. It is advanced to the beginning 
+ *        of the next record.
+ * @param buffer_end A pointer to one past the last byte of the buffer.
+ * @param id A reference to the string that will hold the header of the record. It is left empty if 
+ *        the buffer does not start with a header line.
+ * @param begin A reference to the pointer that will hold the first byte of the sequence lines.
+ * @param end A reference to the pointer that will hold one past the last byte of the sequence lines.
+ * @return True if a record was found; false if the end of the buffer was reached.
+ */
+bool find_record( const char*& cursor, const char* buffer_end, std::string& id, const char*& begin, const char*& end );
+
+/**
+ * @brief Computes the length of a FASTA record once its line breaks are removed.
+ * 
+ * @param begin A pointer to the first byte of the sequence lines.
+ * @param end A pointer to one past the last byte of the sequence lines.
+ * @return The number of sequence characters in `[begin, end)`.
+ */
+size_t compacted_length( const char* begin, const char* end );
+
+/**
+ * @brief Skips a number of sequence characters in the sequence lines of a FASTA record.
+ * 
+ * @param begin A pointer into the sequence lines.
+ * @param end A pointer to one past the last byte of the sequence lines.
+ * @param count The number of sequence characters to skip.
+ * @return A pointer to the byte holding the next sequence character, or `end`.
+ */
+const char* skip_sequence( const char* begin, const char* end, size_t count );
+
+/**
+ * @brief Compacts the sequence lines of a FASTA record into a single buffer.
+ * 
+ * Line breaks are located with `memchr` and each line is copied exactly once into `sequence`. The 
+ * buffer is reused between calls, so it only grows up to the size of the largest record.
+ * 
+ * @param begin A pointer to the first byte of the sequence lines.
+ * @param end A pointer to one past the last byte of the sequence lines.
+ * @param sequence A reference to the string that will hold the compacted sequence.
+ */
+void compact_record( const char* begin, const char* end, std::string& sequence );
+
+/**
+ * @brief Compacts a window of the sequence lines of a FASTA record into a single buffer.
+ * 
+ * Same as `compact_record()`, but only `length` sequence characters are copied, so a segment 
+ * never touches more of the record than its own window.
+ * 
+ * @param begin A pointer to the first byte of the window, see `skip_sequence()`.
+ * @param end A pointer to one past the last byte of the sequence lines.
+ * @param length The number of sequence characters in the window.
+ * @param sequence A reference to the string that will hold the compacted window.
+ */
+void compact_window( const char* begin, const char* end, size_t length, std::string& sequence );
+
 /**
  * @brief Reads a FASTA file and processes its sequences using the LCP (Locally Consistent Parsing) method.
  * 
@@ -55,12 +371,18 @@ void read_fastas( std::vector<struct targs>& thread_arguments, const struct parg
  * @param program_arguments A constant reference to the `pargs` structure that contains the 
  *        program-wide settings, such as the LCP depth level (`lcpLevel`), verbosity, and whether 
  *        to write LCP cores to file.
+ * @param decompress_threads The number of threads inflating BGZF blocks if the file is compressed, 
+ *        taken out of `threadNumber` by `read_fastas()`, see `inflate_threads()`.
  * 
  * @details
- * - The function opens the FASTA file specified in `thread_arguments.inFileName` and processes 
- *   each chromosome or sequence individually.
+ * - The function memory-maps the FASTA file specified in `thread_arguments.inFileName` and processes 
+ *   each chromosome or sequence individually, as located by `find_record()`. Gzip and BGZF-compressed 
+ *   files are decompressed on the fly and read by `stream_record()` instead; BGZF blocks are inflated 
+ *   ahead by a pool of `decompress_threads` threads while the current chromosome is deepened.
  * - For each sequence, an `lps` (locally parsed string) object is created, and its depth is increased using 
- *   `deepen()`. The sequence is then stored in a vector for further processing.
+ *   `deepen()`. If cores are written to file, the sequence is then stored in a vector for further processing. 
+ *   Otherwise, it is immediately reduced to a sorted run of core labels and counts and released, and the runs 
+ *   are merged incrementally into `cores` and `counts` of the genome.
  * - If the `verbose` flag in `program_arguments` is set, the function logs detailed information about each 
  *   sequence, including its ID and size.
  * - Once all sequences are processed, the function optionally saves the LCP cores to a file if the `writeCores` 
@@ -72,8 +394,24 @@ void read_fastas( std::vector<struct targs>& thread_arguments, const struct parg
  *       separate FASTA file or sequence set. The function logs the initiation and completion of each thread 
  *       using the thread ID for traceability.
  * 
- * @see flatten(), generateSignature(), initializeSetAndCounts(), save(), log()
+ * @see find_record(), compact_record(), set_signature(), log()
+ */
+void read_fasta( struct targs& thread_arguments, const struct pargs& program_arguments, size_t decompress_threads );
+
+/**
+ * @brief Sets the cores and counts of a genome from its deepened chromosomes.
+ * 
+ * This function optionally saves the LCP cores to a file if the `writeCores` flag is enabled, 
+ * flattens the cores of all chromosomes into core labels, releases the `lps` objects and 
+ * initializes `cores` and `counts` of the genome from the sorted labels.
+ * 
+ * @param thread_arguments A reference to the `targs` structure of the genome.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param strs A reference to the vector of deepened chromosomes of the genome, in file order. 
+ *        The vector is emptied and its objects are deleted.
+ * 
+ * @see flatten(), generateSignature(), initializeSetAndCounts(), save()
  */
-void read_fasta( struct targs& thread_arguments, const struct pargs& program_arguments );
+void set_signature( struct targs& thread_arguments, const struct pargs& program_arguments, std::vector<lcp::lps*>& strs );
 
 #endif
\ No newline at end of file
@@ -1,131 +1,422 @@
 #include "rfastq.h"
+#include "rbam.h"
 
 
-std::mutex results_mutex; // mutex for protecting access to the results vector
+/**
+ * @brief Decompresses a FASTQ file into large raw buffers on a dedicated thread.
+ *
+ * This function runs in its own thread and fills buffers taken from a pool of free chunks with
+ * decompressed bytes, which are handed over to the parser in the order they were read. Plain
+ * gzip streams are inflated by this thread alone, while BGZF blocks are inflated in parallel by
+ * the thread pool of the file, so decompression overlaps with parsing and core computation.
+ * The raw queue is marked as finished at the end of the file.
+ *
+ * @param infile The opened input file.
+ * @param raw_queue The queue to which filled chunks are pushed.
+ * @param free_chunks The queue from which empty chunks are taken.
+ * @param inflate_time The seconds spent reading from the file, incremented by the call.
+ */
+void inflate_fastq( BgzfFile& infile, TaskQueue<Chunk>& raw_queue, TaskQueue<Chunk>& free_chunks, double& inflate_time ) {
+    Chunk chunk;
+
+    while ( free_chunks.pop(chunk) ) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        ssize_t length = infile.read( &chunk.data[0], chunk.data.size() );
+        inflate_time += std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+        if ( length < 0 ) {
+            log(ERROR, "Error while decompressing the reads.");
+            exit(1);
+        }
+
+        if ( length == 0 ) {
+            break;
+        }
+
+        chunk.length = length;
+        raw_queue.push( std::move(chunk) );
+    }
+
+    raw_queue.markFinished();
+};
+
+
+/**
+ * @brief Queues a full batch of reads and takes an empty one from the pool.
+ *
+ * Blocks while all batches of the pool are queued or being processed.
+ *
+ * @param task The full batch, replaced by an empty batch of the same sample.
+ * @param sample The index of the sample the batch belongs to.
+ * @param pool The pool of workers shared by all samples.
+ */
+void hand_over( Task& task, size_t sample, struct read_pool& pool ) {
+    pool.pending[sample]++;
+    pool.task_queue.push( std::move(task) );
+    pool.free_queue.pop( task );
+    task.sample = sample;
+};
+
+
+/**
+ * @brief Queues the last batch of a producer, or returns it to the pool if it is empty.
+ *
+ * @param task The last batch of the producer.
+ * @param pool The pool of workers shared by all samples.
+ */
+void release( Task& task, struct read_pool& pool ) {
+    if ( !task.ends.empty() ) {
+        pool.pending[task.sample]++;
+        pool.task_queue.push( std::move(task) );
+    } else {
+        pool.free_queue.push( std::move(task) );
+    }
+};
+
 
 /**
- * @brief Processes genomic reads from a queue, extracts LCP cores, and aggregates results in a shared vector.
+ * @brief Marks a batch of a sample as processed, or the sample as read.
  *
- * This function runs in a worker thread and is responsible for processing genomic reads
- * retrieved from a thread-safe queue. For each read, it computes the LCP cores at a specified
- * LCP level, processes the reverse complement of the read, computes its LCP cores, and then
- * aggregates these cores in a shared vector. The function ensures thread-safe access to the
- * shared vector using mutexes and minimizes locking overhead by merging local results into
- * the shared vector periodically.
+ * The sample is complete once it is read and all its batches are processed.
  *
- * @param task_queue The thread-safe queue from which tasks (genomic reads) are retrieved.
- * @param cores A shared vector to store the labels of LCP cores extracted from the reads.
+ * @param pool The pool of workers shared by all samples.
+ * @param sample The index of the sample.
+ */
+void complete_batch( struct read_pool& pool, size_t sample ) {
+    if ( --pool.pending[sample] == 0 ) {
+        pool.complete[sample] = true;
+    }
+};
+
+
+/**
+ * @brief Converts the table of a worker into a run of its sample and releases the table.
+ *
+ * @param pool The pool of workers shared by all samples.
+ * @param table The table of the worker, left empty without buckets.
+ * @param sample The index of the sample of the table.
+ */
+void flush_table( struct read_pool& pool, std::unordered_map<uint32_t, size_t>& table, size_t sample ) {
+    struct run result;
+    makeRun( table, result );
+    std::unordered_map<uint32_t, size_t>().swap( table );
+
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pushRun( pool.runs[sample], result );
+};
+
+
+/**
+ * @brief Processes batches of genomic reads from a queue, extracts LCP cores, and counts them in thread-local tables.
+ *
+ * This function runs in a worker thread of the pool shared by all samples and is responsible for
+ * processing batches of genomic reads retrieved from the task queue. For each read, it computes the
+ * LCP cores at a specified LCP level, processes the reverse complement of the read, computes its
+ * LCP cores, and then counts these cores in a hash table owned by the thread, one per sample, so
+ * that memory grows with the number of distinct cores rather than with the sequencing depth. A
+ * table is flushed by `flush_table()` into a sorted run, which is pushed to the stack of runs of
+ * its sample under the mutex of the pool, and released as soon as all batches of its sample are
+ * processed or it holds `TABLE_FLUSH_SIZE` cores, so a worker only keeps tables of the samples in
+ * progress, each of a bounded size. Processed batches are cleared, keeping their
+ * capacity, and returned to the pool of free batches, so that producers do not allocate new buffers.
+ * In sketch mode, only the cores kept by the sketch are counted, so that the tables shrink with 
+ * the scale.
+ *
+ * @param pool The pool holding the task queue, the free batches and the runs of every sample.
  * @param lcp_level The depth of analysis for extracting LCP cores from the reads.
+ * @param threshold The threshold of the sketch, see `sketchThreshold()`.
  */
-void process_read( ThreadSafeQueue<Task>& task_queue, std::vector<uint32_t>& cores, const int lcp_level ) {
-    std::vector<uint32_t> local_cores;
+void process_read( struct read_pool& pool, const int lcp_level, const uint32_t threshold ) {
+    std::vector<std::unordered_map<uint32_t, size_t>> tables( pool.runs.size() );
+    std::vector<double> seconds( pool.runs.size(), 0 );
+    std::vector<size_t> active;     // samples whose tables are not empty
+    std::string read;
     Task task;
 
-    auto merge_results = [&]() {
-        std::lock_guard<std::mutex> lock(results_mutex);
-        cores.insert(cores.end(), local_cores.begin(), local_cores.end());
-        local_cores.clear();
-    };
+    while ( pool.task_queue.pop(task) ) {
 
-    while ( task_queue.pop(task) || !task_queue.isFinished() ) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::unordered_map<uint32_t, size_t>& table = tables[task.sample];
+        const bool fresh = table.empty();
+        size_t begin = 0;
 
-        lcp::lps *lcp = new lcp::lps(task.read);
-        lcp->deepen(lcp_level);
-        
-        for ( std::vector<lcp::core*>::iterator it = lcp->cores->begin(); it != lcp->cores->end(); it++ ) {
-            local_cores.push_back( (*it)->label );
-        }
+        for ( std::vector<size_t>::iterator end = task.ends.begin(); end != task.ends.end(); end++ ) {
 
-        delete lcp;
-        lcp = NULL;
+            read.assign( task.bases, begin, *end - begin );
+            begin = *end;
+
+            lcp::lps *lcp = new lcp::lps(read);
+            lcp->deepen(lcp_level);
+            
+            for ( std::vector<lcp::core*>::iterator it = lcp->cores->begin(); it != lcp->cores->end(); it++ ) {
+                if ( hashCore( (*it)->label ) <= threshold ) {
+                    table[(*it)->label]++;
+                }
+            }
 
-        reverseComplement(task.read);
+            delete lcp;
+            lcp = NULL;
 
-        lcp = new lcp::lps(task.read);
-        lcp->deepen(lcp_level);
-        
-        for ( std::vector<lcp::core*>::iterator it = lcp->cores->begin(); it != lcp->cores->end(); it++ ) {
-            local_cores.push_back( (*it)->label );
+            reverseComplement(read);
+
+            lcp = new lcp::lps(read);
+            lcp->deepen(lcp_level);
+            
+            for ( std::vector<lcp::core*>::iterator it = lcp->cores->begin(); it != lcp->cores->end(); it++ ) {
+                if ( hashCore( (*it)->label ) <= threshold ) {
+                    table[(*it)->label]++;
+                }
+            }
+
+            delete lcp;
+        }
+
+        seconds[task.sample] += std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+        if ( fresh && !table.empty() ) {
+            active.push_back( task.sample );
         }
 
-        delete lcp;
+        // return the emptied batch to the pool
+        const size_t sample = task.sample;
+        task.bases.clear();
+        task.ends.clear();
+        pool.free_queue.push( std::move(task) );
 
-        // periodically merge results to the main vector to reduce locking overhead
-        if (local_cores.size() >= MERGE_CORE_THRESHOLD) {
-            merge_results();
+        complete_batch( pool, sample );
+
+        // flush the tables of complete samples and the large ones
+        for ( std::vector<size_t>::iterator it = active.begin(); it != active.end(); ) {
+            if ( pool.complete[*it] || tables[*it].size() >= TABLE_FLUSH_SIZE ) {
+                flush_table( pool, tables[*it], *it );
+                it = active.erase(it);
+            } else {
+                it++;
+            }
         }
     }
 
-    // merge any remaining results after all tasks are processed
-    if (!local_cores.empty()) {
-        merge_results();
+    for ( std::vector<size_t>::iterator it = active.begin(); it != active.end(); it++ ) {
+        flush_table( pool, tables[*it], *it );
+    }
+
+    std::lock_guard<std::mutex> lock(pool.mutex);
+
+    for ( size_t i = 0; i < seconds.size(); i++ ) {
+        pool.stats[i].lcp += seconds[i];
     }
 };
 
 
 /**
- * @brief Processes a genome file to extract LCP cores using multiple threads.
+ * @brief Reads a FASTQ file and feeds its reads to the shared worker pool.
  *
- * This function reads genomic sequences from a specified file and distributes the processing
- * tasks among several worker threads. Each thread computes LCP cores for the sequences at a
- * given LCP level and aggregates these cores into a shared vector. The function tracks the
- * total number of reads processed and their combined length. It ensures efficient and
- * thread-safe handling of genomic data, leveraging parallel processing to enhance performance.
+ * The file is decompressed by a dedicated inflate thread (see `inflate_fastq()`) into
+ * `INFLATE_BUFFER_COUNT` buffers of `INFLATE_BUFFER_SIZE` bytes; BGZF input is additionally
+ * inflated block-parallel by the `read_threads` of the pool. The calling thread parses these
+ * buffers, so reads of any length are supported, and packs the sequences into batches of
+ * `READ_BATCH_SIZE` reads, which are taken from the free batches of the pool and tagged with the
+ * index of the sample. The producer blocks while every batch is queued or being processed, so
+ * memory is bounded. The function tracks the number and the total length of the reads.
  *
- * @param filename Path to the input file containing genomic sequences.
- * @param infile Reference to an open GzFile object for reading the input file.
- * @param lcp_level The depth of LCP analysis for extracting cores from sequences.
- * @param cores A reference to a shared vector where extracted LCP cores are aggregated.
- * @param read_count Reference to a variable that will hold the total number of processed reads.
- * @param total_length Reference to a variable that will hold the combined length of all reads.
- * @param thread_number The number of worker threads to use for processing.
+ * @param thread_arguments A reference to the `targs` structure containing the input file name and
+ *        receiving the total length of the reads.
+ * @param sample The index of the sample in the pool.
+ * @param pool The pool of workers shared by all samples.
+ * @param program_arguments The `pargs` structure containing the program settings.
  */
-void read_fastq( struct targs& thread_arguments, const struct pargs program_arguments ) {
+void read_fastq( struct targs& thread_arguments, size_t sample, struct read_pool& pool, const struct pargs& program_arguments ) {
 
-    GzFile infile( thread_arguments.inFileName.c_str(), "rb" );
+    BgzfFile infile( thread_arguments.inFileName.c_str(), pool.read_threads );
 
-    ThreadSafeQueue<Task> task_queue;
-    std::vector<std::thread> workers;
+    if ( !infile ) {
+        log(ERROR, "Could not be able to open %s", thread_arguments.inFileName.c_str());
+        exit(1);
+    }
 
-    // start worker threads
-    for (size_t i = 0; i < program_arguments.threadNumber; ++i) {
-        workers.emplace_back(process_read, std::ref(task_queue), std::ref(thread_arguments.cores), std::ref(program_arguments.lcpLevel));
+    TaskQueue<Chunk> raw_queue( INFLATE_BUFFER_COUNT );
+    TaskQueue<Chunk> free_chunks( INFLATE_BUFFER_COUNT );
+    struct sample_stats stats = { 0, 0, 0, 0 };
+
+    // fill the pool of raw buffers
+    for (size_t i = 0; i < INFLATE_BUFFER_COUNT; ++i) {
+        Chunk chunk;
+        chunk.data.resize( INFLATE_BUFFER_SIZE );
+        chunk.length = 0;
+        free_chunks.push( std::move(chunk) );
     }
 
+    std::thread inflater( inflate_fastq, std::ref(infile), std::ref(raw_queue), std::ref(free_chunks), std::ref(stats.inflate) );
+
     program_arguments.verbose && std::cout << "Processing is started for " << thread_arguments.inFileName << std::endl;
     
     // variables
-    char buffer[BUFFERSIZE];
-
-    // read file
-    std::string sequence;
-        
-    sequence.reserve(BUFFERSIZE);
-
-    while (true) {
-        if ( infile.gets(buffer) == Z_NULL) {
-            // End of file or an error
-            if ( ! infile.eof() ) {
-                std::cerr << "Error reading file." << std::endl;
+    size_t line_number = 0;
+    size_t read_begin = 0;
+    thread_arguments.size = 0;
+
+    Task task;
+    pool.free_queue.pop(task);
+    task.sample = sample;
+
+    // close the sequence line being appended to the current batch
+    auto end_read = [&]() {
+        while ( task.bases.size() > read_begin && task.bases[task.bases.size() - 1] == '\r' ) {
+            task.bases.resize( task.bases.size() - 1 );
+        }
+
+        task.ends.push_back( task.bases.size() );
+        thread_arguments.size += task.bases.size() - read_begin;
+        stats.reads++;
+
+        // hand over full batch and take an empty one, blocks while all batches are in use
+        if ( task.ends.size() == READ_BATCH_SIZE ) {
+            std::chrono::steady_clock::time_point wait = std::chrono::steady_clock::now();
+            hand_over( task, sample, pool );
+            stats.parse -= std::chrono::duration<double>( std::chrono::steady_clock::now() - wait ).count();
+        }
+
+        read_begin = task.bases.size();
+    };
+
+    // parse the decompressed chunks, every second line of a record is its sequence
+    Chunk chunk;
+
+    while ( raw_queue.pop(chunk) ) {
+        std::chrono::steady_clock::time_point parse_start = std::chrono::steady_clock::now();
+
+        const char* current = chunk.data.data();
+        const char* last = current + chunk.length;
+
+        while ( current < last ) {
+            const char* newline = static_cast<const char*>( memchr(current, '\n', last - current) );
+            const char* line_end = newline ? newline : last;
+
+            // lines may span chunks, so sequences are appended piecewise
+            if ( line_number % 4 == 1 ) {
+                task.bases.append( current, line_end - current );
             }
-            break;
+
+            if ( newline == NULL ) {
+                break;
+            }
+
+            if ( line_number % 4 == 1 ) {
+                end_read();
+            }
+
+            line_number++;
+            current = newline + 1;
         }
 
-        infile.gets(buffer);
-        sequence.append(buffer);
+        stats.parse += std::chrono::duration<double>( std::chrono::steady_clock::now() - parse_start ).count();
+
+        free_chunks.push( std::move(chunk) );
+    }
+
+    // sequence on the last line without a line break
+    if ( line_number % 4 == 1 && task.bases.size() > read_begin ) {
+        end_read();
+    }
+
+    inflater.join();
 
-        while ( !task_queue.isAvailable() );
+    release( task, pool );
+
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.stats[sample].reads += stats.reads;
+    pool.stats[sample].inflate += stats.inflate;
+    pool.stats[sample].parse += stats.parse;
+};
 
-        // assign read to tasks queue
-        Task task;
-        task.read = std::string(buffer);
-        task_queue.push(task);
 
-        infile.gets(buffer);
-        infile.gets(buffer);
+/**
+ * @brief Processes FASTQ or BAM samples concurrently using one pool of worker threads.
+ *
+ * Up to `CONCURRENT_SAMPLES` producer threads take the next sample from the pool and read it with
+ * `read_fastq()` or `read_bam()`, depending on the program mode, until all samples are read. Their
+ * batches of reads are processed by worker threads running `process_read()`, which
+ * are shared by all samples, so that the tail of one sample overlaps with the next one and small
+ * samples do not leave workers idle. Batches are exchanged through a lock-free ring buffer
+ * (`LockFreeQueue`), or through the mutex-based `ThreadSafeQueue` if the program is compiled with
+ * `MUTEX_QUEUE`. Once all workers are done, the runs of each sample are merged into its set of
+ * cores and their counts. In verbose mode, the read throughput and the time spent in inflating,
+ * parsing and computing cores are reported per sample.
+ *
+ * All threads are taken out of `threadNumber`: up to half of them read the samples, i.e. one
+ * producer per four threads, each with its inflater and BGZF threads for FASTQ files, or its region
+ * or htslib threads for BAM files, and the rest run the workers. At least one producer and one
+ * worker are started, so FASTQ samples are processed by three threads if `threadNumber` is below three.
+ *
+ * @param thread_arguments A reference to a vector of `targs` structures, one per sample, receiving
+ *        the distinct LCP cores, their counts and the total length of the reads.
+ * @param program_arguments The `pargs` structure containing the LCP level and the number of
+ *        threads to use for reading and processing.
+ */
+void read_samples( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments ) {
+
+    // producers and their reading threads take up to half of the threads, one producer per four threads
+    const size_t thread_number = std::max( program_arguments.threadNumber, (size_t)1 );
+    const size_t producer_count = std::max( std::min( std::min( thread_arguments.size(), (size_t)CONCURRENT_SAMPLES ), thread_number / 4 ), (size_t)1 );
+    const size_t share = std::max( thread_number / 2 / producer_count, (size_t)1 );
+
+    // a FASTQ producer also runs its inflater, which inflates BGZF blocks itself unless two more threads are left
+    size_t read_threads, reading;
+
+    if ( program_arguments.mode == BAM ) {
+        read_threads = std::min( share, (size_t)BAM_REGION_THREADS );
+        reading = read_threads;
+    } else {
+        read_threads = share >= 4 ? std::min( share - 2, (size_t)FASTQ_BGZF_THREADS ) : 0;
+        reading = 2 + read_threads;
+    }
+
+    const size_t worker_count = thread_number > producer_count * reading ? thread_number - producer_count * reading : 1;
+
+    // every producer, or region thread of a BAM producer, holds one batch while filling it
+    const size_t batch_count = BATCHES_PER_THREAD * worker_count + producer_count * ( program_arguments.mode == BAM ? read_threads : 1 );
+
+    struct read_pool pool( batch_count, thread_arguments.size(), read_threads );
+    std::vector<std::thread> workers;
+    std::vector<std::thread> producers;
+
+    // fill the pool of batches
+    for (size_t i = 0; i < batch_count; ++i) {
+        pool.free_queue.push( Task() );
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // start worker threads
+    for (size_t i = 0; i < worker_count; ++i) {
+        workers.emplace_back(process_read, std::ref(pool), program_arguments.lcpLevel, sketchThreshold( program_arguments.scale ));
     }
 
-    task_queue.markFinished();
+    // start producer threads, each reading samples until none is left
+    for (size_t i = 0; i < producer_count; ++i) {
+        producers.emplace_back([&]() {
+            size_t sample;
+
+            while ( ( sample = pool.next++ ) < thread_arguments.size() ) {
+                if ( program_arguments.mode == BAM ) {
+                    read_bam( thread_arguments[sample], sample, pool, program_arguments );
+                } else {
+                    read_fastq( thread_arguments[sample], sample, pool, program_arguments );
+                }
+
+                // release the hold of the producer on the sample
+                complete_batch( pool, sample );
+            }
+        });
+    }
+
+    for (std::vector<std::thread>::iterator it = producers.begin(); it != producers.end(); it++ ) {
+        if ((*it).joinable()) {
+            (*it).join();
+        }
+    }
+
+    pool.task_queue.markFinished();
 
     // wait for all worker threads to complete
     for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); it++ ) {
@@ -134,5 +425,20 @@ void read_fastq( struct targs& thread_arguments, const struct pargs program_argu
         }
     }
 
-    generateSignature( thread_arguments.cores );
-};
\ No newline at end of file
+    if ( program_arguments.verbose ) {
+        double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+        size_t read_count = 0;
+
+        for ( size_t i = 0; i < thread_arguments.size(); i++ ) {
+            read_count += pool.stats[i].reads;
+            log(INFO, "%s: %zu reads, time spent in inflate: %.2f s, parse: %.2f s, LCP: %.2f s (summed over threads)", thread_arguments[i].inFileName.c_str(), pool.stats[i].reads, pool.stats[i].inflate, pool.stats[i].parse, pool.stats[i].lcp);
+        }
+
+        log(INFO, "Processed %zu reads of %zu samples in %.2f seconds (%.0f reads/s, %zu workers, %zu producers of %zu threads)", read_count, thread_arguments.size(), seconds, read_count / seconds, worker_count, producer_count, reading);
+    }
+
+    // set lcp cores and counts to arguments
+    for ( size_t i = 0; i < thread_arguments.size(); i++ ) {
+        collapseRuns( pool.runs[i], thread_arguments[i].cores, thread_arguments[i].counts );
+    }
+};
@@ -2,27 +2,104 @@
 #define RFASTQ_H
 
 #include <cstdint>
+#include <cstring>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <chrono>
 #include <vector>
+#include <unordered_map>
 #include <iostream>
 #include <string>
 #include "args.h"
 #include "lps.h"
 #include "similarity_metrics.h"
 #include "helper.h"
-#include "utils/GzFile.hpp"
+#include "utils/BgzfFile.hpp"
 #include "utils/ThreadSafeQueue.hpp"
+#include "utils/LockFreeQueue.hpp"
 
-#ifndef MERGE_CORE_THRESHOLD
-#define MERGE_CORE_THRESHOLD 200
+#ifndef READ_BATCH_SIZE
+#define READ_BATCH_SIZE 4096
+#endif
+
+#ifndef BATCHES_PER_THREAD
+#define BATCHES_PER_THREAD 2
+#endif
+
+#ifndef INFLATE_BUFFER_SIZE
+#define INFLATE_BUFFER_SIZE 4194304
+#endif
+
+#ifndef INFLATE_BUFFER_COUNT
+#define INFLATE_BUFFER_COUNT 4
+#endif
+
+// most threads inflating the BGZF blocks of a FASTQ file, taken out of the threads set with -t
+#ifndef FASTQ_BGZF_THREADS
+#define FASTQ_BGZF_THREADS 4
+#endif
+
+// distinct cores of a sample counted by a worker before its table is flushed into a run
+#ifndef TABLE_FLUSH_SIZE
+#define TABLE_FLUSH_SIZE 2097152
+#endif
+
+// most samples read at the same time, their producers are taken out of the threads set with -t
+#ifndef CONCURRENT_SAMPLES
+#define CONCURRENT_SAMPLES 4
+#endif
+
+// batches are exchanged through a lock-free ring buffer unless the mutex queue is requested
+#ifdef MUTEX_QUEUE
+template <typename T> using TaskQueue = ThreadSafeQueue<T>;
+#else
+template <typename T> using TaskQueue = LockFreeQueue<T>;
 #endif
 
 struct Task {
-    std::string read;
+    size_t sample;                  // index of the sample the reads belong to
+    std::string bases;              // sequences of the reads, concatenated
+    std::vector<size_t> ends;       // end offset of each read in bases
 };
 
-void process_read( ThreadSafeQueue<Task>& task_queue, std::vector<uint32_t>& lcp_cores, const int lcp_level );
-void read_fastq( struct targs& arguments, const struct pargs program_arguments );
+struct Chunk {
+    std::string data;               // decompressed bytes, sized to INFLATE_BUFFER_SIZE
+    size_t length;                  // number of valid bytes in data
+};
+
+struct sample_stats {
+    size_t reads;                   // number of reads
+    double inflate;                 // seconds spent decompressing
+    double parse;                   // seconds spent splitting decompressed bytes into reads
+    double lcp;                     // seconds spent computing cores, summed over workers
+};
 
-#endif
\ No newline at end of file
+struct read_pool {
+    TaskQueue<Task> task_queue;                         // batches to be processed, of any sample
+    TaskQueue<Task> free_queue;                         // emptied batches, shared by all producers
+    std::vector<std::vector<struct run>> runs;          // stack of runs of each sample
+    std::vector<struct sample_stats> stats;
+    std::vector<std::atomic<size_t>> pending;           // unprocessed batches of each sample, plus one while it is read
+    std::vector<std::atomic<bool>> complete;            // set once all batches of a sample are processed
+    std::atomic<size_t> next;                           // next sample to be read
+    size_t read_threads;                                // BGZF threads of a FASTQ producer, or reading threads of a BAM producer
+    std::mutex mutex;
+
+    read_pool(size_t batch_count, size_t sample_count, size_t read_threads) : task_queue(batch_count), free_queue(batch_count), runs(sample_count), stats(sample_count), pending(sample_count), complete(sample_count), next(0), read_threads(read_threads) {
+        for ( size_t i = 0; i < sample_count; i++ ) {
+            pending[i] = 1;
+        }
+    }
+};
+
+void inflate_fastq( BgzfFile& infile, TaskQueue<Chunk>& raw_queue, TaskQueue<Chunk>& free_chunks, double& inflate_time );
+void hand_over( Task& task, size_t sample, struct read_pool& pool );
+void release( Task& task, struct read_pool& pool );
+void complete_batch( struct read_pool& pool, size_t sample );
+void flush_table( struct read_pool& pool, std::unordered_map<uint32_t, size_t>& table, size_t sample );
+void process_read( struct read_pool& pool, const int lcp_level, const uint32_t threshold );
+void read_fastq( struct targs& arguments, size_t sample, struct read_pool& pool, const struct pargs& program_arguments );
+void read_samples( std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments );
+
+#endif
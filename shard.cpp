@@ -0,0 +1,289 @@
+#include "shard.h"
+
+
+// tiles of a range in the order of tile_index(), see in_shard()
+static void shard_tiles( size_t numGenomes, size_t first, size_t last, std::vector<struct tile>& tiles ) {
+
+    const size_t rows = ( numGenomes + MATRIX_TILE_SIZE - 1 ) / MATRIX_TILE_SIZE;
+    size_t index = 0;
+
+    for ( size_t row = 0; row < rows && index < last; row++ ) {
+        for ( size_t column = row; column < rows; column++, index++ ) {
+            if ( first <= index && index < last ) {
+                struct tile t = { row * MATRIX_TILE_SIZE, std::min( ( row + 1 ) * MATRIX_TILE_SIZE, numGenomes ), column * MATRIX_TILE_SIZE, std::min( ( column + 1 ) * MATRIX_TILE_SIZE, numGenomes ), 0, 0 };
+
+                for ( size_t i = t.row_begin; i < t.row_end; i++ ) {
+                    t.pairs += t.column_end - std::min( std::max( t.column_begin, i + 1 ), t.column_end );
+                }
+
+                tiles.push_back(t);
+            }
+        }
+    }
+};
+
+
+void plan_shard( const std::vector<size_t>& lengths, struct pargs& program_arguments ) {
+
+    std::vector<size_t> bounds;
+    shard_bounds( lengths, program_arguments.shardCount, bounds );
+
+    program_arguments.shardBegin = bounds[program_arguments.shardIndex - 1];
+    program_arguments.shardEnd = bounds[program_arguments.shardIndex];
+
+    log(INFO, "Shard %zu/%zu computes %zu of %zu tiles, from tile %zu", program_arguments.shardIndex, program_arguments.shardCount, program_arguments.shardEnd - program_arguments.shardBegin, tile_count( lengths.size() ), program_arguments.shardBegin);
+};
+
+
+void save_shard( const std::vector<struct targs>& thread_arguments, const std::vector<uint64_t>& checksums, const struct pargs& program_arguments, const TriangularMatrix& matrix ) {
+
+    const size_t numGenomes = thread_arguments.size();
+    const std::string filename = program_arguments.prefix + "." + std::to_string( program_arguments.shardIndex ) + "-" + std::to_string( program_arguments.shardCount ) + ".shard";
+    const std::string temporary = filename + ".tmp";
+
+    std::vector<struct tile> tiles;
+    shard_tiles( numGenomes, program_arguments.shardBegin, program_arguments.shardEnd, tiles );
+
+    struct shard_header header;
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, SHARD_MAGIC, 4 );
+    header.version = SHARD_VERSION;
+    header.lcp_level = program_arguments.lcpLevel;
+    header.type = program_arguments.type;
+    header.scale = numGenomes == 0 ? 1 : std::max( thread_arguments[0].scale, (size_t)1 );
+    header.genomes = numGenomes;
+    header.shard = program_arguments.shardIndex;
+    header.shards = program_arguments.shardCount;
+    header.tile_size = MATRIX_TILE_SIZE;
+    header.first_tile = program_arguments.shardBegin;
+    header.last_tile = program_arguments.shardEnd;
+
+    std::string names;
+
+    for ( std::vector<struct targs>::const_iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+        names += trimmed_name( it->shortName ) + "\n";
+    }
+
+    header.names_length = names.size();
+
+    for ( std::vector<struct tile>::const_iterator it = tiles.begin(); it != tiles.end(); it++ ) {
+        header.cells += it->pairs;
+    }
+
+    std::ofstream out( temporary, std::ios::binary );
+
+    if ( !out ) {
+        log(ERROR, "Couldn't open %s", temporary.c_str());
+        exit(1);
+    }
+
+    write_section( out, &header, sizeof(header) );
+    write_section( out, names.data(), names.size() );
+    write_section( out, checksums.data(), checksums.size() * sizeof(uint64_t) );
+
+    std::vector<struct similarity> cells;
+
+    for ( std::vector<struct tile>::const_iterator it = tiles.begin(); it != tiles.end(); it++ ) {
+        cells.clear();
+
+        for ( size_t i = it->row_begin; i < it->row_end; i++ ) {
+            for ( size_t j = std::max( it->column_begin, i + 1 ); j < it->column_end; j++ ) {
+                cells.push_back( matrix.get(i, j) );
+            }
+        }
+
+        out.write( reinterpret_cast<const char*>(cells.data()), cells.size() * sizeof(struct similarity) );
+    }
+
+    out.close();
+
+    if ( out.fail() || rename( temporary.c_str(), filename.c_str() ) != 0 ) {
+        log(ERROR, "Failed to write %s", filename.c_str());
+        exit(1);
+    }
+
+    log(INFO, "Shard %zu/%zu with %zu pairs is saved to %s", program_arguments.shardIndex, program_arguments.shardCount, (size_t)header.cells, filename.c_str());
+};
+
+
+// maps a shard file and checks that it is complete
+static MmapFile* open_shard( const std::string& filename, struct shard_header& header ) {
+
+    MmapFile* file = new MmapFile( filename.c_str() );
+
+    if ( !(*file) || file->size() < sizeof(struct shard_header) ) {
+        log(ERROR, "Couldn't open shard %s", filename.c_str());
+        exit(1);
+    }
+
+    memcpy( &header, file->data(), sizeof(struct shard_header) );
+
+    if ( memcmp( header.magic, SHARD_MAGIC, 4 ) != 0 || header.version != SHARD_VERSION || header.shard == 0 || header.shard > header.shards ) {
+        log(ERROR, "Invalid shard file %s", filename.c_str());
+        exit(1);
+    }
+
+    if ( header.tile_size != MATRIX_TILE_SIZE ) {
+        log(ERROR, "Shard %s was computed with tiles of %zu genomes, not %d.", filename.c_str(), (size_t)header.tile_size, MATRIX_TILE_SIZE);
+        exit(1);
+    }
+
+    if ( header.first_tile > header.last_tile || header.last_tile > tile_count( header.genomes ) ) {
+        log(ERROR, "Invalid shard file %s", filename.c_str());
+        exit(1);
+    }
+
+    const size_t bytes = section_size( sizeof(struct shard_header) ) + section_size( header.names_length ) + section_size( header.genomes * sizeof(uint64_t) ) + section_size( header.cells * sizeof(struct similarity) );
+
+    if ( file->size() != bytes ) {
+        log(ERROR, "Shard file %s is truncated.", filename.c_str());
+        exit(1);
+    }
+
+    return file;
+};
+
+
+void merge_shards( const std::vector<struct targs>& shard_arguments, struct pargs& program_arguments ) {
+
+    // the first shard defines the genomes of the matrix
+    struct shard_header first;
+    MmapFile* file = open_shard( shard_arguments[0].inFileName, first );
+
+    const size_t numGenomes = first.genomes;
+    const size_t names_offset = section_size( sizeof(struct shard_header) );
+    const size_t checksums_offset = names_offset + section_size( first.names_length );
+    const size_t cells_offset = checksums_offset + section_size( numGenomes * sizeof(uint64_t) );
+
+    const std::string names( file->data() + names_offset, first.names_length );
+    // genomes a shard has not read have no checksum, it is taken from the other shards
+    std::vector<uint64_t> checksums( numGenomes, 0 );
+
+    delete file;
+
+    std::vector<struct targs> genomes;
+    std::stringstream ss( names );
+    std::string name;
+
+    while ( std::getline( ss, name ) ) {
+        struct targs genome;
+        genome.inFileName = name;
+        genome.scale = first.scale;
+        genome.size = 0;
+
+        // make its size 10
+        if ( name.size() < 10 ) {
+            name.append(10 - name.size(), ' ');
+        }
+        genome.shortName = name;
+
+        genomes.push_back( genome );
+    }
+
+    if ( genomes.size() != numGenomes ) {
+        log(ERROR, "Invalid shard file %s", shard_arguments[0].inFileName.c_str());
+        exit(1);
+    }
+
+    log(INFO, "Merging %zu shards of %zu genomes", shard_arguments.size(), numGenomes);
+
+    TriangularMatrix matrix( numGenomes, ( program_arguments.prefix + ".matrix" ).c_str() );
+
+    if ( !matrix ) {
+        log(ERROR, "Failed to allocate the similarity matrix of %zu genomes", numGenomes);
+        exit(1);
+    }
+
+    std::vector<bool> seen( first.shards + 1, false );
+    std::vector<uint64_t> firsts( first.shards + 1, 0 ), lasts( first.shards + 1, 0 );
+
+    for ( std::vector<struct targs>::const_iterator it = shard_arguments.begin(); it != shard_arguments.end(); it++ ) {
+        struct shard_header header;
+        file = open_shard( it->inFileName, header );
+
+        if ( header.genomes != first.genomes || header.shards != first.shards || header.lcp_level != first.lcp_level || header.type != first.type || header.scale != first.scale ||
+             header.names_length != first.names_length || memcmp( file->data() + names_offset, names.data(), names.size() ) != 0 ) {
+            log(ERROR, "Shard %s was computed from other genomes or settings than %s", it->inFileName.c_str(), shard_arguments[0].inFileName.c_str());
+            exit(1);
+        }
+
+        const uint64_t* shard_checksums = reinterpret_cast<const uint64_t*>( file->data() + checksums_offset );
+
+        for ( size_t g = 0; g < numGenomes; g++ ) {
+            if ( shard_checksums[g] != 0 && checksums[g] != 0 && shard_checksums[g] != checksums[g] ) {
+                log(ERROR, "Shard %s was computed from other genomes or settings than %s", it->inFileName.c_str(), shard_arguments[0].inFileName.c_str());
+                exit(1);
+            }
+            if ( checksums[g] == 0 ) {
+                checksums[g] = shard_checksums[g];
+            }
+        }
+
+        if ( seen[header.shard] ) {
+            log(ERROR, "Shard %zu/%zu is given twice.", (size_t)header.shard, (size_t)header.shards);
+            exit(1);
+        }
+        seen[header.shard] = true;
+        firsts[header.shard] = header.first_tile;
+        lasts[header.shard] = header.last_tile;
+
+        std::vector<struct tile> tiles;
+        shard_tiles( numGenomes, header.first_tile, header.last_tile, tiles );
+
+        size_t pairs = 0;
+
+        for ( std::vector<struct tile>::const_iterator t = tiles.begin(); t != tiles.end(); t++ ) {
+            pairs += t->pairs;
+        }
+
+        if ( pairs != header.cells ) {
+            log(ERROR, "Invalid shard file %s", it->inFileName.c_str());
+            exit(1);
+        }
+
+        const struct similarity* cells = reinterpret_cast<const struct similarity*>( file->data() + cells_offset );
+
+        for ( std::vector<struct tile>::const_iterator t = tiles.begin(); t != tiles.end(); t++ ) {
+            for ( size_t i = t->row_begin; i < t->row_end; i++ ) {
+                for ( size_t j = std::max( t->column_begin, i + 1 ); j < t->column_end; j++ ) {
+                    matrix.at(i, j) = *(cells++);
+                }
+            }
+        }
+
+        delete file;
+    }
+
+    std::string missing;
+
+    for ( size_t i = 1; i < seen.size(); i++ ) {
+        if ( !seen[i] ) {
+            missing += ( missing.empty() ? "" : "," ) + std::to_string(i);
+        }
+    }
+
+    if ( !missing.empty() ) {
+        log(ERROR, "Missing shards of %zu: %s", (size_t)first.shards, missing.c_str());
+        exit(1);
+    }
+
+    // the ranges depend on the sizes of the genomes the shards were run on
+    for ( size_t i = 1; i < seen.size(); i++ ) {
+        if ( firsts[i] != ( i == 1 ? 0 : lasts[i - 1] ) || ( i + 1 == seen.size() && lasts[i] != tile_count( numGenomes ) ) ) {
+            log(ERROR, "The tiles of shard %zu/%zu do not follow those of the previous shard, the shards were run on different files.", i, (size_t)first.shards);
+            exit(1);
+        }
+    }
+
+    // the outputs are written as by a single run
+    program_arguments.lcpLevel = first.lcp_level;
+    program_arguments.type = first.type == SET ? SET : VECTOR;
+
+    log(INFO, "Writing distance matrices to files...");
+
+    write_matrices( genomes, program_arguments, matrix );
+
+    if ( program_arguments.writeState ) {
+        save_state( genomes, checksums, program_arguments, matrix );
+    }
+};
@@ -0,0 +1,90 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "args.h"
+#include "logging.h"
+#include "fileio.h"
+#include "matrix.h"
+#include "wmatrix.h"
+#include "state.h"
+#include "utils/MmapFile.hpp"
+#include "utils/TriangularMatrix.hpp"
+
+// magic number and version of shard files
+#define SHARD_MAGIC "GCSH"
+#define SHARD_VERSION 2
+
+
+struct shard_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t lcp_level;     // LCP level of the core labels
+    uint32_t type;          // calculation mode, see `data_type`
+    uint64_t scale;         // scale of the sketches, 1 for all cores
+    uint64_t genomes;       // number of genomes of the whole matrix
+    uint64_t shard;         // number of the shard, from 1
+    uint64_t shards;        // number of shards
+    uint64_t tile_size;     // `MATRIX_TILE_SIZE` of the tile grid
+    uint64_t first_tile;    // first tile of the shard, see `tile_index()`
+    uint64_t last_tile;     // tile after the last tile of the shard
+    uint64_t names_length;  // bytes of the newline-terminated genome names
+    uint64_t cells;         // number of cells of the shard
+};
+
+
+/**
+ * @brief Sets the range of tiles of the shard set with `--shard`.
+ *
+ * The tiles are split by `shard_bounds()` into ranges of about the same cost, and the range of the 
+ * shard is stored in `shardBegin` and `shardEnd`. The ranges only follow each other if all shards of 
+ * a matrix are run on the same files; `merge` checks it with the ranges stored in the shard files.
+ *
+ * @param lengths A constant reference to the number of cores of every genome, or to any estimate of 
+ *        it in a unit common to all genomes.
+ * @param program_arguments A reference to the `pargs` structure.
+ */
+void plan_shard( const std::vector<size_t>& lengths, struct pargs& program_arguments );
+
+/**
+ * @brief Writes the cells computed by the shard set with `--shard` to `<prefix>.<i>-<n>.shard`.
+ *
+ * The shard file consists of 8-byte aligned sections: the `shard_header`, with the range of tiles of 
+ * the shard, the short names and the signature checksums of all genomes, 0 for the genomes the shard 
+ * has not read, and the cells of the tiles of the shard, tile by tile in the
+ * order of `tile_index()` and row by row within a tile, see `write_section()`. The file is written
+ * next to its destination and renamed, so a shard file is either complete or missing, and a failed
+ * shard can simply be run again.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param checksums A constant reference to the signature checksums of the genomes.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param matrix A constant reference to the matrix of similarities, whose cells of the shard are computed; 
+ *        only the rows of the tiles of the shard need to be allocated.
+ */
+void save_shard( const std::vector<struct targs>& thread_arguments, const std::vector<uint64_t>& checksums, const struct pargs& program_arguments, const TriangularMatrix& matrix );
+
+/**
+ * @brief Assembles the shard files of the `merge` command and writes the distance matrices.
+ *
+ * The shards must have been computed from the same genomes, by checksum, with the same LCP level,
+ * scale, calculation mode and number of shards, and every shard must be given exactly once. The 
+ * ranges of tiles of the shards must follow each other and cover the whole matrix. The
+ * matrices are written by `write_matrices()` in the format set with `--format`, and the state of the
+ * matrix is saved with `--state`.
+ *
+ * @param shard_arguments A constant reference to the vector of `targs` structures whose input file
+ *        names are the shard files.
+ * @param program_arguments A reference to the `pargs` structure, its LCP level and calculation mode
+ *        are set to those of the shards.
+ */
+void merge_shards( const std::vector<struct targs>& shard_arguments, struct pargs& program_arguments );
+
+#endif
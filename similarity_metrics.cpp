@@ -1,131 +1,251 @@
 #include "similarity_metrics.h"
 
+#if !defined(SCALAR_INTERSECTION) && defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) ) && defined(__SSE2__)
+#define SIMD_INTERSECTION
+#include <immintrin.h>
+#endif
 
-void calculateIntersectionAndUnionSizes( const struct targs& argument1, const struct targs& argument2, const struct pargs& program_arguments, size_t& interSize, size_t& unionSize ) {
 
-    std::vector<uint32_t>::const_iterator core1 = argument1.cores.begin(), core2 = argument2.cores.begin();
-    std::vector<size_t>::const_iterator count1 = argument1.counts.begin(), count2 = argument2.counts.begin();
-    interSize = 0;
-    unionSize = 0;
+// merges the remaining elements one at a time
+static size_t intersectScalar( const uint32_t* set1, size_t size1, const uint32_t* set2, size_t size2, size_t& i, size_t& j, size_t* matches1, size_t* matches2, size_t capacity ) {
+    size_t count = 0;
 
-    while ( core1 != argument1.cores.end() && core2 != argument2.cores.end() ) {
-        if ( *core1 < *core2 ) {
-            core1++;
-            count1++;
-        } else if ( *core1 > *core2 ) {
-            core2++;
-            count2++;
+    while ( i < size1 && j < size2 && count < capacity ) {
+        if ( set1[i] < set2[j] ) {
+            i++;
+        } else if ( set1[i] > set2[j] ) {
+            j++;
         } else {
-            if ( program_arguments.type == SET ) {
-                interSize++;
-            } else {
-                interSize += std::min(*count1, *count2);
-            }
-            core1++;
-            count1++;
-            core2++;
-            count2++;
+            matches1[count] = i++;
+            matches2[count] = j++;
+            count++;
         }
+    }
 
-        if ( program_arguments.type == SET ) {
-            unionSize++;
-        } else {
-            unionSize += std::max(*count1, *count2);
+    return count;
+};
+
+
+// locates each element of the smaller set in the larger one, doubling the step until it is passed
+static size_t intersectGalloping( const uint32_t* small, size_t small_size, const uint32_t* large, size_t large_size, size_t& i, size_t& j, size_t* small_matches, size_t* large_matches, size_t capacity ) {
+    size_t count = 0;
+
+    while ( i < small_size && j < large_size && count < capacity ) {
+        const uint32_t value = small[i];
+        size_t step = 1;
+
+        while ( j + step < large_size && large[j + step] < value ) {
+            step <<= 1;
         }
-    }
 
-    // count the remaining elements in either vector
-    if ( program_arguments.type == SET ) {
-        if( count1 != argument1.counts.end() ) {
-            unionSize += argument1.counts.end() - count1;
+        j = std::lower_bound( large + j + ( step >> 1 ), large + std::min( j + step + 1, large_size ), value ) - large;
+
+        if ( j < large_size && large[j] == value ) {
+            small_matches[count] = i;
+            large_matches[count] = j;
+            count++;
+            j++;
         }
-        else if( count2 != argument2.counts.end() ) {
-            unionSize += argument2.counts.end() - count2;
+
+        i++;
+    }
+
+    return count;
+};
+
+
+#ifdef SIMD_INTERSECTION
+
+// pairs the matched lanes of two blocks; both blocks are sorted, so the k-th matched lane of the 
+// first block holds the same element as the k-th matched lane of the second block
+static inline size_t emitMatches( int lanes1, int lanes2, size_t i, size_t j, size_t* matches1, size_t* matches2 ) {
+    size_t count = 0;
+
+    while ( lanes1 ) {
+        matches1[count] = i + __builtin_ctz( lanes1 );
+        matches2[count] = j + __builtin_ctz( lanes2 );
+        count++;
+        lanes1 &= lanes1 - 1;
+        lanes2 &= lanes2 - 1;
+    }
+
+    return count;
+};
+
+
+// compares blocks of 4 elements of both sets with all 4 rotations of the second block
+static size_t intersectSSE2( const uint32_t* set1, size_t size1, const uint32_t* set2, size_t size2, size_t& i, size_t& j, size_t* matches1, size_t* matches2, size_t capacity ) {
+    size_t count = 0;
+
+    while ( i + 4 <= size1 && j + 4 <= size2 && count + 4 <= capacity ) {
+        const __m128i block1 = _mm_loadu_si128( reinterpret_cast<const __m128i*>(set1 + i) );
+        const __m128i block2 = _mm_loadu_si128( reinterpret_cast<const __m128i*>(set2 + j) );
+
+        // lane l of rotation k holds element (l + k) % 4 of the second block
+        const int mask0 = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( block1, block2 ) ) );
+        const int mask1 = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( block1, _mm_shuffle_epi32( block2, _MM_SHUFFLE(0, 3, 2, 1) ) ) ) );
+        const int mask2 = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( block1, _mm_shuffle_epi32( block2, _MM_SHUFFLE(1, 0, 3, 2) ) ) ) );
+        const int mask3 = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( block1, _mm_shuffle_epi32( block2, _MM_SHUFFLE(2, 1, 0, 3) ) ) ) );
+
+        const int lanes1 = mask0 | mask1 | mask2 | mask3;
+
+        if ( lanes1 ) {
+            // rotate the masks back to the lanes of the second block
+            const int lanes2 = ( mask0 | ( mask1 << 1 ) | ( mask2 << 2 ) | ( mask3 << 3 ) | ( mask1 >> 3 ) | ( mask2 >> 2 ) | ( mask3 >> 1 ) ) & 0xF;
+            count += emitMatches( lanes1, lanes2, i, j, matches1 + count, matches2 + count );
         }
-    } else {
-        while ( count1 != argument1.counts.end() ) {
-            unionSize += *count1;
-            count1++;
+
+        // advance the block that ends first, or both
+        const uint32_t last1 = set1[i + 3], last2 = set2[j + 3];
+        i += ( last1 <= last2 ) << 2;
+        j += ( last2 <= last1 ) << 2;
+    }
+
+    return count;
+};
+
+
+// compares blocks of 8 elements of both sets with all 8 rotations of the second block
+__attribute__((target("avx2")))
+static size_t intersectAVX2( const uint32_t* set1, size_t size1, const uint32_t* set2, size_t size2, size_t& i, size_t& j, size_t* matches1, size_t* matches2, size_t capacity ) {
+    size_t count = 0;
+
+    const __m256i rotate1 = _mm256_setr_epi32( 1, 2, 3, 4, 5, 6, 7, 0 );
+    const __m256i rotate2 = _mm256_setr_epi32( 2, 3, 4, 5, 6, 7, 0, 1 );
+    const __m256i rotate3 = _mm256_setr_epi32( 3, 4, 5, 6, 7, 0, 1, 2 );
+
+    while ( i + 8 <= size1 && j + 8 <= size2 && count + 8 <= capacity ) {
+        const __m256i block1 = _mm256_loadu_si256( reinterpret_cast<const __m256i*>(set1 + i) );
+        const __m256i block2 = _mm256_loadu_si256( reinterpret_cast<const __m256i*>(set2 + j) );
+
+        // lane l of rotation k holds element (l + k) % 8 of the second block, rotations by 4 or more 
+        // are obtained by swapping the halves of the first four
+        const __m256i rotated1 = _mm256_permutevar8x32_epi32( block2, rotate1 );
+        const __m256i rotated2 = _mm256_permutevar8x32_epi32( block2, rotate2 );
+        const __m256i rotated3 = _mm256_permutevar8x32_epi32( block2, rotate3 );
+
+        int masks[8];
+        masks[0] = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( block1, block2 ) ) );
+        masks[1] = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( block1, rotated1 ) ) );
+        masks[2] = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( block1, rotated2 ) ) );
+        masks[3] = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( block1, rotated3 ) ) );
+        masks[4] = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( block1, _mm256_permute2x128_si256( block2, block2, 1 ) ) ) );
+        masks[5] = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( block1, _mm256_permute2x128_si256( rotated1, rotated1, 1 ) ) ) );
+        masks[6] = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( block1, _mm256_permute2x128_si256( rotated2, rotated2, 1 ) ) ) );
+        masks[7] = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( block1, _mm256_permute2x128_si256( rotated3, rotated3, 1 ) ) ) );
+
+        const int lanes1 = masks[0] | masks[1] | masks[2] | masks[3] | masks[4] | masks[5] | masks[6] | masks[7];
+
+        if ( lanes1 ) {
+            // rotate the masks back to the lanes of the second block
+            int lanes2 = masks[0];
+            for ( int rotation = 1; rotation < 8; rotation++ ) {
+                lanes2 |= ( masks[rotation] << rotation ) | ( masks[rotation] >> ( 8 - rotation ) );
+            }
+            count += emitMatches( lanes1, lanes2 & 0xFF, i, j, matches1 + count, matches2 + count );
         }
-        while ( count2 != argument2.counts.end() ) {
-            unionSize += *count2;
-            count2++;
+
+        // advance the block that ends first, or both
+        const uint32_t last1 = set1[i + 7], last2 = set2[j + 7];
+        i += ( last1 <= last2 ) << 3;
+        j += ( last2 <= last1 ) << 3;
+    }
+
+    return count;
+};
+
+#endif
+
+
+size_t intersectSorted( const uint32_t* set1, size_t size1, const uint32_t* set2, size_t size2, struct intersection_cursor& cursor, size_t* matches1, size_t* matches2, size_t capacity ) {
+
+    size_t& i = cursor.position1;
+    size_t& j = cursor.position2;
+
+    // skewed sizes, most of the larger set is skipped
+    if ( size2 > size1 * GALLOP_RATIO ) {
+        return intersectGalloping( set1, size1, set2, size2, i, j, matches1, matches2, capacity );
+    }
+    if ( size1 > size2 * GALLOP_RATIO ) {
+        return intersectGalloping( set2, size2, set1, size1, j, i, matches2, matches1, capacity );
+    }
+
+    size_t count = 0;
+
+#ifdef SIMD_INTERSECTION
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+
+    if ( !cursor.dense ) {
+        const size_t start1 = i, start2 = j;
+
+        if ( avx2 ) {
+            count += intersectAVX2( set1, size1, set2, size2, i, j, matches1, matches2, capacity );
         }
+        count += intersectSSE2( set1, size1, set2, size2, i, j, matches1 + count, matches2 + count, capacity - count );
+
+        // most elements of the side advancing slower are shared, and its runs in the other side are 
+        // short enough for the scalar merge
+        cursor.dense = count * 100 > std::min( i - start1, j - start2 ) * DENSE_MATCH_PERCENT && std::max( size1, size2 ) <= std::min( size1, size2 ) * ( GALLOP_RATIO / 2 );
+    }
+#endif
+
+    // stop at a full buffer, the blocks are resumed by the next call
+    if ( count + 8 > capacity && i < size1 && j < size2 ) {
+        return count;
     }
+
+    return count + intersectScalar( set1, size1, set2, size2, i, j, matches1 + count, matches2 + count, capacity - count );
 };
 
 
-double calculateJaccardSimilarity( size_t interSize, size_t unionSize ) {
-    return static_cast<double>(interSize) / static_cast<double>(unionSize);
+void compareCores( const struct targs& argument1, const struct targs& argument2, const size_t total1, const size_t total2, const struct pargs& program_arguments, struct comparison& result ) {
+    if ( program_arguments.type == SET ) {
+        compareCores<SET>( argument1, argument2, total1, total2, result );
+    } else {
+        compareCores<VECTOR>( argument1, argument2, total1, total2, result );
+    }
 };
 
 
-double calculateDiceSimilarity( const size_t interSize, const struct targs& argument1, const struct targs& argument2, const struct pargs& program_arguments ) {
+size_t calculateCountTotal( const struct targs& argument ) {
+
+    size_t total = 0;
+
+    for ( std::vector<size_t>::const_iterator count = argument.counts.begin(); count != argument.counts.end(); count++ ) {
+        total += (*count);
+    }
+
+    return total;
+};
+
+
+double calculateTotalSize( const struct targs& argument, const struct pargs& program_arguments ) {
     
-    double size1 = 0, size2 = 0;
+    double size = 0;
 
     if ( program_arguments.type == SET ) {
-        size1 += argument1.cores.size();
-        size2 += argument2.cores.size();
+        size += argument.cores.size();
     } else {
-        
-        std::vector<size_t>::const_iterator count1 = argument1.counts.begin(), count2 = argument2.counts.begin();
-        while ( count1 != argument1.counts.end() ) {
-            size1 += (*count1);
-            count1++;
-        }
-        while ( count2 != argument2.counts.end() ) {
-            size2 += (*count2);
-            count2++;
+        for ( std::vector<size_t>::const_iterator count = argument.counts.begin(); count != argument.counts.end(); count++ ) {
+            size += (*count);
         }
-        
     }
-    
-    return 2 * static_cast<double>(interSize) / ( size1 + size2 );
+
+    return size;
 };
 
 
-double calculateNormalizedVectorSimilarity( const struct targs& argument1, const struct targs& argument2 ) {
-    
-    std::vector<uint32_t>::const_iterator core1 = argument1.cores.begin(), core2 = argument2.cores.begin();
-    std::vector<size_t>::const_iterator count1 = argument1.counts.begin(), count2 = argument2.counts.begin();
-    
-    double numerator = 0.0, denominator = 0.0;
-    double depth1 = 1, depth2 = static_cast<double>(argument2.size) / static_cast<double>(argument1.size);
-    
-    while ( core1 != argument1.cores.end() && core2 != argument2.cores.end() ) {
-        if ( *core1 < *core2 ) {
-            numerator += (*count1) * depth2;
-            denominator += (*count1) * depth2;
-            core1++;
-            count1++;
-        } else if ( *core1 > *core2 ) {
-            numerator += (*count2) * depth1;
-            denominator += (*count2) * depth1;
-            core2++;
-            count2++;
-        } else {
-            numerator += abs((*count1) * depth2 - (*count2) * depth1);
-            denominator += ((*count1) * depth2 + (*count2) * depth1);
-            core1++;
-            count1++;
-            core2++;
-            count2++;
-        }
-    }
+double calculateJaccardSimilarity( size_t interSize, size_t unionSize ) {
+    return static_cast<double>(interSize) / static_cast<double>(unionSize);
+};
 
-    while( count1 < argument1.counts.end() ) {
-        numerator += (*count1) * depth2;
-        denominator += (*count1) * depth2;
-        count1++;
-    }
 
-    while( count2 < argument2.counts.end() ) {
-        numerator += (*count2) * depth1;
-        denominator += (*count2) * depth1;
-        count2++;
-    }
+double calculateDiceSimilarity( const size_t interSize, const double size1, const double size2 ) {
+    return 2 * static_cast<double>(interSize) / ( size1 + size2 );
+};
 
+
+double calculateNormalizedVectorSimilarity( const double numerator, const double denominator ) {
     // check for division by zero before returning the result
     return denominator != 0.0 ? 1 - numerator / denominator : 0.0;
-};
\ No newline at end of file
+};
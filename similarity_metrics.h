@@ -5,44 +5,179 @@
 #include <vector>
 #include <iterator>
 #include <algorithm>
+#include <cmath>
 #include "logging.h"
 #include "args.h"
 
 
+#ifndef GALLOP_RATIO
+#define GALLOP_RATIO 32
+#endif
+
+// above this many matches per 100 elements of the side advancing slower, the scalar merge is faster
+#ifndef DENSE_MATCH_PERCENT
+#define DENSE_MATCH_PERCENT 80
+#endif
+
+#ifndef INTERSECTION_BUFFER_SIZE
+#define INTERSECTION_BUFFER_SIZE 1024
+#endif
+
+
+struct comparison {
+    size_t interSize;       // size of the intersection of the core multisets, or sets
+    size_t unionSize;       // size of the union of the core multisets, or sets
+    double numerator;       // depth-weighted Manhattan distance of the count vectors
+    double denominator;     // depth-weighted sum of the count vectors
+};
+
+struct intersection_cursor {
+    size_t position1;       // next element of the first set
+    size_t position2;       // next element of the second set
+    bool dense;             // set once the matches are too dense for the blocks
+};
+
+
+/**
+ * @brief Finds the common elements of two sorted sets, writing their index pairs to a buffer.
+ * 
+ * The sets must be sorted in ascending order and free of duplicates, as the `cores` of a genome. 
+ * The search starts at the positions of the cursor and stops when either set is exhausted, or when 
+ * the buffer cannot hold another block of matches; the cursor is advanced, so that the search can 
+ * be resumed by calling the function again until one of its positions reaches the end of its set. 
+ * The matches are written in ascending order.
+ * 
+ * If one set is more than `GALLOP_RATIO` times larger than the other, each element of the smaller 
+ * set is located in the larger one by galloping (exponential) search, which skips most of the larger 
+ * set. Otherwise, blocks of 8 (AVX2, if the processor supports it) or 4 (SSE2) elements of both sets 
+ * are compared all-against-all, and the block with the smaller last element is advanced, which 
+ * avoids the data-dependent branch of a scalar merge. If more than `DENSE_MATCH_PERCENT` percent 
+ * of the elements of the side advancing slower match, the branches of the scalar merge become 
+ * predictable while every match costs the blocks a scan of their masks; unless one set is more 
+ * than half of `GALLOP_RATIO` times larger, the cursor is then marked `dense` and the following 
+ * calls use the scalar merge only. The remaining 
+ * elements are merged with a scalar loop, which is used throughout on other architectures or if the 
+ * program is compiled with `SCALAR_INTERSECTION`. See `bench/intersect_bench.cpp` for the measured 
+ * crossovers.
+ * 
+ * @param set1 A pointer to the first sorted set.
+ * @param size1 The number of elements in the first set.
+ * @param set2 A pointer to the second sorted set.
+ * @param size2 The number of elements in the second set.
+ * @param cursor A reference to the positions in both sets, advanced by the call.
+ * @param matches1 A buffer that will receive the indices of the common elements in the first set.
+ * @param matches2 A buffer that will receive the indices of the common elements in the second set.
+ * @param capacity The number of elements the buffers can hold, at least 8.
+ * @return The number of index pairs written to the buffers.
+ */
+size_t intersectSorted( const uint32_t* set1, size_t size1, const uint32_t* set2, size_t size2, struct intersection_cursor& cursor, size_t* matches1, size_t* matches2, size_t capacity );
+
+/**
+ * @brief Compares the LCP cores of two genomes in a single pass over their common cores.
+ * 
+ * The common cores are found by `intersectSorted()`, and only their counts are visited; once the 
+ * cursor is marked `dense`, the rest is merged in the same loop as the counts. Everything 
+ * that depends on the other cores is derived from per-genome totals, which are calculated once per 
+ * genome instead of once per pair:
+ * - In `SET` mode, every distinct core counts once towards the intersection and union sizes.
+ * - In `VECTOR` mode, a shared core adds the minimum of its counts to the intersection size, and 
+ *   the union size is the sum of the totals of both genomes minus the intersection size.
+ * - The normalized vector similarity always considers the counts, scaled by the relative sequencing 
+ *   depths of the genomes. Its denominator is the depth-weighted sum of both totals, and each shared 
+ *   core reduces its numerator by twice the smaller of its weighted counts.
+ * 
+ * The calculation mode is a template parameter, so the inner loop does not branch on it.
+ * 
+ * @tparam TYPE The calculation mode, `SET` or `VECTOR`.
+ * @param argument1 A constant reference to the `targs` structure of the first genome.
+ * @param argument2 A constant reference to the `targs` structure of the second genome.
+ * @param total1 The sum of the counts of the first genome, see `calculateCountTotal()`.
+ * @param total2 The sum of the counts of the second genome, see `calculateCountTotal()`.
+ * @param result A reference to the structure that will hold the results of the comparison.
+ */
+template <data_type TYPE>
+void compareCores( const struct targs& argument1, const struct targs& argument2, const size_t total1, const size_t total2, struct comparison& result ) {
+
+    size_t matches1[INTERSECTION_BUFFER_SIZE], matches2[INTERSECTION_BUFFER_SIZE];
+    struct intersection_cursor cursor = { 0, 0, false };
+
+    const size_t size1 = argument1.cores.size(), size2 = argument2.cores.size();
+    const double depth1 = 1, depth2 = static_cast<double>(argument2.size) / static_cast<double>(argument1.size);
+
+    size_t interSize = 0;
+    double shared = 0.0;
+
+    while ( cursor.position1 < size1 && cursor.position2 < size2 ) {
+        // most cores are shared, the buffer would only add a pass over the matches
+        if ( cursor.dense ) {
+            size_t i = cursor.position1, j = cursor.position2;
+
+            while ( i < size1 && j < size2 ) {
+                if ( argument1.cores[i] < argument2.cores[j] ) {
+                    i++;
+                } else if ( argument1.cores[i] > argument2.cores[j] ) {
+                    j++;
+                } else {
+                    const size_t count1 = argument1.counts[i++], count2 = argument2.counts[j++];
+
+                    interSize += TYPE == SET ? 1 : std::min(count1, count2);
+                    shared += 2 * std::min(count1 * depth2, count2 * depth1);
+                }
+            }
+            break;
+        }
+
+        size_t count = intersectSorted( argument1.cores.data(), size1, argument2.cores.data(), size2, cursor, matches1, matches2, INTERSECTION_BUFFER_SIZE );
+
+        for ( size_t k = 0; k < count; k++ ) {
+            const size_t count1 = argument1.counts[matches1[k]], count2 = argument2.counts[matches2[k]];
+
+            interSize += TYPE == SET ? 1 : std::min(count1, count2);
+            shared += 2 * std::min(count1 * depth2, count2 * depth1);
+        }
+    }
+
+    result.interSize = interSize;
+    result.unionSize = ( TYPE == SET ? size1 + size2 : total1 + total2 ) - interSize;
+    result.denominator = total1 * depth2 + total2 * depth1;
+    result.numerator = result.denominator - shared;
+};
+
 /**
- * @brief Calculates the intersection and union sizes of LCP core sets from two thread arguments.
+ * @brief Compares the LCP cores of two genomes in the calculation mode of the program.
  * 
- * This function computes the intersection and union sizes between the `cores` and `counts` vectors 
- * in two thread-specific argument structures (`argument1` and `argument2`). It performs the calculations 
- * based on whether the program is operating in a set-based mode or a vector-based mode, as specified 
- * by the `program_arguments.type`.
+ * Dispatches to the `compareCores()` kernel of the mode given in `program_arguments.type`, once 
+ * per pair of genomes.
  * 
- * @param argument1 A constant reference to the `targs` structure representing the first set of LCP cores 
- *        and counts for comparison.
- * @param argument2 A constant reference to the `targs` structure representing the second set of LCP cores 
- *        and counts for comparison.
+ * @param argument1 A constant reference to the `targs` structure of the first genome.
+ * @param argument2 A constant reference to the `targs` structure of the second genome.
+ * @param total1 The sum of the counts of the first genome.
+ * @param total2 The sum of the counts of the second genome.
  * @param program_arguments A constant reference to the `pargs` structure, which contains program-wide settings, 
  *        including the type of operation (set-based or vector-based).
- * @param interSize A reference to the variable where the computed size of the intersection will be stored.
- * @param unionSize A reference to the variable where the computed size of the union will be stored.
+ * @param result A reference to the structure that will hold the results of the comparison.
+ */
+void compareCores( const struct targs& argument1, const struct targs& argument2, const size_t total1, const size_t total2, const struct pargs& program_arguments, struct comparison& result );
+
+/**
+ * @brief Calculates the sum of the counts of the cores of a genome.
  * 
- * @details
- * - The function uses two iterators (`core1` and `core2`) to traverse the `cores` vectors of `argument1` 
- *   and `argument2` respectively, and similarly uses `count1` and `count2` for the corresponding `counts` vectors.
- * - If the LCP core in `argument1` is smaller than the core in `argument2`, the iterator for `argument1` advances, 
- *   and vice versa. When the cores match, the intersection size is updated, depending on the program type:
- *   - If `SET` mode is enabled, the intersection size is incremented by one.
- *   - If `VECTOR` mode is enabled, the intersection size is incremented by the minimum of the counts.
- * - The union size is calculated similarly, incrementing based on the maximum count when in `VECTOR` mode.
- * - After one vector is exhausted, any remaining elements in the other vector are added to the union size.
+ * @param argument A constant reference to the `targs` structure of the genome.
+ * @return The sum of the counts of all cores.
+ */
+size_t calculateCountTotal( const struct targs& argument );
+
+/**
+ * @brief Calculates the size of the core set, or multiset, of a genome.
+ * 
+ * This is the per-genome term of the Dice similarity; it should be calculated once per genome, 
+ * not once per pair.
  * 
- * @note
- * - In `SET` mode, the function treats the `cores` vectors as sets and only counts unique cores for the 
- *   intersection and union.
- * - In `VECTOR` mode, the `counts` vectors are considered, and the union and intersection sizes are determined 
- *   by comparing the counts associated with each core.
+ * @param argument A constant reference to the `targs` structure of the genome.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @return The number of distinct cores in `SET` mode, or the sum of their counts in `VECTOR` mode.
  */
-void calculateIntersectionAndUnionSizes( const struct targs& argument1, const struct targs& argument2, const struct pargs& program_arguments, size_t& interSize, size_t& unionSize );
+double calculateTotalSize( const struct targs& argument, const struct pargs& program_arguments );
 
 /**
  * @brief Calculates the Jaccard similarity between two genomes.
@@ -65,32 +200,24 @@ double calculateJaccardSimilarity( size_t interSize, size_t unionSize );
  * of similarity focusing on shared genomic features.
  *
  * @param interSize The size of the intersection between the two sets of cores.
- * @param argument1 A constant reference to the `targs` structure representing the first set of LCP cores 
- *        and counts for comparison.
- * @param argument2 A constant reference to the `targs` structure representing the second set of LCP cores 
- *        and counts for comparison.
- * @param program_arguments A constant reference to the `pargs` structure, which contains program-wide settings, 
- *        including the type of operation (set-based or vector-based).
+ * @param size1 The size of the first set of cores, see `calculateTotalSize()`.
+ * @param size2 The size of the second set of cores, see `calculateTotalSize()`.
  * @return The Dice similarity coefficient as a double.
  */
-double calculateDiceSimilarity( const size_t interSize, const struct targs& argument1, const struct targs& argument2, const struct pargs& program_arguments );
+double calculateDiceSimilarity( const size_t interSize, const double size1, const double size2 );
 
 /**
  * @brief Calculates a similarity score between two sets of hashed LCP cores.
  *
- * This function compares two sets of hashed LCP cores, representing genomic sequences
- * analyzed at specified depths, to compute a similarity score. The score is based on
- * the normalized Manhattan distance between the weighted counts of matching LCP cores,
- * adjusted to reflect similarity. This approach considers both the presence and abundance
- * of LCP cores in relation to the analysis depths, offering a nuanced similarity measure
- * suitable for genomic comparisons.
+ * The score is based on the normalized Manhattan distance between the weighted counts of 
+ * matching LCP cores, adjusted to reflect similarity. This approach considers both the presence 
+ * and abundance of LCP cores in relation to the analysis depths, offering a nuanced similarity 
+ * measure suitable for genomic comparisons. Its terms are computed by `compareCores()`.
  *
- * @param argument1 A constant reference to the `targs` structure representing the first set of LCP cores 
- *        and counts for comparison.
- * @param argument2 A constant reference to the `targs` structure representing the second set of LCP cores 
- *        and counts for comparison.
+ * @param numerator The depth-weighted Manhattan distance of the count vectors.
+ * @param denominator The depth-weighted sum of the count vectors.
  * @return A double representing the similarity score, ranging from 0 (no similarity) to 1 (identical).
  */
-double calculateNormalizedVectorSimilarity(  const struct targs& argument1, const struct targs& argument2 );
+double calculateNormalizedVectorSimilarity( const double numerator, const double denominator );
 
 #endif
\ No newline at end of file
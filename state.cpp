@@ -0,0 +1,213 @@
+#include "state.h"
+
+
+// finalizer of splitmix64, every input bit affects every output bit
+static inline uint64_t mix( uint64_t value ) {
+    value = ( value ^ ( value >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+    value = ( value ^ ( value >> 27 ) ) * 0x94d049bb133111ebULL;
+    return value ^ ( value >> 31 );
+};
+
+
+static void checksum_genomes( const std::vector<struct targs>& thread_arguments, std::atomic<size_t>& next, std::vector<uint64_t>& checksums ) {
+
+    size_t index;
+
+    while ( ( index = next.fetch_add(1) ) < thread_arguments.size() ) {
+        const struct targs& genome = thread_arguments[index];
+        uint64_t checksum = mix( genome.size ^ ( (uint64_t)genome.cores.size() << 32 ) );
+
+        for ( size_t i = 0; i < genome.cores.size(); i++ ) {
+            checksum = mix( checksum ^ genome.cores[i] );
+            checksum = mix( checksum ^ genome.counts[i] );
+        }
+
+        checksums[index] = checksum;
+    }
+};
+
+
+void signature_checksums( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, std::vector<uint64_t>& checksums ) {
+
+    checksums.assign( thread_arguments.size(), 0 );
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    const size_t threadNumber = std::max( std::min( program_arguments.threadNumber, thread_arguments.size() ), (size_t)1 );
+
+    for ( size_t i = 0; i < threadNumber; i++ ) {
+        threads.emplace_back( checksum_genomes, std::cref(thread_arguments), std::ref(next), std::ref(checksums) );
+    }
+
+    for ( std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++ ) {
+        it->join();
+    }
+};
+
+
+void save_state( const std::vector<struct targs>& thread_arguments, const std::vector<uint64_t>& checksums, const struct pargs& program_arguments, const TriangularMatrix& matrix ) {
+
+    const std::string filename = program_arguments.prefix + ".state";
+    const std::string temporary = filename + ".tmp";
+
+    struct state_header header;
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, STATE_MAGIC, 4 );
+    header.version = STATE_VERSION;
+    header.lcp_level = program_arguments.lcpLevel;
+    header.type = program_arguments.type;
+    header.scale = thread_arguments.empty() ? 1 : std::max( thread_arguments[0].scale, (size_t)1 );
+    header.genomes = thread_arguments.size();
+
+    std::string names;
+
+    for ( std::vector<struct targs>::const_iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+        names += trimmed_name( it->shortName ) + "\n";
+    }
+
+    header.names_length = names.size();
+
+    std::ofstream out( temporary, std::ios::binary );
+
+    if ( !out ) {
+        log(ERROR, "Couldn't open %s", temporary.c_str());
+        exit(1);
+    }
+
+    write_section( out, &header, sizeof(header) );
+    write_section( out, names.data(), names.size() );
+    write_section( out, checksums.data(), checksums.size() * sizeof(uint64_t) );
+    write_section( out, matrix.data(), matrix.count() * sizeof(struct similarity) );
+
+    out.close();
+
+    if ( out.fail() || rename( temporary.c_str(), filename.c_str() ) != 0 ) {
+        log(ERROR, "Failed to write %s", filename.c_str());
+        exit(1);
+    }
+
+    if ( program_arguments.verbose ) {
+        log(INFO, "Matrix state of %zu genomes is saved to %s", thread_arguments.size(), filename.c_str());
+    }
+};
+
+
+void load_state( const std::vector<struct targs>& thread_arguments, const std::vector<uint64_t>& checksums, const struct pargs& program_arguments, TriangularMatrix& matrix, std::vector<bool>& known ) {
+
+    const std::string& filename = program_arguments.updateFile;
+    const size_t numGenomes = thread_arguments.size();
+
+    MmapFile file( filename.c_str() );
+
+    if ( !file || file.size() < sizeof(struct state_header) ) {
+        log(ERROR, "Couldn't open matrix state %s", filename.c_str());
+        exit(1);
+    }
+
+    struct state_header header;
+    memcpy( &header, file.data(), sizeof(struct state_header) );
+
+    if ( memcmp( header.magic, STATE_MAGIC, 4 ) != 0 || header.version != STATE_VERSION ) {
+        log(ERROR, "Invalid matrix state file %s", filename.c_str());
+        exit(1);
+    }
+
+    const size_t previousGenomes = header.genomes;
+    const size_t cells = previousGenomes * ( previousGenomes - ( previousGenomes != 0 ) ) / 2;
+
+    // sections, in the order of save_state()
+    const size_t names_offset = section_size( sizeof(struct state_header) );
+    const size_t checksums_offset = names_offset + section_size( header.names_length );
+    const size_t cells_offset = checksums_offset + section_size( previousGenomes * sizeof(uint64_t) );
+
+    if ( file.size() != cells_offset + section_size( cells * sizeof(struct similarity) ) ) {
+        log(ERROR, "Matrix state file %s is truncated.", filename.c_str());
+        exit(1);
+    }
+
+    // similarities of another configuration cannot be reused
+    const size_t scale = numGenomes == 0 ? 1 : std::max( thread_arguments[0].scale, (size_t)1 );
+
+    if ( header.lcp_level != program_arguments.lcpLevel ) {
+        log(ERROR, "Matrix state %s was computed at LCP level %u, not %zu.", filename.c_str(), header.lcp_level, program_arguments.lcpLevel);
+        exit(1);
+    }
+    if ( header.type != (uint32_t)program_arguments.type ) {
+        log(ERROR, "Matrix state %s was computed in %s mode.", filename.c_str(), ( header.type == SET ? "set" : "vector" ));
+        exit(1);
+    }
+    if ( header.scale != scale ) {
+        log(ERROR, "Matrix state %s was computed at scale %zu, not %zu.", filename.c_str(), (size_t)header.scale, scale);
+        exit(1);
+    }
+
+    std::vector<std::string> names;
+    std::stringstream ss( std::string( file.data() + names_offset, header.names_length ) );
+    std::string name;
+
+    while ( std::getline( ss, name ) ) {
+        names.push_back( name );
+    }
+
+    if ( names.size() != previousGenomes ) {
+        log(ERROR, "Invalid matrix state file %s", filename.c_str());
+        exit(1);
+    }
+
+    const uint64_t* previousChecksums = reinterpret_cast<const uint64_t*>( file.data() + checksums_offset );
+    const struct similarity* previousCells = reinterpret_cast<const struct similarity*>( file.data() + cells_offset );
+
+    // genomes of the state by checksum, duplicates are matched by name or in order
+    std::unordered_multimap<uint64_t, size_t> genomes;
+    std::vector<bool> used( previousGenomes, false );
+
+    for ( size_t i = 0; i < previousGenomes; i++ ) {
+        genomes.insert( std::make_pair( previousChecksums[i], i ) );
+    }
+
+    std::vector<size_t> previous( numGenomes, previousGenomes );
+    known.assign( numGenomes, false );
+    size_t knownGenomes = 0;
+
+    for ( size_t i = 0; i < numGenomes; i++ ) {
+        const std::string shortName = trimmed_name( thread_arguments[i].shortName );
+        std::pair<std::unordered_multimap<uint64_t, size_t>::const_iterator, std::unordered_multimap<uint64_t, size_t>::const_iterator> range = genomes.equal_range( checksums[i] );
+
+        for ( std::unordered_multimap<uint64_t, size_t>::const_iterator it = range.first; it != range.second; it++ ) {
+            if ( !used[it->second] && ( previous[i] == previousGenomes || names[it->second] == shortName ) ) {
+                previous[i] = it->second;
+            }
+        }
+
+        if ( previous[i] == previousGenomes ) {
+            continue;
+        }
+
+        used[previous[i]] = true;
+        known[i] = true;
+        knownGenomes++;
+
+        if ( program_arguments.verbose && names[previous[i]] != shortName ) {
+            log(INFO, "%s was named %s in %s", shortName.c_str(), names[previous[i]].c_str(), filename.c_str());
+        }
+    }
+
+    // the cells of the state are read row by row if the known genomes keep their order, a shard only 
+    // holds the rows of its tiles and only needs its own pairs
+    for ( size_t i = matrix.row_begin(); i < matrix.row_end(); i++ ) {
+        if ( !known[i] ) {
+            continue;
+        }
+
+        for ( size_t j = i + 1; j < numGenomes; j++ ) {
+            if ( !known[j] || !in_shard( i, j, numGenomes, program_arguments ) ) {
+                continue;
+            }
+
+            const size_t a = std::min( previous[i], previous[j] ), b = std::max( previous[i], previous[j] );
+            matrix.at(i, j) = previousCells[a * ( 2 * previousGenomes - a - 1 ) / 2 + ( b - a - 1 )];
+        }
+    }
+
+    log(INFO, "Reusing %zu pairs of %zu genomes from %s, %zu genomes are new, %zu are dropped", knownGenomes * ( knownGenomes - ( knownGenomes != 0 ) ) / 2, knownGenomes, filename.c_str(), numGenomes - knownGenomes, previousGenomes - knownGenomes);
+};
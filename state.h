@@ -0,0 +1,86 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include "args.h"
+#include "logging.h"
+#include "fileio.h"
+#include "matrix.h"
+#include "utils/MmapFile.hpp"
+#include "utils/TriangularMatrix.hpp"
+
+// magic number and version of matrix state files
+#define STATE_MAGIC "GCST"
+#define STATE_VERSION 1
+
+
+struct state_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t lcp_level;     // LCP level of the core labels
+    uint32_t type;          // calculation mode, see `data_type`
+    uint64_t scale;         // scale of the sketches, 1 for all cores
+    uint64_t genomes;       // number of genomes
+    uint64_t names_length;  // bytes of the newline-terminated genome names
+};
+
+
+/**
+ * @brief Computes a checksum of the signature of every genome.
+ *
+ * The checksum covers the cores, their counts and the size of a genome, i.e. everything its
+ * similarities depend on, so that genomes of a previous run can be recognized regardless of their
+ * names or input files. The genomes are processed by `threadNumber` threads.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param checksums An output vector that will contain the checksum of every genome.
+ */
+void signature_checksums( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, std::vector<uint64_t>& checksums );
+
+/**
+ * @brief Writes the state of the similarity matrix to `<prefix>.state`.
+ *
+ * The state file consists of 8-byte aligned sections: the `state_header`, the short names of the
+ * genomes, their signature checksums and the cells of the `TriangularMatrix`, row by row, see
+ * `write_section()`. The file is written next to its destination and renamed, so a previous state is
+ * replaced only by a complete one.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param checksums A constant reference to the signature checksums of the genomes.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param matrix A constant reference to the computed matrix of similarities.
+ */
+void save_state( const std::vector<struct targs>& thread_arguments, const std::vector<uint64_t>& checksums, const struct pargs& program_arguments, const TriangularMatrix& matrix );
+
+/**
+ * @brief Restores the similarities of the genomes of a previous run, given with `--update`.
+ *
+ * A genome is known if the state has a genome with the same signature checksum; if several have,
+ * the one with the same name is preferred. The similarities of all pairs of known genomes are
+ * copied into the matrix, so that only the pairs involving new or changed genomes are left to
+ * `compute_matrices()`; with `--shard`, only the pairs of the shard, whose rows are those of the
+ * matrix, are copied. Genomes of the state missing from the input are dropped. The program exits
+ * with an error if the state was computed at another LCP level, scale or calculation mode.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param checksums A constant reference to the signature checksums of the genomes.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param matrix A reference to the matrix of similarities, of size n.
+ * @param known An output vector of n flags, set for the genomes found in the state.
+ */
+void load_state( const std::vector<struct targs>& thread_arguments, const std::vector<uint64_t>& checksums, const struct pargs& program_arguments, TriangularMatrix& matrix, std::vector<bool>& known );
+
+#endif
@@ -0,0 +1,214 @@
+#include "topk.h"
+
+
+// Jaccard similarity a neighbour is ranked by, that of two empty signatures is 0 / 0 and ranks as 0
+static double rank_key( const struct neighbour& n ) {
+    return std::isnan( n.jaccard ) ? 0 : n.jaccard;
+};
+
+
+// ranks neighbours by decreasing Jaccard similarity, ties by genome
+static bool better( const struct neighbour& a, const struct neighbour& b ) {
+    const double key1 = rank_key( a ), key2 = rank_key( b );
+    return key1 > key2 || ( key1 == key2 && a.genome < b.genome );
+};
+
+
+// the front of a heap is the worst neighbour kept
+static void offer( std::vector<struct neighbour>& heap, const struct neighbour& candidate, size_t capacity ) {
+    if ( heap.size() < capacity ) {
+        heap.push_back( candidate );
+        std::push_heap( heap.begin(), heap.end(), better );
+    } else if ( capacity > 0 && better( candidate, heap.front() ) ) {
+        std::pop_heap( heap.begin(), heap.end(), better );
+        heap.back() = candidate;
+        std::push_heap( heap.begin(), heap.end(), better );
+    }
+};
+
+
+void compare_tiles( const std::vector<struct tile>& tiles, std::atomic<size_t>& next, const std::vector<struct targs>& thread_arguments, const std::vector<double>& sizes, const std::vector<size_t>& totals, const struct pargs& program_arguments, const std::vector<std::vector<uint32_t>>& candidates, size_t capacity, std::vector<std::vector<struct neighbour>>& heaps, std::vector<std::mutex>& locks, std::atomic<size_t>& compared ) {
+
+    size_t index, count = 0;
+
+    while ( ( index = next++ ) < tiles.size() ) {
+        const struct tile& t = tiles[index];
+
+        for ( size_t i = t.row_begin; i < t.row_end; i++ ) {
+            for ( size_t j = std::max( t.column_begin, i + 1 ); j < t.column_end; j++ ) {
+
+                // only candidates of either genome are compared
+                if ( !candidates.empty() && !std::binary_search( candidates[i].begin(), candidates[i].end(), (uint32_t)j ) && !std::binary_search( candidates[j].begin(), candidates[j].end(), (uint32_t)i ) ) {
+                    continue;
+                }
+
+                struct comparison result;
+                compareCores( thread_arguments[i], thread_arguments[j], totals[i], totals[j], program_arguments, result );
+                count++;
+
+                struct neighbour n;
+                n.jaccard = calculateJaccardSimilarity( result.interSize, result.unionSize );
+                n.dice = calculateDiceSimilarity( result.interSize, sizes[i], sizes[j] );
+                n.distance = calculateNormalizedVectorSimilarity( result.numerator, result.denominator );
+
+                n.genome = j;
+                {
+                    std::lock_guard<std::mutex> lock( locks[i] );
+                    offer( heaps[i], n, capacity );
+                }
+                n.genome = i;
+                {
+                    std::lock_guard<std::mutex> lock( locks[j] );
+                    offer( heaps[j], n, capacity );
+                }
+            }
+        }
+    }
+
+    compared += count;
+};
+
+
+// keeps the best neighbours of every genome among all pairs, or among the candidates
+static void search( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const std::vector<std::vector<uint32_t>>& candidates, size_t capacity, std::vector<std::vector<struct neighbour>>& neighbours, std::atomic<size_t>& compared ) {
+
+    const size_t numGenomes = thread_arguments.size();
+
+    std::vector<struct tile> tiles;
+    std::vector<bool> known( numGenomes, false );
+    struct tile area = { 0, numGenomes, 0, numGenomes, 0, 0 };
+    make_tiles( thread_arguments, program_arguments, known, area, tiles );
+
+    std::vector<double> sizes;
+    std::vector<size_t> totals;
+    sizes.reserve( numGenomes );
+    totals.reserve( numGenomes );
+
+    for ( std::vector<struct targs>::const_iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+        sizes.push_back( calculateTotalSize( *it, program_arguments ) );
+        totals.push_back( calculateCountTotal( *it ) );
+    }
+
+    // a single heap per genome is shared by the threads under the lock of the genome
+    const size_t threadNumber = std::min( tiles.size(), program_arguments.threadNumber );
+    std::vector<std::mutex> locks( numGenomes );
+    neighbours.assign( numGenomes, std::vector<struct neighbour>() );
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+
+    for ( size_t i = 0; i < threadNumber; i++ ) {
+        threads.emplace_back( compare_tiles, std::cref(tiles), std::ref(next), std::cref(thread_arguments), std::cref(sizes), std::cref(totals), std::cref(program_arguments), std::cref(candidates), capacity, std::ref(neighbours), std::ref(locks), std::ref(compared) );
+    }
+
+    for ( std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++ ) {
+        it->join();
+    }
+
+    // the k best neighbours are the same whatever the order of the offers
+    for ( size_t i = 0; i < numGenomes; i++ ) {
+        std::sort( neighbours[i].begin(), neighbours[i].end(), better );
+    }
+};
+
+
+void find_neighbours( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, std::vector<std::vector<struct neighbour>>& neighbours ) {
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    const size_t numGenomes = thread_arguments.size();
+    std::vector<std::vector<uint32_t>> candidates;
+    std::atomic<size_t> compared(0);
+
+    if ( program_arguments.prefilterScale > 0 ) {
+        const size_t scale = std::max( program_arguments.prefilterScale, numGenomes == 0 ? (size_t)1 : thread_arguments[0].scale );
+
+        if ( scale != program_arguments.prefilterScale ) {
+            log(WARN, "Prefilter sketches are computed at scale %zu, the scale of the genomes.", scale);
+        }
+
+        // sketches of the genomes, at the threshold of the scale
+        std::vector<struct targs> sketches( numGenomes );
+
+        for ( size_t i = 0; i < numGenomes; i++ ) {
+            sketches[i].size = thread_arguments[i].size;
+            sketches[i].scale = scale;
+            sketches[i].cores = thread_arguments[i].cores;
+            sketches[i].counts = thread_arguments[i].counts;
+            sketchCores( sketches[i].cores, sketches[i].counts, sketchThreshold( scale ) );
+            sketches[i].cores.shrink_to_fit();
+            sketches[i].counts.shrink_to_fit();
+        }
+
+        std::vector<std::vector<struct neighbour>> nearest;
+        search( sketches, program_arguments, candidates, PREFILTER_CANDIDATES * program_arguments.topK, nearest, compared );
+
+        candidates.assign( numGenomes, std::vector<uint32_t>() );
+
+        for ( size_t i = 0; i < numGenomes; i++ ) {
+            for ( std::vector<struct neighbour>::const_iterator it = nearest[i].begin(); it != nearest[i].end(); it++ ) {
+                candidates[i].push_back( it->genome );
+            }
+            std::sort( candidates[i].begin(), candidates[i].end() );
+        }
+
+        if ( program_arguments.verbose ) {
+            log(INFO, "Prefiltered %zu candidates per genome on sketches at scale %zu", PREFILTER_CANDIDATES * program_arguments.topK, scale);
+        }
+
+        compared = 0;
+    }
+
+    search( thread_arguments, program_arguments, candidates, program_arguments.topK, neighbours, compared );
+
+    if ( program_arguments.verbose ) {
+        double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+        log(INFO, "Found %zu nearest neighbours of %zu genomes in %.2f seconds, %zu pairs compared exactly", program_arguments.topK, numGenomes, seconds, compared.load());
+    }
+};
+
+
+void write_neighbours( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const std::vector<std::vector<struct neighbour>>& neighbours ) {
+
+    std::string filename = program_arguments.prefix + ".topk.tsv";
+    std::ofstream out( filename );
+
+    if ( !out ) {
+        log(ERROR, "Couldn't open %s", filename.c_str());
+        exit(1);
+    }
+
+    out << "genome\tneighbour\trank\tjaccard\tdice\tns" << std::endl;
+
+    std::vector<std::string> names;
+
+    for ( std::vector<struct targs>::const_iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+        names.push_back( trimmed_name( it->shortName ) );
+    }
+
+    std::string line;
+    char number[FORMAT_BUFFER_SIZE];
+
+    for ( size_t i = 0; i < neighbours.size(); i++ ) {
+        for ( size_t rank = 0; rank < neighbours[i].size(); rank++ ) {
+            const struct neighbour& n = neighbours[i][rank];
+            line = names[i] + "\t" + names[n.genome] + "\t" + std::to_string( rank + 1 );
+
+            const double values[3] = { n.jaccard, n.dice, n.distance };
+            for ( size_t k = 0; k < 3; k++ ) {
+                line += '\t';
+                line.append( number, format_fixed( values[k], number ) );
+            }
+
+            line += '\n';
+            out.write( line.data(), line.size() );
+        }
+    }
+
+    out.close();
+
+    if ( out.fail() ) {
+        log(ERROR, "Failed to write %s", filename.c_str());
+        exit(1);
+    }
+};
@@ -0,0 +1,89 @@
+#ifndef TOPK_H
+#define TOPK_H
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include "args.h"
+#include "logging.h"
+#include "fileio.h"
+#include "helper.h"
+#include "similarity_metrics.h"
+#include "matrix.h"
+#include "wmatrix.h"
+
+// candidates per genome kept by the sketch prefilter, as a multiple of k
+#ifndef PREFILTER_CANDIDATES
+#define PREFILTER_CANDIDATES 4
+#endif
+
+
+struct neighbour {
+    uint32_t genome;        // index of the neighbouring genome
+    double jaccard;
+    double dice;
+    double distance;        // normalized vector similarity
+};
+
+
+/**
+ * @brief Finds the k nearest neighbours of every genome, set with `--top-k`.
+ *
+ * The neighbours are ranked by decreasing Jaccard similarity, ties by increasing genome index; the
+ * similarity of two empty signatures, 0 / 0, is ranked as 0 and reported as is. Every pair is
+ * compared once, as by `compute_matrices()`, and offered by `compare_tiles()` to the bounded heaps of
+ * k neighbours of both genomes, one per genome shared by the threads under a lock per genome, so that
+ * no matrix is allocated and the memory is O(n k) whatever the number of threads.
+ *
+ * With `--prefilter`, the genomes are first reduced to FracMinHash sketches at the given scale, and
+ * the same search on the sketches keeps `PREFILTER_CANDIDATES` * k candidates per genome. The cores
+ * of two genomes are then only merged if one of them is a candidate of the other, so the exact
+ * similarities of the reported neighbours are identical, but a neighbour missed by the sketches is
+ * not found.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param neighbours An output vector per genome that will contain its nearest neighbours, best first.
+ */
+void find_neighbours( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, std::vector<std::vector<struct neighbour>>& neighbours );
+
+/**
+ * @brief Offers the pairs of tiles to bounded heaps of neighbours until no tile is left.
+ *
+ * Worker routine of `find_neighbours()`.
+ *
+ * @param tiles A constant reference to the tiles of the pairs to be compared.
+ * @param next The index of the next tile to be processed, shared by the threads.
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param sizes A constant reference to the core set sizes of the genomes, see `calculateTotalSize()`.
+ * @param totals A constant reference to the sums of the counts of the genomes.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param candidates A constant reference to the sorted candidates of every genome, or an empty vector
+ *        if all pairs are compared.
+ * @param capacity The number of neighbours kept per genome.
+ * @param heaps An output vector of heaps, one per genome, shared by the threads.
+ * @param locks A reference to the locks of the heaps, one per genome.
+ * @param compared The number of compared pairs, shared by the threads.
+ */
+void compare_tiles( const std::vector<struct tile>& tiles, std::atomic<size_t>& next, const std::vector<struct targs>& thread_arguments, const std::vector<double>& sizes, const std::vector<size_t>& totals, const struct pargs& program_arguments, const std::vector<std::vector<uint32_t>>& candidates, size_t capacity, std::vector<std::vector<struct neighbour>>& heaps, std::vector<std::mutex>& locks, std::atomic<size_t>& compared );
+
+/**
+ * @brief Writes the nearest neighbours of every genome to `<prefix>.topk.tsv`.
+ *
+ * One line per genome and neighbour, with their short names, the rank of the neighbour, and the
+ * Jaccard, Dice and normalized vector similarities.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param neighbours A constant reference to the neighbours of every genome, best first.
+ */
+void write_neighbours( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const std::vector<std::vector<struct neighbour>>& neighbours );
+
+#endif
@@ -0,0 +1,67 @@
+/**
+ * @file    BgzfFile.hpp
+ * @brief   Wrapper Class for Reading Gzip and BGZF Compressed Files with htslib
+ *
+ * This header file defines the BgzfFile class, which wraps htslib's BGZF reader.
+ * It transparently reads uncompressed, gzip-compressed and BGZF-compressed files.
+ * For BGZF input, blocks are decompressed in parallel by an htslib thread pool,
+ * which reads ahead while the caller processes already decompressed data, so
+ * decompression overlaps with the work done on the returned bytes.
+ *
+ * Usage Example:
+ *     BgzfFile file("genome.fa.gz", 4);
+ *     char buffer[BUFFERSIZE];
+ *     ssize_t length;
+ *     while ((length = file.read(buffer, BUFFERSIZE)) > 0) {
+ *         // Process buffer...
+ *     }
+ */
+
+
+#ifndef BGZFFILE_HPP
+#define BGZFFILE_HPP
+
+#include <cstddef>
+#include <sys/types.h>
+#include <htslib/bgzf.h>
+
+
+class BgzfFile {
+public:
+    BgzfFile(const char* filename, int threads) {
+        bgzf_ = bgzf_open(filename, "r");
+
+        // only BGZF blocks can be decompressed independently
+        if (bgzf_ && threads > 1 && isBgzf()) {
+            bgzf_mt(bgzf_, threads, 256);
+        }
+    }
+
+    ~BgzfFile() {
+        if (bgzf_) bgzf_close(bgzf_);
+    }
+
+    // Reads up to length decompressed bytes, returns 0 at end of file and -1 on error
+    ssize_t read(void* buffer, size_t length) {
+        return bgzf_ ? bgzf_read(bgzf_, buffer, length) : -1;
+    }
+
+    // Returns true if the file is BGZF-compressed
+    bool isBgzf() const {
+        return bgzf_ && bgzf_compression(bgzf_) == bgzf;
+    }
+
+    // Check if the file is valid
+    explicit operator bool() const {
+        return bgzf_ != nullptr;
+    }
+
+private:
+    BGZF* bgzf_;
+
+    BgzfFile(const BgzfFile&);
+    BgzfFile& operator=(const BgzfFile&);
+};
+
+
+#endif
@@ -0,0 +1,234 @@
+/**
+ * @class   LockFreeQueue
+ * @brief   A bounded lock-free multi-producer/multi-consumer queue.
+ *
+ * This template class implements a fixed-capacity ring buffer in which every cell carries a
+ * sequence number, so that producers and consumers claim cells with a single compare-and-swap
+ * on their own position counter and never share a lock. It offers the same push, pop and
+ * markFinished semantics as ThreadSafeQueue and can be used in its place: `push` waits while
+ * the queue is full, `pop` waits while it is empty and returns false once the queue is both
+ * empty and finished. Waiting threads spin briefly, then yield, then sleep, so idle consumers
+ * do not burn a core.
+ *
+ * @tparam T The type of elements stored in the queue.
+ */
+
+
+#ifndef LOCK_FREE_QUEUE_HPP
+#define LOCK_FREE_QUEUE_HPP
+
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#define CACHE_LINE_SIZE     64
+
+template <typename T>
+class LockFreeQueue {
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    Cell* cells;
+    size_t mask;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueue_position;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeue_position;
+    alignas(CACHE_LINE_SIZE) std::atomic<bool> finished;
+
+    LockFreeQueue(const LockFreeQueue&);
+    LockFreeQueue& operator=(const LockFreeQueue&);
+
+
+    /**
+     * @fn      static void backoff(size_t& attempts)
+     * @brief   Waits before the next attempt, longer as the number of failed attempts grows.
+     *
+     * @param attempts Reference to the number of failed attempts, incremented by the call.
+     */
+    static void backoff(size_t& attempts) {
+        if ( attempts < 64 ) {
+            // busy wait, the other side is likely to be done within a few cycles
+        } else if ( attempts < 256 ) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        attempts++;
+    }
+
+public:
+
+    /**
+     * @brief   Constructs a queue holding at most `capacity` elements.
+     *
+     * @param capacity The minimum number of cells, rounded up to the next power of two.
+     */
+    explicit LockFreeQueue(size_t capacity) : enqueue_position(0), dequeue_position(0), finished(false) {
+        size_t size = 2;
+        while ( size < capacity ) {
+            size <<= 1;
+        }
+
+        cells = new Cell[size];
+        mask = size - 1;
+
+        for ( size_t i = 0; i < size; i++ ) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~LockFreeQueue() {
+        delete[] cells;
+    }
+
+
+    /**
+     * @fn      bool tryPush(T&& value)
+     * @brief   Moves an element to the end of the queue if there is a free cell.
+     *
+     * @param value The element to move to the queue. It is left untouched if the queue is full.
+     * @return True if the element was pushed; false if the queue is full.
+     */
+    bool tryPush(T&& value) {
+        Cell* cell;
+        size_t position = enqueue_position.load(std::memory_order_relaxed);
+
+        while ( true ) {
+            cell = &cells[position & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+            if ( difference == 0 ) {
+                if ( enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed) ) {
+                    break;
+                }
+            } else if ( difference < 0 ) {
+                return false;
+            } else {
+                position = enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = std::move(value);
+        cell->sequence.store(position + 1, std::memory_order_release);
+
+        return true;
+    }
+
+
+    /**
+     * @fn      void push(T&& value)
+     * @brief   Moves an element to the end of the queue, waiting while the queue is full.
+     *
+     * @param value The element to move to the queue.
+     */
+    void push(T&& value) {
+        size_t attempts = 0;
+        while ( !tryPush(std::move(value)) ) {
+            backoff(attempts);
+        }
+    }
+
+
+    /**
+     * @fn      void push(const T& value)
+     * @brief   Adds a copy of an element to the end of the queue, waiting while the queue is full.
+     *
+     * @param value The element to add to the queue.
+     */
+    void push(const T& value) {
+        T copy(value);
+        push(std::move(copy));
+    }
+
+
+    /**
+     * @fn      bool tryPop(T& value)
+     * @brief   Removes and returns the front element from the queue without waiting.
+     *
+     * @param value Reference to the variable where the popped element will be stored.
+     * @return True if an element was successfully popped; false if the queue is currently empty.
+     */
+    bool tryPop(T& value) {
+        Cell* cell;
+        size_t position = dequeue_position.load(std::memory_order_relaxed);
+
+        while ( true ) {
+            cell = &cells[position & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+            if ( difference == 0 ) {
+                if ( dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed) ) {
+                    break;
+                }
+            } else if ( difference < 0 ) {
+                return false;
+            } else {
+                position = dequeue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = std::move(cell->data);
+        cell->sequence.store(position + mask + 1, std::memory_order_release);
+
+        return true;
+    }
+
+
+    /**
+     * @fn      bool pop(T& value)
+     * @brief   Removes and returns the front element from the queue, waiting while it is empty.
+     *
+     * If the queue is marked as finished and empty, it returns false to indicate no more
+     * elements are forthcoming.
+     *
+     * @param value Reference to the variable where the popped element will be stored.
+     * @return True if an element was successfully popped; false if the queue is empty and finished.
+     */
+    bool pop(T& value) {
+        size_t attempts = 0;
+
+        while ( !tryPop(value) ) {
+            // elements pushed before the queue was finished are visible once the flag is
+            if ( finished.load(std::memory_order_acquire) ) {
+                return tryPop(value);
+            }
+            backoff(attempts);
+        }
+
+        return true;
+    }
+
+
+    /**
+     * @fn      void markFinished()
+     * @brief   Marks the queue as finished for operations.
+     *
+     * Signals that no more elements will be added to the queue, allowing waiting threads to
+     * complete their operations gracefully once the queue is empty.
+     */
+    void markFinished() {
+        finished.store(true, std::memory_order_release);
+    }
+
+
+    /**
+     * @fn      bool isFinished() const
+     * @brief   Checks if the queue has been marked as finished.
+     *
+     * @return True if the queue is marked as finished; otherwise, false.
+     */
+    bool isFinished() const {
+        return finished.load(std::memory_order_acquire);
+    }
+
+};
+
+#endif
@@ -0,0 +1,95 @@
+/**
+ * @file    MmapFile.hpp
+ * @brief   Read-only Memory-Mapped File Wrapper
+ *
+ * This header file defines the MmapFile class, which maps a whole file into the
+ * address space of the process in read-only mode. The mapping is advised for
+ * sequential access so that the kernel reads ahead aggressively, and the content
+ * can be scanned in place without copying it through stream buffers.
+ *
+ * The MmapFile class is designed for large plain-text inputs such as FASTA
+ * assemblies, where records can be located with vectorized scans (`memchr`)
+ * directly on the mapped bytes.
+ *
+ * Usage Example:
+ *     MmapFile file("genome.fa");
+ *     if (file) {
+ *         const char* begin = file.data();
+ *         const char* end = file.data() + file.size();
+ *         // Scan [begin, end)...
+ *     }
+ */
+
+
+#ifndef MMAPFILE_HPP
+#define MMAPFILE_HPP
+
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+class MmapFile {
+public:
+    MmapFile(const char* filename) : data_(nullptr), size_(0), valid_(false) {
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return;
+        }
+
+        size_ = static_cast<size_t>(st.st_size);
+
+        // empty files cannot be mapped, but they are still valid inputs
+        if (size_ != 0) {
+            void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                close(fd);
+                return;
+            }
+            madvise(addr, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(addr);
+        }
+
+        // the mapping stays valid after the descriptor is closed
+        close(fd);
+        valid_ = true;
+    }
+
+    ~MmapFile() {
+        if (data_) munmap(const_cast<char*>(data_), size_);
+    }
+
+    // Pointer to the first byte of the mapping
+    const char* data() const {
+        return data_;
+    }
+
+    // Number of mapped bytes
+    size_t size() const {
+        return size_;
+    }
+
+    // Check if the file is mapped
+    explicit operator bool() const {
+        return valid_;
+    }
+
+private:
+    const char* data_;
+    size_t size_;
+    bool valid_;
+
+    MmapFile(const MmapFile&);
+    MmapFile& operator=(const MmapFile&);
+};
+
+
+#endif
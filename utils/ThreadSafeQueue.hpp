@@ -4,7 +4,8 @@
  *
  * This template class encapsulates a standard queue along with synchronization primitives
  * to ensure thread-safe operations. It supports pushing elements to the queue, popping
- * elements from it, and marking the queue as finished for operations.
+ * elements from it, and marking the queue as finished for operations. If a capacity is
+ * given, producers block in `push` while the queue is full instead of polling it.
  *
  * @tparam T The type of elements stored in the queue.
  */
@@ -15,6 +16,7 @@
 
 
 #include <queue>
+#include <utility>
 #include <thread>
 #include <mutex>
 #include <atomic>
@@ -27,23 +29,34 @@ class ThreadSafeQueue {
 private:
     std::mutex mutex;
     std::condition_variable cond_var;
+    std::condition_variable not_full;
     std::queue<T> queue;
-    bool finished = false;
+    size_t capacity;
+    std::atomic<bool> finished;
 
 public:
 
+    /**
+     * @brief   Constructs a queue holding at most `capacity` elements.
+     *
+     * @param capacity The maximum number of queued elements, 0 for an unbounded queue.
+     */
+    explicit ThreadSafeQueue(size_t capacity = 0) : capacity(capacity), finished(false) {}
+
+
     /**
      * @fn      void push(const T& value)
      * @brief   Adds an element to the end of the queue in a thread-safe manner.
      *
-     * Locks the queue, adds the provided element to it, and then notifies one waiting thread
-     * about the availability of new data.
+     * Locks the queue, waits while it is full, adds the provided element to it, and then
+     * notifies one waiting thread about the availability of new data.
      *
      * @param value The element to add to the queue.
      */
     void push(const T& value) {
         {
-            std::lock_guard<std::mutex> lock(mutex);
+            std::unique_lock<std::mutex> lock(mutex);
+            not_full.wait(lock, [this]{ return capacity == 0 || queue.size() < capacity; });
             queue.push(value);
         }
         
@@ -51,6 +64,26 @@ public:
     }
 
 
+    /**
+     * @fn      void push(T&& value)
+     * @brief   Moves an element to the end of the queue in a thread-safe manner.
+     *
+     * Same as `push(const T&)`, but the element is moved, so buffers owned by it are handed
+     * over to the consumer without being copied.
+     *
+     * @param value The element to move to the queue.
+     */
+    void push(T&& value) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            not_full.wait(lock, [this]{ return capacity == 0 || queue.size() < capacity; });
+            queue.push(std::move(value));
+        }
+        
+        cond_var.notify_one();
+    }
+
+
     /**
      * @fn      bool pop(T& value)
      * @brief   Removes and returns the front element from the queue in a thread-safe manner.
@@ -71,8 +104,36 @@ public:
             return false;
         }
         
-        value = queue.front();
+        value = std::move(queue.front());
         queue.pop();
+        lock.unlock();
+
+        not_full.notify_one();
+        
+        return true;
+    }
+
+
+    /**
+     * @fn      bool tryPop(T& value)
+     * @brief   Removes and returns the front element from the queue without waiting.
+     *
+     * @param value Reference to the variable where the popped element will be stored.
+     * @return True if an element was successfully popped; false if the queue is currently empty.
+     */
+    bool tryPop(T& value) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+        
+            if ( queue.empty() ) {
+                return false;
+            }
+        
+            value = std::move(queue.front());
+            queue.pop();
+        }
+
+        not_full.notify_one();
         
         return true;
     }
@@ -104,7 +165,7 @@ public:
      * @return True if the queue is marked as finished; otherwise, false.
      */
     bool isFinished() const {
-        return finished;
+        return finished.load();
     }
 
 
@@ -0,0 +1,173 @@
+/**
+ * @file    TriangularMatrix.hpp
+ * @brief   Packed Upper-Triangular Matrix of Pairwise Similarities
+ *
+ * This header file defines the TriangularMatrix class, which stores the similarities
+ * of all pairs of n genomes. Similarity matrices are symmetric and their diagonal is
+ * always 1, so only the n * (n - 1) / 2 cells above the diagonal are kept, row by row,
+ * and the three metrics of a pair are stored next to each other.
+ *
+ * A matrix may be limited to a window of consecutive rows, e.g. the rows of the tiles of a shard,
+ * in which case only the cells of these rows are allocated and only they may be accessed; callers
+ * check the pairs they access against `row_begin()` and `row_end()`.
+ *
+ * Small matrices are allocated on the heap. Matrices larger than `MATRIX_HEAP_LIMIT`
+ * bytes, or the given heap limit, are mapped onto a backing file instead, which is unlinked right after it is
+ * mapped, so that the kernel can write computed cells back to disk under memory
+ * pressure and the file disappears when the program exits.
+ *
+ * Usage Example:
+ *     TriangularMatrix matrix(numGenomes, "gc.matrix");
+ *     if (matrix) {
+ *         matrix.at(i, j).dice = 0.5; // i < j
+ *         double dice = matrix.get(j, i).dice;
+ *     }
+ */
+
+
+#ifndef TRIANGULARMATRIX_HPP
+#define TRIANGULARMATRIX_HPP
+
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef MATRIX_HEAP_LIMIT
+#define MATRIX_HEAP_LIMIT 1073741824
+#endif
+
+
+struct similarity {
+    double jaccard;
+    double dice;
+    double distance;
+};
+
+
+class TriangularMatrix {
+public:
+    TriangularMatrix(size_t n, const char* filename, size_t heap_limit = MATRIX_HEAP_LIMIT) : TriangularMatrix(n, 0, n, filename, heap_limit) {
+    }
+
+    // Matrix of the rows from row_begin up to, but not including, row_end
+    TriangularMatrix(size_t n, size_t row_begin, size_t row_end, const char* filename, size_t heap_limit = MATRIX_HEAP_LIMIT) : cells_(nullptr), n_(n), row_begin_(row_begin), row_end_(row_end), offset_(offset(row_begin)), count_(offset(row_end) - offset(row_begin)), mapped_(false), valid_(false) {
+        const size_t bytes = count_ * sizeof(struct similarity);
+
+        if (bytes <= heap_limit || bytes == 0) {
+            cells_ = new struct similarity[count_];
+            valid_ = true;
+            return;
+        }
+
+        int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) {
+            return;
+        }
+
+        // the file is sparse, blocks are only allocated for written cells
+        if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+            close(fd);
+            unlink(filename);
+            return;
+        }
+
+        void* addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        unlink(filename);
+
+        if (addr == MAP_FAILED) {
+            return;
+        }
+
+        cells_ = static_cast<struct similarity*>(addr);
+        mapped_ = true;
+        valid_ = true;
+    }
+
+    ~TriangularMatrix() {
+        if (mapped_) {
+            munmap(cells_, count_ * sizeof(struct similarity));
+        } else {
+            delete[] cells_;
+        }
+    }
+
+    // Cell of the pair (i, j), where i < j
+    struct similarity& at(size_t i, size_t j) {
+        return cells_[offset(i) - offset_ + (j - i - 1)];
+    }
+
+    // Similarities of the pair (i, j) in any order, 1 on the diagonal
+    struct similarity get(size_t i, size_t j) const {
+        if (i == j) {
+            struct similarity identity = { 1, 1, 1 };
+            return identity;
+        }
+        if (j < i) {
+            size_t k = i; i = j; j = k;
+        }
+        return cells_[offset(i) - offset_ + (j - i - 1)];
+    }
+
+    // Pointer to the cell (i, i + 1), the cells of the row i up to (i, n - 1) follow it
+    const struct similarity* row(size_t i) const {
+        return cells_ + (offset(i) - offset_);
+    }
+
+    // Number of genomes
+    size_t size() const {
+        return n_;
+    }
+
+    // First row of the window
+    size_t row_begin() const {
+        return row_begin_;
+    }
+
+    // Row after the last row of the window
+    size_t row_end() const {
+        return row_end_;
+    }
+
+    // Pointer to the first cell of the window, the cells of a row follow each other
+    const struct similarity* data() const {
+        return cells_;
+    }
+
+    // Number of cells of the window
+    size_t count() const {
+        return count_;
+    }
+
+    // Check if the matrix is mapped onto a backing file
+    bool mapped() const {
+        return mapped_;
+    }
+
+    // Check if the cells are allocated
+    explicit operator bool() const {
+        return valid_;
+    }
+
+private:
+    struct similarity* cells_;
+    size_t n_;
+    size_t row_begin_;
+    size_t row_end_;
+    size_t offset_;
+    size_t count_;
+    bool mapped_;
+    bool valid_;
+
+    // Cells of the rows above the row i
+    size_t offset(size_t i) const {
+        return i * (2 * n_ - i - 1) / 2;
+    }
+
+    TriangularMatrix(const TriangularMatrix&);
+    TriangularMatrix& operator=(const TriangularMatrix&);
+};
+
+
+#endif
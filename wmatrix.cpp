@@ -0,0 +1,277 @@
+#include "wmatrix.h"
+
+
+static const char* metric_names[METRIC_COUNT] = { "dice", "jaccard", "ns" };
+
+// two digits of every number below 100
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+
+// appends the lowest bytes of a number in little-endian order
+static inline void append_little_endian( std::string& buffer, uint64_t value, size_t bytes ) {
+    char data[8];
+    for ( size_t k = 0; k < bytes; k++ ) {
+        data[k] = static_cast<char>( value >> ( 8 * k ) );
+    }
+    buffer.append( data, bytes );
+};
+
+
+static inline void append_distance( std::string& buffer, output_format format, double similarity ) {
+    const double distance = 1 - similarity;
+
+    if ( format == PHY || format == LOWER ) {
+        char text[FORMAT_BUFFER_SIZE + 1];
+        text[0] = ' ';
+        buffer.append( text, 1 + format_fixed( distance, text + 1 ) );
+    } else if ( format == BIN32 ) {
+        float value = static_cast<float>( distance );
+        uint32_t bits;
+        memcpy( &bits, &value, sizeof(bits) );
+        append_little_endian( buffer, bits, sizeof(bits) );
+    } else {
+        uint64_t bits;
+        memcpy( &bits, &distance, sizeof(bits) );
+        append_little_endian( buffer, bits, sizeof(bits) );
+    }
+};
+
+
+static void write_buffers( std::ofstream* files, const std::vector<std::string>& buffers, size_t count ) {
+    for ( size_t t = 0; t < count; t++ ) {
+        for ( size_t m = 0; m < METRIC_COUNT; m++ ) {
+            files[m].write( buffers[t * METRIC_COUNT + m].data(), buffers[t * METRIC_COUNT + m].size() );
+        }
+    }
+};
+
+
+void write_matrices( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const TriangularMatrix& matrix ) {
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    const size_t numGenomes = thread_arguments.size();
+    const output_format format = program_arguments.format;
+    const bool text = ( format == PHY || format == LOWER );
+    const char* extension = text ? ".phy" : ( format == NPY ? ".npy" : ".bin" );
+
+    // headers of the matrices
+    std::string header;
+
+    if ( text ) {
+        header = std::to_string( numGenomes ) + "\n";
+    } else if ( format == NPY ) {
+        std::string dictionary = "{'descr': '<f8', 'fortran_order': False, 'shape': (" + std::to_string( numGenomes ) + ", " + std::to_string( numGenomes ) + "), }";
+
+        // the header is padded with spaces and a newline, so that the data is 64-byte aligned
+        dictionary.append( 63 - ( 10 + dictionary.size() ) % 64, ' ' );
+        dictionary += '\n';
+
+        header.append( "\x93NUMPY\x01\x00", 8 );
+        append_little_endian( header, dictionary.size(), 2 );
+        header += dictionary;
+    } else {
+        header = MATRIX_MAGIC;
+        append_little_endian( header, format == BIN32 ? sizeof(float) : sizeof(double), 4 );
+        append_little_endian( header, numGenomes, 8 );
+    }
+
+    std::ofstream files[METRIC_COUNT];
+
+    for ( size_t m = 0; m < METRIC_COUNT; m++ ) {
+        std::string filename = program_arguments.prefix + "." + metric_names[m] + extension;
+        files[m].open( filename, std::ios::out | std::ios::binary );
+
+        if ( !files[m].is_open() ) {
+            log(ERROR, "Couldn't open %s", filename.c_str());
+            exit(1);
+        }
+
+        files[m].write( header.data(), header.size() );
+    }
+
+    // binary matrices have no room for the names of the genomes
+    if ( !text ) {
+        std::string filename = program_arguments.prefix + ".names";
+        std::ofstream names( filename, std::ios::out );
+
+        if ( !names.is_open() ) {
+            log(ERROR, "Couldn't open %s", filename.c_str());
+            exit(1);
+        }
+
+        for ( std::vector<struct targs>::const_iterator it = thread_arguments.begin(); it != thread_arguments.end(); it++ ) {
+            names << trimmed_name( it->shortName ) << std::endl;
+        }
+    }
+
+    // rows of a round, a text row has at most 18 characters per distance below 8 in addition to the name
+    const size_t row_size = text ? 18 * numGenomes + 16 : sizeof(double) * numGenomes;
+    const size_t rows_per_thread = std::max( (size_t)1, (size_t)WRITE_BUFFER_SIZE / std::max( (size_t)1, row_size ) );
+    const size_t thread_number = std::max( (size_t)1, program_arguments.threadNumber );
+
+    // a round is formatted while the previous one is written
+    std::vector<std::string> buffers[2];
+    buffers[0].resize( thread_number * METRIC_COUNT );
+    buffers[1].resize( thread_number * METRIC_COUNT );
+    std::thread writer;
+
+    for ( size_t row = 0, round = 0; row < numGenomes; round++ ) {
+        std::vector<std::string>& current = buffers[round & 1];
+        std::vector<std::thread> threads;
+
+        for ( size_t t = 0; t < thread_number && row < numGenomes; t++ ) {
+            size_t row_end = std::min( row + rows_per_thread, numGenomes );
+
+            for ( size_t m = 0; m < METRIC_COUNT; m++ ) {
+                current[t * METRIC_COUNT + m].clear();
+            }
+
+            threads.emplace_back( format_rows, std::cref(thread_arguments), format, std::cref(matrix), row, row_end, &current[t * METRIC_COUNT] );
+            row = row_end;
+        }
+
+        for ( std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); it++ ) {
+            if ((*it).joinable()) {
+                (*it).join();
+            }
+        }
+
+        if ( writer.joinable() ) {
+            writer.join();
+        }
+        writer = std::thread( write_buffers, files, std::cref(current), threads.size() );
+    }
+
+    if ( writer.joinable() ) {
+        writer.join();
+    }
+
+    for ( size_t m = 0; m < METRIC_COUNT; m++ ) {
+        files[m].close();
+
+        if ( files[m].fail() ) {
+            log(ERROR, "Failed to write %s.%s%s", program_arguments.prefix.c_str(), metric_names[m], extension);
+            exit(1);
+        }
+    }
+
+    if ( program_arguments.verbose ) {
+        double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+        log(INFO, "Wrote matrices in %.2f seconds", seconds);
+    }
+};
+
+
+void format_rows( const std::vector<struct targs>& thread_arguments, output_format format, const TriangularMatrix& matrix, size_t row_begin, size_t row_end, std::string* buffers ) {
+
+    const size_t numGenomes = thread_arguments.size();
+    const bool text = ( format == PHY || format == LOWER );
+
+    // the cells left of the rows are stored in the columns of the rows above them, a short segment 
+    // of every row; these rows are read in the order they are stored and transposed into a buffer
+    std::vector<struct similarity> columns( ( row_end - row_begin ) * row_begin );
+
+    for ( size_t j = 0; j < row_begin; j++ ) {
+        const struct similarity* segment = matrix.row( j ) + ( row_begin - j - 1 );
+
+        for ( size_t i = row_begin; i < row_end; i++ ) {
+            columns[( i - row_begin ) * row_begin + j] = segment[i - row_begin];
+        }
+    }
+
+    for ( size_t i = row_begin; i < row_end; i++ ) {
+
+        // the lower triangle ends before the diagonal
+        const size_t end = format == LOWER ? i : numGenomes;
+        const struct similarity* transposed = columns.data() + ( i - row_begin ) * row_begin;
+        const struct similarity* stored = matrix.row( i );
+
+        if ( text ) {
+            for ( size_t m = 0; m < METRIC_COUNT; m++ ) {
+                buffers[m] += thread_arguments[i].shortName;
+            }
+        }
+
+        for ( size_t j = 0; j < end; j++ ) {
+            // left of the range from the buffer, within the range from its nearby rows, right of the diagonal from the row
+            const struct similarity cell = j < row_begin ? transposed[j] : ( j <= i ? matrix.get( i, j ) : stored[j - i - 1] );
+            append_distance( buffers[0], format, cell.dice );
+            append_distance( buffers[1], format, cell.jaccard );
+            append_distance( buffers[2], format, cell.distance );
+        }
+
+        if ( text ) {
+            for ( size_t m = 0; m < METRIC_COUNT; m++ ) {
+                buffers[m] += '\n';
+            }
+        }
+    }
+};
+
+
+size_t format_fixed( double value, char* buffer ) {
+
+    // out of the exact range, including infinities and NaN
+    if ( !( std::fabs( value ) < 8 ) ) {
+        return snprintf( buffer, FORMAT_BUFFER_SIZE, "%.15f", value );
+    }
+
+    uint64_t bits;
+    memcpy( &bits, &value, sizeof(bits) );
+
+    char* position = buffer;
+
+    if ( bits >> 63 ) {
+        *position++ = '-';
+    }
+
+    // value = mantissa * 2^-shift
+    int exponent = ( bits >> 52 ) & 0x7FF;
+    uint64_t mantissa = bits & ( ( (uint64_t)1 << 52 ) - 1 );
+
+    if ( exponent ) {
+        mantissa |= (uint64_t)1 << 52;
+    } else {
+        exponent = 1;
+    }
+
+    const int shift = 1075 - exponent;
+    uint64_t scaled = 0;
+
+    // mantissa * 10^15 is below 2^103, so larger shifts round to 0
+    if ( shift < 104 ) {
+        unsigned __int128 product = (unsigned __int128)mantissa * 1000000000000000ULL;
+        scaled = (uint64_t)( product >> shift );
+
+        unsigned __int128 remainder = product - ( (unsigned __int128)scaled << shift );
+        unsigned __int128 half = (unsigned __int128)1 << ( shift - 1 );
+
+        // round half to even, as printf
+        if ( remainder > half || ( remainder == half && ( scaled & 1 ) ) ) {
+            scaled++;
+        }
+    }
+
+    uint64_t integer = scaled / 1000000000000000ULL;
+    uint64_t fraction = scaled % 1000000000000000ULL;
+
+    *position++ = '0' + integer;
+    *position++ = '.';
+
+    // 15 digits, written from the last one
+    char* digit = position + 15;
+    *--digit = '0' + fraction % 10;
+    fraction /= 10;
+
+    while ( digit != position ) {
+        digit -= 2;
+        memcpy( digit, digit_pairs + 2 * ( fraction % 100 ), 2 );
+        fraction /= 100;
+    }
+
+    return position + 15 - buffer;
+};
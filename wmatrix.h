@@ -0,0 +1,95 @@
+#ifndef WMATRIX_H
+#define WMATRIX_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include "args.h"
+#include "logging.h"
+#include "fileio.h"
+#include "utils/TriangularMatrix.hpp"
+
+// bytes of formatted rows collected by a thread for each metric before they are written
+#ifndef WRITE_BUFFER_SIZE
+#define WRITE_BUFFER_SIZE 16777216
+#endif
+
+// magic number of the binary matrix files
+#define MATRIX_MAGIC "GCMX"
+
+#define METRIC_COUNT 3
+
+// characters needed to format any double with `format_fixed()`
+#define FORMAT_BUFFER_SIZE 400
+
+
+/**
+ * @brief Writes the distance matrices of the Dice, Jaccard and normalized vector similarities.
+ *
+ * Every metric is written to `<prefix>.<metric>.<extension>`, where the metrics are `dice`,
+ * `jaccard` and `ns`, as the distance `1 - similarity`. The format is chosen with `--format`:
+ *
+ * - `phy`: square PHYLIP matrix, the number of genomes followed by a line per genome with its short
+ *   name and its distances to all genomes, with 15 decimal digits.
+ * - `lower`: lower-triangular PHYLIP matrix, the line of a genome only has the distances to the
+ *   genomes before it.
+ * - `bin` and `bin32`: `.bin` file with a 16-byte header, the magic number `GCMX`, the size of an
+ *   element (8 or 4) as a 32-bit integer and the number of genomes as a 64-bit integer, followed by
+ *   the square matrix in row-major order as float64 or float32 values. All numbers are little-endian.
+ * - `npy`: NumPy `.npy` file of a float64 square matrix.
+ *
+ * The short names of the genomes of binary matrices are written to `<prefix>.names`, one per line.
+ *
+ * The rows are formatted in rounds: each of the `threadNumber` threads formats a range of rows of
+ * all three metrics into its own buffers, by `format_rows()`, and the buffers are then written in
+ * the order of their rows. A round holds about `WRITE_BUFFER_SIZE` bytes per thread and metric,
+ * and is formatted while the previous one is written, so the buffers take up to
+ * 2 * `METRIC_COUNT` * `WRITE_BUFFER_SIZE` bytes per thread, in addition to the cells transposed by
+ * `format_rows()`.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param program_arguments A constant reference to the `pargs` structure.
+ * @param matrix A constant reference to the matrix of similarities.
+ */
+void write_matrices( const std::vector<struct targs>& thread_arguments, const struct pargs& program_arguments, const TriangularMatrix& matrix );
+
+/**
+ * @brief Formats a range of rows of the distance matrices.
+ *
+ * Worker routine of `write_matrices()`. Only the cells above the diagonal are stored, so the cells
+ * left of the diagonal are those of a column of the rows above. Instead of reading them column by
+ * column, which would touch a page of a mapped matrix per cell, the segments of the rows above the
+ * range are read in the order they are stored and transposed into a buffer of
+ * (row_end - row_begin) * row_begin cells, 24 bytes each.
+ *
+ * @param thread_arguments A constant reference to the vector of `targs` structures, one per genome.
+ * @param format The format of the matrices.
+ * @param matrix A constant reference to the matrix of similarities.
+ * @param row_begin The first row to be formatted.
+ * @param row_end The row after the last row to be formatted.
+ * @param buffers An array of `METRIC_COUNT` buffers, the Dice, Jaccard and normalized vector rows are
+ *        appended to, in this order.
+ */
+void format_rows( const std::vector<struct targs>& thread_arguments, output_format format, const TriangularMatrix& matrix, size_t row_begin, size_t row_end, std::string* buffers );
+
+/**
+ * @brief Formats a number with 15 digits after the decimal point.
+ *
+ * The result is identical to `printf("%.15f")`, or to `std::fixed` with `std::setprecision(15)`,
+ * including the rounding of ties to even. Numbers whose absolute value is below 8, as all
+ * distances, are rounded exactly with 128-bit integer arithmetic on their binary representation;
+ * other numbers are formatted by `snprintf`.
+ *
+ * @param value The number to be formatted.
+ * @param buffer The output buffer, of at least `FORMAT_BUFFER_SIZE` characters.
+ * @return The number of characters written, without a terminating null character.
+ */
+size_t format_fixed( double value, char* buffer );
+
+#endif